@@ -2,9 +2,23 @@ LOCAL_PATH:= $(call my-dir)
 
 include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= \
-	audio_hal.c
+	audio_hal.c \
+	audio_ring.c \
+	audio_route_engine.c \
+	audio_stats.c \
+	audio_tap.c
 #	AudioHardware.cpp
 
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_SRC_FILES += \
+	audio_conv.c.neon \
+	audio_resampler.c.neon
+else
+LOCAL_SRC_FILES += \
+	audio_conv.c \
+	audio_resampler.c
+endif
+
 LOCAL_MODULE := audio.primary.$(TARGET_DEVICE)
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_STATIC_LIBRARIES:= libmedia_helper
@@ -17,6 +31,7 @@ LOCAL_SHARED_LIBRARIES:= \
 
 #LOCAL_WHOLE_STATIC_LIBRARIES := libaudiohw_legacy
 LOCAL_MODULE_TAGS := optional
+LOCAL_REQUIRED_MODULES := tiny4412_mixer_paths.conf
 
 LOCAL_SHARED_LIBRARIES += libdl
 LOCAL_C_INCLUDES += \
@@ -45,6 +60,16 @@ include $(BUILD_SHARED_LIBRARY)
 
 include $(CLEAR_VARS)
 
+LOCAL_MODULE := tiny4412_mixer_paths.conf
+LOCAL_MODULE_CLASS := ETC
+LOCAL_MODULE_PATH := $(TARGET_OUT_ETC)
+LOCAL_SRC_FILES := $(LOCAL_MODULE)
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_PREBUILT)
+
+include $(CLEAR_VARS)
+
 LOCAL_SRC_FILES := AudioPolicyManager.cpp
 LOCAL_SHARED_LIBRARIES := libcutils libutils
 LOCAL_STATIC_LIBRARIES := libmedia_helper
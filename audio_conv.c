@@ -0,0 +1,516 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* sample format and channel conversion kernels. The NEON versions process 8
+ * frames per iteration, the scalar loops handle the tail and non NEON builds.
+ * CONV_NO_NEON forces the scalar loops, for comparing both in tests/ */
+
+#include <math.h>
+#include <string.h>
+
+#include "audio_conv.h"
+
+#if defined(__ARM_NEON__) && !defined(CONV_NO_NEON)
+#include <arm_neon.h>
+#define CONV_USE_NEON
+#endif
+
+void conv_stereo_to_mono(int16_t *dst, const int16_t *src, size_t frames,
+                         enum conv_downmix mode)
+{
+    size_t i = 0;
+
+    switch (mode) {
+    case CONV_DOWNMIX_RIGHT:
+#ifdef CONV_USE_NEON
+        for (; i + 8 <= frames; i += 8) {
+            int16x8x2_t lr = vld2q_s16(src + i * 2);
+            vst1q_s16(dst + i, lr.val[1]);
+        }
+#endif
+        for (; i < frames; i++)
+            dst[i] = src[i * 2 + 1];
+        break;
+
+    case CONV_DOWNMIX_AVERAGE:
+#ifdef CONV_USE_NEON
+        for (; i + 8 <= frames; i += 8) {
+            int16x8x2_t lr = vld2q_s16(src + i * 2);
+            /* halving add cannot overflow */
+            vst1q_s16(dst + i, vhaddq_s16(lr.val[0], lr.val[1]));
+        }
+#endif
+        for (; i < frames; i++)
+            dst[i] = (int16_t)(((int32_t)src[i * 2] + src[i * 2 + 1]) >> 1);
+        break;
+
+    case CONV_DOWNMIX_LEFT:
+    default:
+#ifdef CONV_USE_NEON
+        for (; i + 8 <= frames; i += 8) {
+            int16x8x2_t lr = vld2q_s16(src + i * 2);
+            vst1q_s16(dst + i, lr.val[0]);
+        }
+#endif
+        for (; i < frames; i++)
+            dst[i] = src[i * 2];
+        break;
+    }
+}
+
+void conv_mono_to_stereo(int16_t *dst, const int16_t *src, size_t frames)
+{
+    size_t i = 0;
+
+#ifdef CONV_USE_NEON
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t lr;
+
+        lr.val[0] = vld1q_s16(src + i);
+        lr.val[1] = lr.val[0];
+        vst2q_s16(dst + i * 2, lr);
+    }
+#endif
+    for (; i < frames; i++) {
+        dst[i * 2] = src[i];
+        dst[i * 2 + 1] = src[i];
+    }
+}
+
+void conv_deinterleave_stereo(int16_t *left, int16_t *right, const int16_t *src,
+                              size_t frames)
+{
+    size_t i = 0;
+
+#ifdef CONV_USE_NEON
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t lr = vld2q_s16(src + i * 2);
+
+        vst1q_s16(left + i, lr.val[0]);
+        vst1q_s16(right + i, lr.val[1]);
+    }
+#endif
+    for (; i < frames; i++) {
+        left[i] = src[i * 2];
+        right[i] = src[i * 2 + 1];
+    }
+}
+
+void conv_float_to_s16(int16_t *dst, const float *src, size_t samples)
+{
+    size_t i = 0;
+
+#ifdef CONV_USE_NEON
+    for (; i + 8 <= samples; i += 8) {
+        float32x4_t lo = vmulq_n_f32(vld1q_f32(src + i), 32768.0f);
+        float32x4_t hi = vmulq_n_f32(vld1q_f32(src + i + 4), 32768.0f);
+
+        /* the float to int conversion and the narrowing both saturate */
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(vcvtq_s32_f32(lo)),
+                                        vqmovn_s32(vcvtq_s32_f32(hi))));
+    }
+#endif
+    for (; i < samples; i++) {
+        float f = src[i] * 32768.0f;
+
+        /* converting a NaN is undefined, NEON gives 0 */
+        if (isnan(f))
+            dst[i] = 0;
+        else if (f >= 32767.0f)
+            dst[i] = INT16_MAX;
+        else if (f <= -32768.0f)
+            dst[i] = INT16_MIN;
+        else
+            dst[i] = (int16_t)f;
+    }
+}
+
+static inline int16_t clamp16(int32_t v)
+{
+    if (v > INT16_MAX)
+        return INT16_MAX;
+    if (v < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t)v;
+}
+
+void conv_s32_to_s16(int16_t *dst, const int32_t *src, size_t samples)
+{
+    size_t i = 0;
+
+#ifdef CONV_USE_NEON
+    for (; i + 8 <= samples; i += 8) {
+        vst1q_s16(dst + i, vcombine_s16(vqrshrn_n_s32(vld1q_s32(src + i), 16),
+                                        vqrshrn_n_s32(vld1q_s32(src + i + 4), 16)));
+    }
+#endif
+    for (; i < samples; i++)
+        dst[i] = clamp16((int32_t)(((int64_t)src[i] + 0x8000) >> 16));
+}
+
+void conv_q8_23_to_s16(int16_t *dst, const int32_t *src, size_t samples)
+{
+    size_t i = 0;
+
+#ifdef CONV_USE_NEON
+    for (; i + 8 <= samples; i += 8) {
+        vst1q_s16(dst + i, vcombine_s16(vqrshrn_n_s32(vld1q_s32(src + i), 8),
+                                        vqrshrn_n_s32(vld1q_s32(src + i + 4), 8)));
+    }
+#endif
+    for (; i < samples; i++)
+        dst[i] = clamp16((int32_t)(((int64_t)src[i] + 0x80) >> 8));
+}
+
+void conv_s24_packed_to_s16(int16_t *dst, const uint8_t *src, size_t samples)
+{
+    size_t i = 0;
+
+#ifdef CONV_USE_NEON
+    for (; i + 16 <= samples; i += 16) {
+        /* keep the two most significant bytes of each little endian sample */
+        uint8x16x3_t b = vld3q_u8(src + i * 3);
+        uint8x16x2_t s = vzipq_u8(b.val[1], b.val[2]);
+
+        vst1q_s16(dst + i, vreinterpretq_s16_u8(s.val[0]));
+        vst1q_s16(dst + i + 8, vreinterpretq_s16_u8(s.val[1]));
+    }
+#endif
+    for (; i < samples; i++)
+        dst[i] = (int16_t)(src[i * 3 + 1] | (src[i * 3 + 2] << 8));
+}
+
+void conv_gain_init(struct conv_gain *gain, float left, float right)
+{
+    gain->current[0] = gain->target[0] = left;
+    gain->current[1] = gain->target[1] = right;
+    gain->step[0] = gain->step[1] = 0;
+    gain->ramp_frames = 0;
+}
+
+void conv_gain_set_target(struct conv_gain *gain, float left, float right, size_t frames)
+{
+    if (left == gain->target[0] && right == gain->target[1])
+        return;
+
+    if (frames == 0) {
+        conv_gain_init(gain, left, right);
+        return;
+    }
+
+    gain->target[0] = left;
+    gain->target[1] = right;
+    gain->step[0] = (left - gain->current[0]) / frames;
+    gain->step[1] = (right - gain->current[1]) / frames;
+    gain->ramp_frames = frames;
+}
+
+bool conv_gain_is_unity(const struct conv_gain *gain)
+{
+    return gain->ramp_frames == 0 && gain->current[0] == 1.0f && gain->current[1] == 1.0f;
+}
+
+static inline int16_t gain16(int16_t s, float g)
+{
+    float f = s * g;
+
+    if (f >= 32767.0f)
+        return INT16_MAX;
+    if (f <= -32768.0f)
+        return INT16_MIN;
+    return (int16_t)f;
+}
+
+#ifdef CONV_USE_NEON
+/* 8 samples times 2 gain vectors, truncated and saturated like the scalar code */
+static inline int16x8_t gain_s16x8(int16x8_t s, float32x4_t g_lo, float32x4_t g_hi)
+{
+    float32x4_t lo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(s))), g_lo);
+    float32x4_t hi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(s))), g_hi);
+
+    return vcombine_s16(vqmovn_s32(vcvtq_s32_f32(lo)), vqmovn_s32(vcvtq_s32_f32(hi)));
+}
+#endif
+
+/* constant gain over samples: the gain pattern repeats every 2 samples */
+static void gain_const_s16(int16_t *dst, const int16_t *src, size_t samples, float g0, float g1)
+{
+    size_t i = 0;
+
+    if (g0 == 0.0f && g1 == 0.0f) {
+        memset(dst, 0, samples * sizeof(int16_t));
+        return;
+    }
+
+#ifdef CONV_USE_NEON
+    {
+        const float gains[4] = { g0, g1, g0, g1 };
+        float32x4_t g = vld1q_f32(gains);
+
+        for (; i + 8 <= samples; i += 8)
+            vst1q_s16(dst + i, gain_s16x8(vld1q_s16(src + i), g, g));
+    }
+#endif
+    for (; i + 2 <= samples; i += 2) {
+        dst[i] = gain16(src[i], g0);
+        dst[i + 1] = gain16(src[i + 1], g1);
+    }
+    if (i < samples)
+        dst[i] = gain16(src[i], g0);
+}
+
+static void gain_ramp_s16(int16_t *dst, const int16_t *src, size_t frames,
+                          unsigned int channels, struct conv_gain *gain)
+{
+    float gl = gain->current[0];
+    float gr = gain->current[1];
+    size_t i = 0;
+    unsigned int c;
+
+    if (channels == 2) {
+#ifdef CONV_USE_NEON
+        /* 4 frames per iteration: frames 0-1 in lo, frames 2-3 in hi */
+        const float start[4] = { gl, gr, gl + gain->step[0], gr + gain->step[1] };
+        const float step2[4] = { 2 * gain->step[0], 2 * gain->step[1],
+                                 2 * gain->step[0], 2 * gain->step[1] };
+        float32x4_t g_lo = vld1q_f32(start);
+        float32x4_t d2 = vld1q_f32(step2);
+        float32x4_t d4 = vaddq_f32(d2, d2);
+
+        for (; i + 4 <= frames; i += 4) {
+            float32x4_t g_hi = vaddq_f32(g_lo, d2);
+
+            vst1q_s16(dst + i * 2, gain_s16x8(vld1q_s16(src + i * 2), g_lo, g_hi));
+            g_lo = vaddq_f32(g_lo, d4);
+        }
+        gl += i * gain->step[0];
+        gr += i * gain->step[1];
+#endif
+        for (; i < frames; i++) {
+            dst[i * 2] = gain16(src[i * 2], gl);
+            dst[i * 2 + 1] = gain16(src[i * 2 + 1], gr);
+            gl += gain->step[0];
+            gr += gain->step[1];
+        }
+    } else {
+        for (; i < frames; i++) {
+            for (c = 0; c < channels; c++)
+                dst[i * channels + c] = gain16(src[i * channels + c], gl);
+            gl += gain->step[0];
+        }
+        gr += frames * gain->step[1];
+    }
+
+    gain->current[0] = gl;
+    gain->current[1] = gr;
+}
+
+void conv_gain_s16(int16_t *dst, const int16_t *src, size_t frames, unsigned int channels,
+                   struct conv_gain *gain)
+{
+    size_t ramp = frames < gain->ramp_frames ? frames : gain->ramp_frames;
+
+    if (ramp > 0) {
+        gain_ramp_s16(dst, src, ramp, channels, gain);
+        gain->ramp_frames -= ramp;
+        if (gain->ramp_frames == 0)
+            conv_gain_init(gain, gain->target[0], gain->target[1]);
+        dst += ramp * channels;
+        src += ramp * channels;
+        frames -= ramp;
+    }
+
+    if (frames == 0)
+        return;
+
+    if (conv_gain_is_unity(gain)) {
+        if (dst != src)
+            memmove(dst, src, frames * channels * sizeof(int16_t));
+        return;
+    }
+
+    if (channels == 2)
+        gain_const_s16(dst, src, frames * 2, gain->current[0], gain->current[1]);
+    else
+        gain_const_s16(dst, src, frames * channels, gain->current[0], gain->current[0]);
+}
+
+static inline int16_t downmix16(const int16_t *frame, enum conv_downmix mode)
+{
+    switch (mode) {
+    case CONV_DOWNMIX_RIGHT:
+        return frame[1];
+    case CONV_DOWNMIX_AVERAGE:
+        return (int16_t)(((int32_t)frame[0] + frame[1]) >> 1);
+    case CONV_DOWNMIX_LEFT:
+    default:
+        return frame[0];
+    }
+}
+
+/* fold and scale frames, the gain moving by step every frame. returns the gain
+ * after the last frame */
+static float mono_gain_s16(int16_t *dst, const int16_t *src, size_t frames,
+                           enum conv_downmix mode, float g, float step)
+{
+    size_t i = 0;
+
+#ifdef CONV_USE_NEON
+    {
+        const float start[4] = { g, g + step, g + 2 * step, g + 3 * step };
+        float32x4_t g_lo = vld1q_f32(start);
+        float32x4_t d4 = vdupq_n_f32(4 * step);
+        float32x4_t d8 = vaddq_f32(d4, d4);
+
+        for (; i + 8 <= frames; i += 8) {
+            int16x8x2_t lr = vld2q_s16(src + i * 2);
+            int16x8_t m;
+
+            if (mode == CONV_DOWNMIX_RIGHT)
+                m = lr.val[1];
+            else if (mode == CONV_DOWNMIX_AVERAGE)
+                m = vhaddq_s16(lr.val[0], lr.val[1]);
+            else
+                m = lr.val[0];
+
+            vst1q_s16(dst + i, gain_s16x8(m, g_lo, vaddq_f32(g_lo, d4)));
+            g_lo = vaddq_f32(g_lo, d8);
+        }
+        g += i * step;
+    }
+#endif
+    for (; i < frames; i++) {
+        dst[i] = gain16(downmix16(src + i * 2, mode), g);
+        g += step;
+    }
+
+    return g;
+}
+
+void conv_stereo_to_mono_gain(int16_t *dst, const int16_t *src, size_t frames,
+                              enum conv_downmix mode, struct conv_gain *gain)
+{
+    size_t ramp = frames < gain->ramp_frames ? frames : gain->ramp_frames;
+
+    if (ramp > 0) {
+        gain->current[0] = mono_gain_s16(dst, src, ramp, mode, gain->current[0], gain->step[0]);
+        gain->current[1] += ramp * gain->step[1];
+        gain->ramp_frames -= ramp;
+        if (gain->ramp_frames == 0)
+            conv_gain_init(gain, gain->target[0], gain->target[1]);
+        dst += ramp;
+        src += ramp * 2;
+        frames -= ramp;
+    }
+
+    if (frames == 0)
+        return;
+
+    if (gain->current[0] == 1.0f)
+        conv_stereo_to_mono(dst, src, frames, mode);
+    else
+        mono_gain_s16(dst, src, frames, mode, gain->current[0], 0);
+}
+
+static void mix_const_s16(int16_t *dst, const int16_t *src, size_t samples, float g0, float g1)
+{
+    size_t i = 0;
+
+    if (g0 == 0.0f && g1 == 0.0f)
+        return;
+
+    if (g0 == 1.0f && g1 == 1.0f) {
+#ifdef CONV_USE_NEON
+        for (; i + 8 <= samples; i += 8)
+            vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i), vld1q_s16(src + i)));
+#endif
+        for (; i < samples; i++)
+            dst[i] = clamp16((int32_t)dst[i] + src[i]);
+        return;
+    }
+
+#ifdef CONV_USE_NEON
+    {
+        const float gains[4] = { g0, g1, g0, g1 };
+        float32x4_t g = vld1q_f32(gains);
+
+        for (; i + 8 <= samples; i += 8)
+            vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i),
+                                          gain_s16x8(vld1q_s16(src + i), g, g)));
+    }
+#endif
+    for (; i + 2 <= samples; i += 2) {
+        dst[i] = clamp16((int32_t)dst[i] + gain16(src[i], g0));
+        dst[i + 1] = clamp16((int32_t)dst[i + 1] + gain16(src[i + 1], g1));
+    }
+}
+
+/* see gain_ramp_s16(), stereo only */
+static void mix_ramp_s16(int16_t *dst, const int16_t *src, size_t frames,
+                         struct conv_gain *gain)
+{
+    float gl = gain->current[0];
+    float gr = gain->current[1];
+    size_t i = 0;
+
+#ifdef CONV_USE_NEON
+    {
+        const float start[4] = { gl, gr, gl + gain->step[0], gr + gain->step[1] };
+        const float step2[4] = { 2 * gain->step[0], 2 * gain->step[1],
+                                 2 * gain->step[0], 2 * gain->step[1] };
+        float32x4_t g_lo = vld1q_f32(start);
+        float32x4_t d2 = vld1q_f32(step2);
+        float32x4_t d4 = vaddq_f32(d2, d2);
+
+        for (; i + 4 <= frames; i += 4) {
+            float32x4_t g_hi = vaddq_f32(g_lo, d2);
+
+            vst1q_s16(dst + i * 2, vqaddq_s16(vld1q_s16(dst + i * 2),
+                                              gain_s16x8(vld1q_s16(src + i * 2), g_lo, g_hi)));
+            g_lo = vaddq_f32(g_lo, d4);
+        }
+        gl += i * gain->step[0];
+        gr += i * gain->step[1];
+    }
+#endif
+    for (; i < frames; i++) {
+        dst[i * 2] = clamp16((int32_t)dst[i * 2] + gain16(src[i * 2], gl));
+        dst[i * 2 + 1] = clamp16((int32_t)dst[i * 2 + 1] + gain16(src[i * 2 + 1], gr));
+        gl += gain->step[0];
+        gr += gain->step[1];
+    }
+
+    gain->current[0] = gl;
+    gain->current[1] = gr;
+}
+
+void conv_mix_s16(int16_t *dst, const int16_t *src, size_t frames, struct conv_gain *gain)
+{
+    size_t ramp = frames < gain->ramp_frames ? frames : gain->ramp_frames;
+
+    if (ramp > 0) {
+        mix_ramp_s16(dst, src, ramp, gain);
+        gain->ramp_frames -= ramp;
+        if (gain->ramp_frames == 0)
+            conv_gain_init(gain, gain->target[0], gain->target[1]);
+        dst += ramp * 2;
+        src += ramp * 2;
+        frames -= ramp;
+    }
+
+    if (frames > 0)
+        mix_const_s16(dst, src, frames * 2, gain->current[0], gain->current[1]);
+}
@@ -0,0 +1,59 @@
+#ifndef __AUDIO_CONV_H__
+#define __AUDIO_CONV_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* how a stereo capture is folded down to a mono stream */
+enum conv_downmix {
+    CONV_DOWNMIX_LEFT,      // keep the left channel
+    CONV_DOWNMIX_RIGHT,     // keep the right channel
+    CONV_DOWNMIX_AVERAGE,   // (L + R) / 2
+};
+
+/* fold interleaved stereo frames down to mono. dst may alias src */
+void conv_stereo_to_mono(int16_t *dst, const int16_t *src, size_t frames,
+                         enum conv_downmix mode);
+
+/* duplicate mono frames into interleaved stereo. dst must not alias src */
+void conv_mono_to_stereo(int16_t *dst, const int16_t *src, size_t frames);
+
+/* split interleaved stereo frames into two planar channels */
+void conv_deinterleave_stereo(int16_t *left, int16_t *right, const int16_t *src,
+                              size_t frames);
+
+/* convert samples to 16 bit with saturation. The count is in
+ * samples, not frames. dst may alias src */
+void conv_float_to_s16(int16_t *dst, const float *src, size_t samples);
+void conv_s32_to_s16(int16_t *dst, const int32_t *src, size_t samples);
+void conv_q8_23_to_s16(int16_t *dst, const int32_t *src, size_t samples);
+void conv_s24_packed_to_s16(int16_t *dst, const uint8_t *src, size_t samples);
+
+/* gain of interleaved 16 bit frames with de-zippering. Stereo frames use a
+ * left and a right gain, other channel counts use the left gain everywhere */
+struct conv_gain {
+    float current[2];
+    float target[2];
+    float step[2];          // added to current every frame while ramping
+    size_t ramp_frames;     // frames left before current reaches target
+};
+
+/* set the gain at once, without a ramp */
+void conv_gain_init(struct conv_gain *gain, float left, float right);
+/* ramp linearly from the current gain to left/right over frames */
+void conv_gain_set_target(struct conv_gain *gain, float left, float right, size_t frames);
+/* true when conv_gain_s16() would leave the samples untouched */
+bool conv_gain_is_unity(const struct conv_gain *gain);
+/* apply the gain with saturation, advancing the ramp. dst may alias src */
+void conv_gain_s16(int16_t *dst, const int16_t *src, size_t frames, unsigned int channels,
+                   struct conv_gain *gain);
+/* conv_stereo_to_mono() and conv_gain_s16() on the mono result in a single
+ * pass. The left gain is used. dst may alias src */
+void conv_stereo_to_mono_gain(int16_t *dst, const int16_t *src, size_t frames,
+                              enum conv_downmix mode, struct conv_gain *gain);
+/* add stereo src scaled by the gain to stereo dst with saturation, advancing
+ * the ramp. A zero gain leaves dst untouched */
+void conv_mix_s16(int16_t *dst, const int16_t *src, size_t frames, struct conv_gain *gain);
+
+#endif
@@ -20,7 +20,11 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <cutils/log.h>
 
@@ -32,6 +36,46 @@
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
+struct string_to_enum {
+    const char *name;
+    uint32_t value;
+};
+
+#define STRING_TO_ENUM(string) { #string, string }
+
+static const struct string_to_enum out_channels_name_to_enum_table[] = {
+    STRING_TO_ENUM(AUDIO_CHANNEL_OUT_STEREO),
+    STRING_TO_ENUM(AUDIO_CHANNEL_OUT_5POINT1),
+    STRING_TO_ENUM(AUDIO_CHANNEL_OUT_7POINT1),
+};
+
+/* mixer config path enabled while one of devices is selected */
+struct tiny4412_route {
+    audio_devices_t devices;
+    const char *path;
+};
+
+static const struct tiny4412_route out_routes[] = {
+    { AUDIO_DEVICE_OUT_SPEAKER, "speaker" },
+    { AUDIO_DEVICE_OUT_WIRED_HEADSET | AUDIO_DEVICE_OUT_WIRED_HEADPHONE, "headphone" },
+};
+
+/* compared with in_device, AUDIO_DEVICE_BIT_IN is stripped */
+static const struct tiny4412_route in_routes[] = {
+    { AUDIO_DEVICE_IN_BUILTIN_MIC | AUDIO_DEVICE_IN_BACK_MIC, "main-mic" },
+    { AUDIO_DEVICE_IN_WIRED_HEADSET, "headset-mic" },
+};
+
+/* client sample rates accepted by the primary and deep buffer outputs */
+static const unsigned int out_sample_rates[] = {
+    16000, 32000, 44100, 48000,
+};
+
+/* sample rates an HDMI sink may advertise, in order of preference after the default */
+static const unsigned int hdmi_sample_rates[] = {
+    32000, 44100, 48000, 88200, 96000, 176400, 192000,
+};
+
 struct pcm_config pcm_out_config = {
             channels : 2,
             rate : AUDIO_HW_OUT_SAMPLERATE,
@@ -43,6 +87,42 @@ struct pcm_config pcm_out_config = {
             silence_threshold : 0,
 };
 
+/* used by AUDIO_OUTPUT_FLAG_FAST streams so that the FastMixer can be enabled */
+struct pcm_config pcm_out_config_fast = {
+            channels : 2,
+            rate : AUDIO_HW_OUT_SAMPLERATE,
+            period_size : AUDIO_HW_OUT_FAST_PERIOD_SZ,
+            period_count : AUDIO_HW_OUT_FAST_PERIOD_CNT,
+            format : PCM_FORMAT_S16_LE,
+            start_threshold : 0,
+            stop_threshold : 0,
+            silence_threshold : 0,
+};
+
+/* used by AUDIO_OUTPUT_FLAG_DEEP_BUFFER streams to keep the CPU asleep between wakeups */
+struct pcm_config pcm_out_config_deep = {
+            channels : 2,
+            rate : AUDIO_HW_OUT_SAMPLERATE,
+            period_size : AUDIO_HW_OUT_DEEP_PERIOD_SZ,
+            period_count : AUDIO_HW_OUT_DEEP_PERIOD_CNT,
+            format : PCM_FORMAT_S16_LE,
+            start_threshold : 0,
+            stop_threshold : 0,
+            silence_threshold : 0,
+};
+
+/* rate and channels are filled in from the sink capabilities at open */
+struct pcm_config pcm_out_config_hdmi = {
+            channels : 6,
+            rate : AUDIO_HW_HDMI_SAMPLERATE,
+            period_size : AUDIO_HW_HDMI_PERIOD_SZ,
+            period_count : AUDIO_HW_HDMI_PERIOD_CNT,
+            format : PCM_FORMAT_S16_LE,
+            start_threshold : 0,
+            stop_threshold : 0,
+            silence_threshold : 0,
+};
+
 #if 0
 struct pcm_config pcm_config_in = {
     .channels = 2,
@@ -64,131 +144,1974 @@ struct pcm_config pcm_config_in = {
         silence_threshold : 0,
     };
 
+/* used by AUDIO_INPUT_FLAG_FAST streams to keep capture latency low */
+struct pcm_config pcm_config_in_fast = {
+        channels : 2,
+        rate : AUDIO_HW_IN_SAMPLERATE,
+        period_size : AUDIO_HW_IN_FAST_PERIOD_SZ,
+        period_count : AUDIO_HW_IN_FAST_PERIOD_CNT,
+        format : PCM_FORMAT_S16_LE,
+        start_threshold : 0,
+        stop_threshold : 0,
+        silence_threshold : 0,
+    };
+
+
+
+/* query the HDMI sink on PCM_CARD_SPDIF for its channel count and rate range */
+static int read_tiny4412_hdmi_caps(struct tiny4412_stream_out *out)
+{
+    struct pcm_params *params;
+    unsigned int max_channels;
+    int i = 0;
+
+    params = pcm_params_get(PCM_CARD_SPDIF, PCM_DEVICE, PCM_OUT);
+    if (params == NULL) {
+        ALOGE("read_tiny4412_hdmi_caps() cannot get params of card %d", PCM_CARD_SPDIF);
+        return -ENOSYS;
+    }
+
+    max_channels = pcm_params_get_max(params, PCM_PARAM_CHANNELS);
+    out->min_rate = pcm_params_get_min(params, PCM_PARAM_RATE);
+    out->max_rate = pcm_params_get_max(params, PCM_PARAM_RATE);
+    pcm_params_free(params);
+
+    memset(out->supported_channel_masks, 0, sizeof(out->supported_channel_masks));
+    if (max_channels >= 6)
+        out->supported_channel_masks[i++] = AUDIO_CHANNEL_OUT_5POINT1;
+    if (max_channels >= 8)
+        out->supported_channel_masks[i++] = AUDIO_CHANNEL_OUT_7POINT1;
+    if (i == 0)
+        out->supported_channel_masks[i++] = AUDIO_CHANNEL_OUT_STEREO;
+
+    ALOGI("HDMI sink: max_channels:%u,rate:%u-%u", max_channels, out->min_rate, out->max_rate);
+
+    return 0;
+}
+
+static bool is_tiny4412_hdmi_rate_supported(struct tiny4412_stream_out *out, unsigned int rate)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(hdmi_sample_rates); i++) {
+        if (hdmi_sample_rates[i] == rate)
+            return rate >= out->min_rate && rate <= out->max_rate;
+    }
+
+    return false;
+}
+
+/* pick the rate and channel mask of the HDMI stream. If the requested ones are
+ * not supported, config is updated with a supported suggestion and -EINVAL is
+ * returned so that the framework retries with it */
+static int negotiate_tiny4412_hdmi_config(struct tiny4412_stream_out *out,
+                                          struct audio_config *config)
+{
+    unsigned int i;
+    int ret = 0;
+
+    if (config->sample_rate == 0) {
+        config->sample_rate = AUDIO_HW_HDMI_SAMPLERATE;
+    }
+    if (!is_tiny4412_hdmi_rate_supported(out, config->sample_rate)) {
+        /* suggest the default rate, or else the first one the sink takes */
+        unsigned int rate = AUDIO_HW_HDMI_SAMPLERATE;
+
+        for (i = 0; !is_tiny4412_hdmi_rate_supported(out, rate); i++) {
+            if (i == ARRAY_SIZE(hdmi_sample_rates)) {
+                ALOGE("negotiate_tiny4412_hdmi_config() no rate in %u-%u",
+                      out->min_rate, out->max_rate);
+                return -EINVAL;
+            }
+            rate = hdmi_sample_rates[i];
+        }
+        config->sample_rate = rate;
+        ret = -EINVAL;
+    }
+
+    if (config->channel_mask == 0) {
+        config->channel_mask = out->supported_channel_masks[0];
+    }
+    for (i = 0; i < MAX_SUPPORTED_CHANNEL_MASKS; i++) {
+        if (out->supported_channel_masks[i] == config->channel_mask)
+            break;
+    }
+    if (i == MAX_SUPPORTED_CHANNEL_MASKS || out->supported_channel_masks[i] == 0) {
+        config->channel_mask = out->supported_channel_masks[0];
+        ret = -EINVAL;
+    }
+
+    if (config->format != AUDIO_FORMAT_DEFAULT &&
+            config->format != AUDIO_FORMAT_PCM_16_BIT) {
+        config->format = AUDIO_FORMAT_PCM_16_BIT;
+        ret = -EINVAL;
+    }
+
+    return ret;
+}
+
+/* mmap mode is used by low latency streams unless disabled with
+ * audio.tiny4412.out_mmap=0 or audio.tiny4412.in_mmap=0 */
+static bool is_tiny4412_mmap_enabled(unsigned int flags)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get((flags & PCM_IN) ? "audio.tiny4412.in_mmap" : "audio.tiny4412.out_mmap",
+                 value, "1");
+
+    return atoi(value) != 0;
+}
+
+/* audio.tiny4412.out_async=1 runs outputs through a ring and a writer thread,
+ * AUDIO_OUTPUT_FLAG_NON_BLOCKING streams always do. audio.tiny4412.in_async=1
+ * runs inputs through a capture thread and a ring */
+static bool is_tiny4412_async_enabled(unsigned int flags)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get((flags & PCM_IN) ? "audio.tiny4412.in_async" : "audio.tiny4412.out_async",
+                 value, "0");
+
+    return atoi(value) != 0;
+}
+
+/* audio.tiny4412.mixer=1 mixes all outputs but HDMI in software onto the
+ * PCM_DEVICE pcm, for codecs without a pcm per output type */
+static bool is_tiny4412_mixer_enabled(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("audio.tiny4412.mixer", value, "0");
+
+    return atoi(value) != 0;
+}
+
+/* audio.tiny4412.in_downmix selects how stereo capture is folded to mono:
+ * "left" (default), "right" or "average" */
+static enum conv_downmix get_tiny4412_downmix_mode(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("audio.tiny4412.in_downmix", value, "left");
+
+    if (strcmp(value, "right") == 0)
+        return CONV_DOWNMIX_RIGHT;
+    if (strcmp(value, "average") == 0)
+        return CONV_DOWNMIX_AVERAGE;
+
+    return CONV_DOWNMIX_LEFT;
+}
+
+/* capture resampler tier: audio.tiny4412.resampler forces "low", "medium",
+ * "high" or "speex", otherwise it follows the input source */
+static enum resampler_tier get_tiny4412_resampler_tier(audio_source_t source)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("audio.tiny4412.resampler", value, "");
+
+    if (strcmp(value, "low") == 0)
+        return RESAMPLER_TIER_LOW;
+    if (strcmp(value, "medium") == 0)
+        return RESAMPLER_TIER_MEDIUM;
+    if (strcmp(value, "high") == 0)
+        return RESAMPLER_TIER_HIGH;
+    if (strcmp(value, "speex") == 0)
+        return RESAMPLER_TIER_SPEEX;
+
+    switch (source) {
+    case AUDIO_SOURCE_VOICE_COMMUNICATION:
+    case AUDIO_SOURCE_HOTWORD:
+        return RESAMPLER_TIER_LOW;
+    case AUDIO_SOURCE_VOICE_RECOGNITION:
+        return RESAMPLER_TIER_MEDIUM;
+    default:
+        return RESAMPLER_TIER_HIGH;
+    }
+}
+
+/* ring of an async stream: twice the kernel buffer so that the client can run
+ * a full buffer ahead */
+static size_t get_tiny4412_out_ring_frames(struct tiny4412_stream_out *out)
+{
+    return out->config.period_size * out->config.period_count * 2;
+}
+
+/* must be called whenever out->config changes. A mixed stream waits in its ring
+ * and then in the mixer pcm, its own period geometry only sizes the ring */
+static void update_tiny4412_out_latency(struct tiny4412_stream_out *out)
+{
+    size_t frames;
+
+    if (out->config.rate == 0) {
+        out->latency_ms = AUDIO_HW_OUT_LATENCY_MS;
+        return;
+    }
+
+    if (out->mixed)
+        frames = pcm_out_config_fast.period_size * pcm_out_config_fast.period_count +
+                 get_tiny4412_out_ring_frames(out);
+    else
+        frames = out->config.period_size * out->config.period_count;
+
+    out->latency_ms = (frames * 1000) / out->config.rate + AUDIO_HW_OUT_LATENCY_MS;
+}
+
+static bool is_tiny4412_out_rate_supported(uint32_t rate)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(out_sample_rates); i++) {
+        if (out_sample_rates[i] == rate)
+            return true;
+    }
+
+    return false;
+}
+
+static bool is_tiny4412_out_format_supported(audio_format_t format)
+{
+    switch (format) {
+    case AUDIO_FORMAT_PCM_16_BIT:
+    case AUDIO_FORMAT_PCM_FLOAT:
+    case AUDIO_FORMAT_PCM_32_BIT:
+    case AUDIO_FORMAT_PCM_8_24_BIT:
+    case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* true if the codec can run the output pcm at rate, so no resampling is needed */
+static bool is_tiny4412_out_rate_native(struct tiny4412_stream_out *out, uint32_t rate)
+{
+    struct pcm_params *params;
+    bool native;
+
+    if (rate == AUDIO_HW_OUT_SAMPLERATE)
+        return true;
+
+    params = pcm_params_get(out->pcm_card_type, out->pcm_device, PCM_OUT);
+    if (params == NULL)
+        return false;
+
+    native = rate >= pcm_params_get_min(params, PCM_PARAM_RATE) &&
+             rate <= pcm_params_get_max(params, PCM_PARAM_RATE);
+    pcm_params_free(params);
+
+    return native;
+}
+
+/* run the pcm at rate if the codec supports it, otherwise at the default rate
+ * with in-HAL resampling. Mixed streams are always resampled to the mixer rate.
+ * must be called with out->lock held, in standby */
+static int set_tiny4412_out_sample_rate(struct tiny4412_stream_out *out, uint32_t rate)
+{
+    int ret;
+
+    if (!is_tiny4412_out_rate_supported(rate))
+        return -EINVAL;
+
+    if (out->resampler) {
+        release_tiny4412_resampler(out->resampler);
+        out->resampler = NULL;
+    }
+
+    out->sample_rate = rate;
+    /* the mixer pcm runs at the default rate whatever the codec could do */
+    if (out->mixed)
+        out->config.rate = AUDIO_HW_OUT_SAMPLERATE;
+    else
+        out->config.rate = is_tiny4412_out_rate_native(out, rate) ? rate : AUDIO_HW_OUT_SAMPLERATE;
+
+    if (out->config.rate != rate) {
+        ret = create_tiny4412_resampler(rate, out->config.rate, out->config.channels,
+                                        RESAMPLER_TIER_HIGH, NULL, &out->resampler);
+        if (ret != 0) {
+            ALOGE("set_tiny4412_out_sample_rate() cannot resample %u -> %u",
+                  rate, out->config.rate);
+            out->resampler = NULL;
+            return ret;
+        }
+    }
+
+    update_tiny4412_out_latency(out);
+    audio_tap_set_format(out->taps[AUDIO_TAP_PRE_RESAMPLE], out->sample_rate,
+                         out->config.channels);
+    audio_tap_set_format(out->taps[AUDIO_TAP_POST_RESAMPLE], out->config.rate,
+                         out->config.channels);
+
+    return 0;
+}
+
+/* make sure *buffer holds at least bytes. Only reallocates when growing */
+static int16_t *get_tiny4412_scratch(int16_t **buffer, size_t *size, size_t bytes)
+{
+    if (*size < bytes) {
+        int16_t *buf = realloc(*buffer, bytes);
+
+        if (buf == NULL)
+            return NULL;
+        *buffer = buf;
+        *size = bytes;
+    }
+
+    return *buffer;
+}
+
+/* follow the stream volume, mute and the master volume and mute with a ramp.
+ * a pending device switch mutes too, see set_tiny4412_out_device() */
+static void update_tiny4412_out_gain(struct tiny4412_stream_out *out)
+{
+    struct tiny4412_audio_device *adev = out->dev;
+    bool muted = out->muted || out->route_muted;
+    float master = atomic_load(&adev->master_mute) ? 0 : atomic_load(&adev->master_volume);
+    float left = muted ? 0 : out->volume[0] * master;
+    float right = muted ? 0 : out->volume[1] * master;
+
+    conv_gain_set_target(&out->gain, left, right,
+                         out->config.rate * AUDIO_HW_GAIN_RAMP_MS / 1000);
+}
+
+/* convert a client buffer to 16 bit samples at the pcm rate. Returns the data
+ * to hand to the pcm and its size in *pcm_bytes, or NULL on allocation failure */
+static const void *convert_tiny4412_out(struct tiny4412_stream_out *out, const void *buffer,
+                                        size_t frames, size_t *pcm_bytes)
+{
+    size_t samples = frames * out->config.channels;
+    const void *data = buffer;
+
+    if (out->format != AUDIO_FORMAT_PCM_16_BIT) {
+        int16_t *dst = get_tiny4412_scratch(&out->fmt_buffer, &out->fmt_buffer_size,
+                                            samples * sizeof(int16_t));
+        if (dst == NULL)
+            return NULL;
+
+        switch (out->format) {
+        case AUDIO_FORMAT_PCM_FLOAT:
+            conv_float_to_s16(dst, (const float *)buffer, samples);
+            break;
+        case AUDIO_FORMAT_PCM_32_BIT:
+            conv_s32_to_s16(dst, (const int32_t *)buffer, samples);
+            break;
+        case AUDIO_FORMAT_PCM_8_24_BIT:
+            conv_q8_23_to_s16(dst, (const int32_t *)buffer, samples);
+            break;
+        case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+            conv_s24_packed_to_s16(dst, (const uint8_t *)buffer, samples);
+            break;
+        default:
+            memset(dst, 0, samples * sizeof(int16_t));
+            break;
+        }
+        data = dst;
+    }
+    audio_tap_write(out->taps[AUDIO_TAP_PRE_RESAMPLE], data, samples * sizeof(int16_t));
+
+    if (out->resampler) {
+        const int16_t *src = data;
+        /* room for the rounding of the ratio and the frames held in the filter */
+        size_t room = frames * out->config.rate / out->sample_rate + AUDIO_HW_OUT_RS_MARGIN;
+        size_t done = 0;
+        int16_t *dst = get_tiny4412_scratch(&out->rs_buffer, &out->rs_buffer_size,
+                                            room * out->config.channels * sizeof(int16_t));
+        if (dst == NULL)
+            return NULL;
+
+        /* the resampler may take the input in several passes */
+        while (frames > 0) {
+            size_t in_frames = frames;
+            size_t out_frames = room - done;
+
+            out->resampler->resample_from_input(out->resampler, (int16_t *)src, &in_frames,
+                                                dst + done * out->config.channels, &out_frames);
+            if (in_frames == 0) {
+                ALOGW("convert_tiny4412_out() resampler stalled, %zu frames dropped", frames);
+                break;
+            }
+            src += in_frames * out->config.channels;
+            frames -= in_frames;
+            done += out_frames;
+        }
+        frames = done;
+        data = dst;
+    }
+
+    *pcm_bytes = frames * out->config.channels * sizeof(int16_t);
+
+    /* a mixed stream gets its gain while being mixed, see conv_mix_s16() */
+    if (out->mixed)
+        goto exit;
+
+    update_tiny4412_out_gain(out);
+    if (!conv_gain_is_unity(&out->gain)) {
+        /* never write into the client buffer */
+        int16_t *dst = (data == buffer) ?
+                get_tiny4412_scratch(&out->gain_buffer, &out->gain_buffer_size, *pcm_bytes) :
+                (int16_t *)data;
+        if (dst == NULL)
+            return NULL;
+
+        conv_gain_s16(dst, (const int16_t *)data, frames, out->config.channels, &out->gain);
+        data = dst;
+    }
+
+exit:
+    audio_tap_write(out->taps[AUDIO_TAP_POST_RESAMPLE], data, *pcm_bytes);
+
+    return data;
+}
+
+static int64_t get_tiny4412_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* CPU time of the calling thread: excludes the time blocked in the driver */
+static int64_t get_tiny4412_cpu_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* audio.tiny4412.warm_standby_ms: how long a pcm stays open and prepared in
+ * standby before it is really closed. 0, the default, closes it right away as
+ * before; boards that pay for a pcm_open() on every resume set e.g. 2000 */
+static uint32_t get_tiny4412_warm_standby_ms(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("audio.tiny4412.warm_standby_ms", value, "0");
+
+    return atoi(value) > 0 ? atoi(value) : 0;
+}
+
+/* go to standby. Unless cold is true or warm standby is disabled, the pcm is
+ * only stopped so that leaving standby costs a pcm_prepare() instead of a
+ * pcm_open(). A stream already in warm standby is closed when cold is true */
+static void do_tiny4412_out_standby(struct tiny4412_stream_out *out, bool cold)
+{
+    struct pcm *pcm = out->pcm[out->out_type];
+
+    if(!out->standby)
+    {
+        if (pcm && !cold && out->dev->warm_standby_ms > 0) {
+            pcm_stop(pcm);
+            out->standby_ns = get_tiny4412_time_ns();
+        } else if (pcm) {
+            pcm_close(pcm);
+            out->pcm[out->out_type] = NULL;
+        }
+        out->mmap_running = false;
+        out->standby = true;
+    } else if (pcm && cold) {
+        pcm_close(pcm);
+        out->pcm[out->out_type] = NULL;
+    }
+
+    return;
+}
+
+static void update_tiny4412_xrun(struct tiny4412_xrun_stats *stats, size_t frames, int64_t now)
+{
+    atomic_fetch_add(&stats->count, 1);
+    atomic_fetch_add(&stats->frames_lost, frames);
+    atomic_store(&stats->last_ns, now);
+}
+
+static void record_tiny4412_out_xrun(struct tiny4412_stream_out *out, size_t frames)
+{
+    int64_t now = get_tiny4412_time_ns();
+
+    update_tiny4412_xrun(&out->xruns, frames, now);
+    update_tiny4412_xrun(&out->dev->out_xruns, frames, now);
+}
+
+static void record_tiny4412_in_xrun(struct tiny4412_stream_in *in, size_t frames)
+{
+    int64_t now = get_tiny4412_time_ns();
+
+    update_tiny4412_xrun(&in->xruns, frames, now);
+    update_tiny4412_xrun(&in->dev->in_xruns, frames, now);
+    atomic_fetch_add(&in->frames_lost, frames);
+}
+
+static void dump_tiny4412_xruns(int fd, const char *name, struct tiny4412_xrun_stats *stats)
+{
+    dprintf(fd,"%s:%u,frames_lost:%llu,last_xrun_ns:%lld\n",name,
+            atomic_load(&stats->count),atomic_load(&stats->frames_lost),atomic_load(&stats->last_ns));
+}
+
+/* see do_tiny4412_out_standby() */
+static void do_tiny4412_in_standby(struct tiny4412_stream_in *in, bool cold)
+{
+    struct tiny4412_audio_device *adev = in->dev;
+
+    if (!in->standby) {
+        if (in->pcm && !cold && adev->warm_standby_ms > 0) {
+            pcm_stop(in->pcm);
+            in->standby_ns = get_tiny4412_time_ns();
+        } else if (in->pcm) {
+            pcm_close(in->pcm);
+            in->pcm = NULL;
+        }
+        in->standby = true;
+    } else if (in->pcm && cold) {
+        pcm_close(in->pcm);
+        in->pcm = NULL;
+    }
+
+}
+
+
+/* must be called with hw device outputs list, output stream, and hw device mutexes locked */
+static int start_tiny4412_output_stream(struct tiny4412_stream_out *out)
+{
+    struct tiny4412_audio_device *adev = out->dev;
+    int64_t begin = get_tiny4412_time_ns();
+
+    audio_timing_start(&out->timing, begin);
+
+    if (out->pcm[out->out_type]) {
+        /* leaving warm standby: the hw params are still in place */
+        if (pcm_prepare(out->pcm[out->out_type]) == 0) {
+            audio_histogram_add(&out->timing.start, get_tiny4412_time_ns() - begin);
+            return 0;
+        }
+        ALOGW("pcm_prepare() failed: %s, reopening",
+              pcm_get_error(out->pcm[out->out_type]));
+        pcm_close(out->pcm[out->out_type]);
+        out->pcm[out->out_type] = NULL;
+    }
+
+    if (out->use_mmap) {
+        out->pcm[out->out_type] = pcm_open(out->pcm_card_type, out->pcm_device,
+                                      PCM_OUT | PCM_MMAP | PCM_NOIRQ | PCM_NORESTART,
+                                      &out->config);
+        if (out->pcm[out->out_type] && !pcm_is_ready(out->pcm[out->out_type])) {
+            /* the driver cannot do mmap: use pcm_write() for this stream from now on */
+            ALOGW("pcm_open(PCM_MMAP) failed: %s, falling back to pcm_write",
+                  pcm_get_error(out->pcm[out->out_type]));
+            pcm_close(out->pcm[out->out_type]);
+            out->pcm[out->out_type] = NULL;
+            out->use_mmap = false;
+        }
+    }
+
+    if (!out->use_mmap)
+        out->pcm[out->out_type] = pcm_open(out->pcm_card_type, out->pcm_device,
+                                      PCM_OUT | PCM_NORESTART, &out->config);
+
+    if (out->pcm[out->out_type] && !pcm_is_ready(out->pcm[out->out_type])) {
+        ALOGE("pcm_open(PCM_CARD) failed: %s",
+              pcm_get_error(out->pcm[out->out_type]));
+        pcm_close(out->pcm[out->out_type]);
+        out->pcm[out->out_type] = NULL;
+        return -ENOMEM;
+    }
+
+    audio_histogram_add(&out->timing.start, get_tiny4412_time_ns() - begin);
+
+    return 0;
+}
+
+/* copy audio straight into the DMA ring of a PCM_MMAP|PCM_NOIRQ pcm. There are no
+ * period interrupts to wait on, so sleep until the hardware pointer has freed
+ * enough room. must be called with out->lock held */
+static int write_tiny4412_mmap(struct tiny4412_stream_out *out, const void *buffer, size_t bytes)
+{
+    struct pcm *pcm = out->pcm[out->out_type];
+    unsigned int buffer_frames = pcm_get_buffer_size(pcm);
+    unsigned int frames = pcm_bytes_to_frames(pcm, bytes);
+    const char *src = (const char *)buffer;
+    int avail;
+    int ret;
+
+    while (frames > 0) {
+        void *areas;
+        unsigned int offset;
+        unsigned int count;
+
+        avail = pcm_mmap_avail(pcm);
+        if (avail < 0)
+            return avail;
+
+        if ((unsigned int)avail > buffer_frames) {
+            /* the hardware pointer overtook the application pointer */
+            ALOGW("write_tiny4412_mmap() underrun, avail:%d", avail);
+            record_tiny4412_out_xrun(out, avail - buffer_frames);
+            out->mmap_running = false;
+            ret = pcm_prepare(pcm);
+            if (ret < 0)
+                return ret;
+            continue;
+        }
+
+        if (avail == 0) {
+            if (!out->mmap_running) {
+                ret = pcm_start(pcm);
+                if (ret < 0)
+                    return ret;
+                out->mmap_running = true;
+            } else {
+                count = frames < out->config.period_size ? frames : out->config.period_size;
+                usleep(count * 1000000LL / out->config.rate);
+            }
+            continue;
+        }
+
+        count = frames;
+        ret = pcm_mmap_begin(pcm, &areas, &offset, &count);
+        if (ret < 0)
+            return ret;
+
+        memcpy((char *)areas + pcm_frames_to_bytes(pcm, offset), src,
+               pcm_frames_to_bytes(pcm, count));
+
+        ret = pcm_mmap_commit(pcm, offset, count);
+        if (ret < 0)
+            return ret;
+
+        src += pcm_frames_to_bytes(pcm, count);
+        frames -= count;
+
+        /* start the DMA once a full period is queued */
+        if (!out->mmap_running &&
+                buffer_frames - pcm_mmap_avail(pcm) >= out->config.period_size) {
+            ret = pcm_start(pcm);
+            if (ret < 0)
+                return ret;
+            out->mmap_running = true;
+        }
+    }
+
+    return 0;
+}
+
+/* the pcms are opened with PCM_NORESTART so that xruns surface as -EPIPE here:
+ * count them, re-prepare the pcm and retry once */
+static int write_tiny4412_pcm(struct tiny4412_stream_out *out, const void *data, size_t bytes)
+{
+    struct pcm *pcm = out->pcm[out->out_type];
+    int64_t begin = get_tiny4412_time_ns();
+    int ret;
+
+    if (out->use_mmap) {
+        ret = write_tiny4412_mmap(out, data, bytes);
+        goto exit;
+    }
+
+    ret = pcm_write(pcm, (void *)data, bytes);
+    if (ret == -EPIPE) {
+        ALOGW("write_tiny4412_pcm() underrun");
+        /* the length of the gap is not known, nothing was dropped */
+        record_tiny4412_out_xrun(out, 0);
+        ret = pcm_prepare(pcm);
+        if (ret == 0)
+            ret = pcm_write(pcm, (void *)data, bytes);
+    }
+
+exit:
+    audio_histogram_add(&out->timing.io, get_tiny4412_time_ns() - begin);
+    if (ret == 0)
+        audio_timing_first_sample(&out->timing, get_tiny4412_time_ns());
+    return ret;
+}
+
+/* start a SCHED_FIFO thread, or a normal one if that is not permitted */
+static int create_tiny4412_rt_thread(pthread_t *thread, void *(*loop)(void *), void *context)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    int ret;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = AUDIO_HW_RT_PRIORITY;
+    pthread_attr_setschedparam(&attr, &param);
+    ret = pthread_create(thread, &attr, loop, context);
+    pthread_attr_destroy(&attr);
+
+    if (ret != 0) {
+        ALOGW("cannot create SCHED_FIFO thread: %d, using SCHED_NORMAL", ret);
+        ret = pthread_create(thread, NULL, loop, context);
+    }
+
+    return -ret;
+}
+
+/* drains out->ring into the pcm, opening and closing it as needed */
+static void *tiny4412_out_writer_loop(void *context)
+{
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)context;
+    size_t period_bytes = out->config.period_size * out->config.channels * sizeof(int16_t);
+    bool streaming = false;
+
+    pthread_mutex_lock(&out->writer_lock);
+    while (!out->writer_exit) {
+        stream_callback_t callback;
+        size_t bytes;
+        int ret;
+
+        if (out->writer_standby) {
+            audio_ring_flush(&out->ring);
+            do_tiny4412_out_standby(out, out->writer_cold);
+            out->writer_standby = false;
+            out->writer_cold = false;
+            streaming = false;
+            pthread_cond_broadcast(&out->space_cond);
+            continue;
+        }
+
+        bytes = audio_ring_readable(&out->ring);
+        if (bytes == 0) {
+            if (streaming)
+                out->ring_underruns++;
+            streaming = false;
+            pthread_cond_wait(&out->writer_cond, &out->writer_lock);
+            continue;
+        }
+        if (bytes < out->ring_fill_min)
+            out->ring_fill_min = bytes;
+
+        if (out->standby) {
+            ret = start_tiny4412_output_stream(out);
+            if (ret < 0) {
+                /* drop the audio rather than spin on a broken device */
+                audio_ring_flush(&out->ring);
+                pthread_cond_broadcast(&out->space_cond);
+                pthread_mutex_unlock(&out->writer_lock);
+                usleep(out->config.period_size * 1000000LL / out->config.rate);
+                pthread_mutex_lock(&out->writer_lock);
+                continue;
+            }
+            out->standby = false;
+        }
+        pthread_mutex_unlock(&out->writer_lock);
+
+        bytes = audio_ring_read(&out->ring, out->writer_buffer, period_bytes);
+        ret = write_tiny4412_pcm(out, out->writer_buffer, bytes);
+        if (ret != 0)
+            ALOGW("tiny4412_out_writer_loop() write error %d", ret);
+        streaming = true;
+
+        pthread_mutex_lock(&out->writer_lock);
+        pthread_cond_broadcast(&out->space_cond);
+        callback = out->write_ready_pending ? out->callback : NULL;
+        if (callback != NULL) {
+            void *cookie = out->callback_cookie;
+
+            out->write_ready_pending = false;
+            pthread_mutex_unlock(&out->writer_lock);
+            callback(STREAM_CBK_EVENT_WRITE_READY, NULL, cookie);
+            pthread_mutex_lock(&out->writer_lock);
+        }
+    }
+    pthread_mutex_unlock(&out->writer_lock);
+
+    return NULL;
+}
+
+/* see do_tiny4412_out_standby(). must be called with mixer->lock held */
+static void do_tiny4412_mixer_standby(struct tiny4412_mixer_engine *mixer, bool cold)
+{
+    if (!mixer->standby) {
+        if (mixer->pcm && !cold && mixer->dev->warm_standby_ms > 0) {
+            pcm_stop(mixer->pcm);
+            mixer->standby_ns = get_tiny4412_time_ns();
+        } else if (mixer->pcm) {
+            pcm_close(mixer->pcm);
+            mixer->pcm = NULL;
+        }
+        mixer->standby = true;
+    } else if (mixer->pcm && cold) {
+        pcm_close(mixer->pcm);
+        mixer->pcm = NULL;
+    }
+}
+
+/* must be called with mixer->lock held */
+static int start_tiny4412_mixer(struct tiny4412_mixer_engine *mixer)
+{
+    int64_t begin = get_tiny4412_time_ns();
+
+    if (mixer->pcm) {
+        if (pcm_prepare(mixer->pcm) == 0) {
+            mixer->standby = false;
+            audio_histogram_add(&mixer->start, get_tiny4412_time_ns() - begin);
+            return 0;
+        }
+        ALOGW("pcm_prepare() failed: %s, reopening", pcm_get_error(mixer->pcm));
+        pcm_close(mixer->pcm);
+        mixer->pcm = NULL;
+    }
+
+    mixer->pcm = pcm_open(PCM_CARD, PCM_DEVICE, PCM_OUT | PCM_NORESTART, &mixer->config);
+    if (mixer->pcm && !pcm_is_ready(mixer->pcm)) {
+        ALOGE("pcm_open(PCM_CARD) failed: %s", pcm_get_error(mixer->pcm));
+        pcm_close(mixer->pcm);
+        mixer->pcm = NULL;
+        return -ENOMEM;
+    }
+
+    mixer->standby = false;
+    audio_histogram_add(&mixer->start, get_tiny4412_time_ns() - begin);
+
+    return 0;
+}
+
+/* write the mixed period, see write_tiny4412_pcm(). Runs without mixer->lock,
+ * the pcm is not touched by anyone else while it plays */
+static int write_tiny4412_mixer(struct tiny4412_mixer_engine *mixer)
+{
+    size_t bytes = pcm_frames_to_bytes(mixer->pcm, mixer->config.period_size);
+    int64_t begin = get_tiny4412_time_ns();
+    int ret;
+
+    ret = pcm_write(mixer->pcm, mixer->buffer, bytes);
+    if (ret == -EPIPE) {
+        int64_t now = get_tiny4412_time_ns();
+
+        ALOGW("write_tiny4412_mixer() underrun");
+        update_tiny4412_xrun(&mixer->xruns, 0, now);
+        update_tiny4412_xrun(&mixer->dev->out_xruns, 0, now);
+        ret = pcm_prepare(mixer->pcm);
+        if (ret == 0)
+            ret = pcm_write(mixer->pcm, mixer->buffer, bytes);
+    }
+    audio_histogram_add(&mixer->io, get_tiny4412_time_ns() - begin);
+
+    return ret;
+}
+
+/* must be called with mixer->lock held */
+static bool has_tiny4412_mixer_clients(struct tiny4412_mixer_engine *mixer)
+{
+    int i;
+
+    for (i = 0; i < AUDIO_HW_MAX_MIXER_CLIENTS; i++)
+        if (mixer->clients[i] && !mixer->clients[i]->standby)
+            return true;
+
+    return false;
+}
+
+/* mix up to one period of every running client into mixer->buffer. A client
+ * short of a full period plays what it has, the rest of its period is silent.
+ * Write ready callbacks owed are returned in callbacks and cookies, they are
+ * called by the caller once mixer->lock is released.
+ * must be called with mixer->lock held. returns the number of callbacks */
+static int mix_tiny4412_clients(struct tiny4412_mixer_engine *mixer,
+                                stream_callback_t *callbacks, void **cookies)
+{
+    size_t period_bytes = mixer->config.period_size * 2 * sizeof(int16_t);
+    int64_t now = get_tiny4412_time_ns();
+    int n = 0;
+    int i;
+
+    memset(mixer->buffer, 0, period_bytes);
+
+    for (i = 0; i < AUDIO_HW_MAX_MIXER_CLIENTS; i++) {
+        struct tiny4412_stream_out *out = mixer->clients[i];
+        size_t bytes;
+
+        if (out == NULL || out->standby)
+            continue;
+
+        bytes = audio_ring_readable(&out->ring);
+        if (bytes < out->ring_fill_min)
+            out->ring_fill_min = bytes;
+        if (bytes > 0 && bytes < period_bytes)
+            out->ring_underruns++;
+
+        bytes = audio_ring_read(&out->ring, out->writer_buffer, period_bytes);
+        if (bytes > 0) {
+            update_tiny4412_out_gain(out);
+            conv_mix_s16(mixer->buffer, out->writer_buffer, bytes / (2 * sizeof(int16_t)),
+                         &out->gain);
+            audio_timing_first_sample(&out->timing, now);
+        }
+
+        pthread_mutex_lock(&out->writer_lock);
+        pthread_cond_broadcast(&out->space_cond);
+        if (out->write_ready_pending && out->callback != NULL) {
+            out->write_ready_pending = false;
+            callbacks[n] = out->callback;
+            cookies[n++] = out->callback_cookie;
+        }
+        pthread_mutex_unlock(&out->writer_lock);
+    }
+
+    return n;
+}
+
+/* the pcm is open while at least one client is out of standby */
+static void *tiny4412_mixer_loop(void *context)
+{
+    struct tiny4412_mixer_engine *mixer = (struct tiny4412_mixer_engine *)context;
+    stream_callback_t callbacks[AUDIO_HW_MAX_MIXER_CLIENTS];
+    void *cookies[AUDIO_HW_MAX_MIXER_CLIENTS];
+
+    pthread_mutex_lock(&mixer->lock);
+    while (!mixer->exit) {
+        int n;
+        int ret;
+
+        if (!has_tiny4412_mixer_clients(mixer)) {
+            do_tiny4412_mixer_standby(mixer, false);
+            pthread_cond_wait(&mixer->cond, &mixer->lock);
+            continue;
+        }
+
+        /* on a broken device the clients keep draining at the pcm pace
+         * rather than stall */
+        ret = mixer->standby ? start_tiny4412_mixer(mixer) : 0;
+
+        n = mix_tiny4412_clients(mixer, callbacks, cookies);
+        pthread_mutex_unlock(&mixer->lock);
+
+        while (n-- > 0)
+            callbacks[n](STREAM_CBK_EVENT_WRITE_READY, NULL, cookies[n]);
+
+        if (ret == 0)
+            ret = write_tiny4412_mixer(mixer);
+        if (ret != 0) {
+            ALOGW("tiny4412_mixer_loop() write error %d", ret);
+            usleep(mixer->config.period_size * 1000000LL / mixer->config.rate);
+        }
+
+        pthread_mutex_lock(&mixer->lock);
+        /* xruns were recovered already: reopen the pcm on the next period */
+        if (ret != 0)
+            do_tiny4412_mixer_standby(mixer, true);
+    }
+    do_tiny4412_mixer_standby(mixer, true);
+    pthread_mutex_unlock(&mixer->lock);
+
+    return NULL;
+}
+
+/* the mixer runs with the fast period so that FastMixer outputs keep their
+ * latency. The mix is stereo at AUDIO_HW_OUT_SAMPLERATE like every client */
+static int start_tiny4412_mixer_engine(struct tiny4412_audio_device *adev)
+{
+    struct tiny4412_mixer_engine *mixer = &adev->mixer;
+    int ret;
+
+    if (mixer->started)
+        return 0;
+
+    mixer->config = pcm_out_config_fast;
+    mixer->buffer = malloc(mixer->config.period_size * mixer->config.channels *
+                           sizeof(int16_t));
+    if (mixer->buffer == NULL)
+        return -ENOMEM;
+
+    mixer->standby = true;
+    ret = create_tiny4412_rt_thread(&mixer->thread, tiny4412_mixer_loop, mixer);
+    if (ret != 0) {
+        ALOGE("start_tiny4412_mixer_engine() cannot create mixer thread: %d", ret);
+        free(mixer->buffer);
+        mixer->buffer = NULL;
+        return ret;
+    }
+    mixer->started = true;
+
+    return 0;
+}
+
+static void stop_tiny4412_mixer_engine(struct tiny4412_audio_device *adev)
+{
+    struct tiny4412_mixer_engine *mixer = &adev->mixer;
+
+    if (!mixer->started)
+        return;
+
+    pthread_mutex_lock(&mixer->lock);
+    mixer->exit = true;
+    pthread_cond_signal(&mixer->cond);
+    pthread_mutex_unlock(&mixer->lock);
+    pthread_join(mixer->thread, NULL);
+    mixer->started = false;
+
+    free(mixer->buffer);
+    mixer->buffer = NULL;
+}
+
+/* leave standby: the mixer takes the stream's ring into the mix from its next
+ * period. must be called with out->lock held */
+static void run_tiny4412_out_mixed(struct tiny4412_stream_out *out)
+{
+    struct tiny4412_mixer_engine *mixer = &out->dev->mixer;
+
+    pthread_mutex_lock(&mixer->lock);
+    if (out->standby) {
+        audio_timing_start(&out->timing, get_tiny4412_time_ns());
+        out->standby = false;
+        pthread_cond_signal(&mixer->cond);
+    }
+    pthread_mutex_unlock(&mixer->lock);
+}
+
+static int add_tiny4412_mixer_client(struct tiny4412_mixer_engine *mixer,
+                                     struct tiny4412_stream_out *out)
+{
+    int ret = -EBUSY;
+    int i;
+
+    pthread_mutex_lock(&mixer->lock);
+    for (i = 0; i < AUDIO_HW_MAX_MIXER_CLIENTS; i++) {
+        if (mixer->clients[i] == NULL) {
+            mixer->clients[i] = out;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mixer->lock);
+
+    return ret;
+}
+
+/* set up the ring and, unless mixed, the writer thread of an async stream. A
+ * mixed stream is registered with the mixer instead. returns -EBUSY if the
+ * mixer has no room left */
+static int start_tiny4412_out_writer(struct tiny4412_stream_out *out, bool mixed)
+{
+    size_t frame_bytes = out->config.channels * sizeof(int16_t);
+    int ret;
+
+    ret = audio_ring_init(&out->ring, get_tiny4412_out_ring_frames(out) * frame_bytes);
+    if (ret != 0)
+        return ret;
+
+    out->writer_buffer = malloc(out->config.period_size * frame_bytes);
+    if (out->writer_buffer == NULL) {
+        audio_ring_release(&out->ring);
+        return -ENOMEM;
+    }
+
+    out->ring_fill_min = out->ring.size;
+    pthread_mutex_init(&out->writer_lock, NULL);
+    pthread_cond_init(&out->writer_cond, NULL);
+    pthread_cond_init(&out->space_cond, NULL);
+
+    if (mixed)
+        ret = add_tiny4412_mixer_client(&out->dev->mixer, out);
+    else
+        ret = create_tiny4412_rt_thread(&out->writer_thread, tiny4412_out_writer_loop, out);
+    if (ret != 0) {
+        ALOGE("start_tiny4412_out_writer() cannot start %s: %d", mixed ? "mixing" : "writer thread",
+              ret);
+        pthread_cond_destroy(&out->space_cond);
+        pthread_cond_destroy(&out->writer_cond);
+        pthread_mutex_destroy(&out->writer_lock);
+        free(out->writer_buffer);
+        out->writer_buffer = NULL;
+        audio_ring_release(&out->ring);
+        return ret;
+    }
+    out->async = true;
+    out->mixed = mixed;
+
+    return 0;
+}
+
+static void stop_tiny4412_out_writer(struct tiny4412_stream_out *out)
+{
+    struct tiny4412_mixer_engine *mixer = &out->dev->mixer;
+    int i;
+
+    if (!out->async)
+        return;
+
+    if (out->mixed) {
+        pthread_mutex_lock(&mixer->lock);
+        for (i = 0; i < AUDIO_HW_MAX_MIXER_CLIENTS; i++)
+            if (mixer->clients[i] == out)
+                mixer->clients[i] = NULL;
+        out->standby = true;
+        pthread_mutex_unlock(&mixer->lock);
+        out->mixed = false;
+    } else {
+        pthread_mutex_lock(&out->writer_lock);
+        out->writer_exit = true;
+        pthread_cond_signal(&out->writer_cond);
+        pthread_cond_broadcast(&out->space_cond);
+        pthread_mutex_unlock(&out->writer_lock);
+        pthread_join(out->writer_thread, NULL);
+    }
+
+    do_tiny4412_out_standby(out, true);
+    out->async = false;
+
+    pthread_cond_destroy(&out->space_cond);
+    pthread_cond_destroy(&out->writer_cond);
+    pthread_mutex_destroy(&out->writer_lock);
+    free(out->writer_buffer);
+    out->writer_buffer = NULL;
+    audio_ring_release(&out->ring);
+}
+
+/* put the stream in standby. In async mode the writer thread owns the pcm so
+ * the request is handed over to it. A cold standby closes the pcm, as needed
+ * before a configuration change, and waits for completion. A mixed stream
+ * only leaves the mix, the mixer pcm follows the last client.
+ * must be called with out->lock held */
+static void standby_tiny4412_out(struct tiny4412_stream_out *out, bool cold)
+{
+    struct tiny4412_mixer_engine *mixer = &out->dev->mixer;
+
+    if (!out->async) {
+        do_tiny4412_out_standby(out, cold);
+        return;
+    }
+
+    if (out->mixed) {
+        pthread_mutex_lock(&mixer->lock);
+        out->standby = true;
+        audio_ring_flush(&out->ring);
+        pthread_mutex_unlock(&mixer->lock);
+        /* release a client blocked on a full ring */
+        pthread_mutex_lock(&out->writer_lock);
+        pthread_cond_broadcast(&out->space_cond);
+        pthread_mutex_unlock(&out->writer_lock);
+        return;
+    }
+
+    pthread_mutex_lock(&out->writer_lock);
+    out->writer_standby = true;
+    out->writer_cold |= cold;
+    pthread_cond_signal(&out->writer_cond);
+    while (cold && out->writer_standby)
+        pthread_cond_wait(&out->space_cond, &out->writer_lock);
+    pthread_mutex_unlock(&out->writer_lock);
+}
+
+/* copy converted audio into the ring. The room check before converting is an
+ * estimate when resampling, so wait for the writer to drain the rest rather
+ * than drop it: the resampler state already moved past these frames.
+ * returns 0, or -EPIPE if the writer exited. must be called with out->lock held */
+static int queue_tiny4412_async(struct tiny4412_stream_out *out, const void *data, size_t bytes)
+{
+    const char *src = (const char *)data;
+    bool exited = false;
+
+    for (;;) {
+        size_t queued = audio_ring_write(&out->ring, src, bytes);
+
+        src += queued;
+        bytes -= queued;
+
+        pthread_mutex_lock(&out->writer_lock);
+        pthread_cond_signal(&out->writer_cond);
+        if (bytes == 0 || exited) {
+            pthread_mutex_unlock(&out->writer_lock);
+            break;
+        }
+        pthread_mutex_unlock(&out->lock);
+        while (audio_ring_writable(&out->ring) == 0 && !out->writer_exit)
+            pthread_cond_wait(&out->space_cond, &out->writer_lock);
+        exited = out->writer_exit;
+        pthread_mutex_unlock(&out->writer_lock);
+        pthread_mutex_lock(&out->lock);
+    }
+
+    return bytes == 0 ? 0 : -EPIPE;
+}
+
+/* queue client frames in the ring for the writer thread. Without
+ * AUDIO_OUTPUT_FLAG_NON_BLOCKING, wait for room without holding out->lock so
+ * that standby, dump and parameter changes are not stalled. returns the number
+ * of client frames accepted. must be called with out->lock held */
+static ssize_t write_tiny4412_async(struct tiny4412_stream_out *out, const void *buffer,
+                                    size_t frames)
+{
+    size_t frame_size = audio_stream_out_frame_size(&out->stream);
+    size_t pcm_frame_size = out->config.channels * sizeof(int16_t);
+    size_t period_bytes = out->config.period_size * pcm_frame_size;
+    size_t done = 0;
+
+    /* a pending standby would flush what is queued now */
+    pthread_mutex_lock(&out->writer_lock);
+    while (out->writer_standby && !out->writer_exit)
+        pthread_cond_wait(&out->space_cond, &out->writer_lock);
+    pthread_mutex_unlock(&out->writer_lock);
+
+    while (done < frames) {
+        size_t room = audio_ring_writable(&out->ring) / pcm_frame_size;
+        size_t chunk = frames - done;
+        const void *data;
+        size_t pcm_bytes;
+
+        if (out->resampler)
+            room = room > AUDIO_HW_OUT_RS_MARGIN ?
+                    (room - AUDIO_HW_OUT_RS_MARGIN) * out->sample_rate / out->config.rate : 0;
+        if (chunk > room)
+            chunk = room;
+
+        if (chunk == 0) {
+            bool full;
+
+            pthread_mutex_lock(&out->writer_lock);
+            if (out->flags & AUDIO_OUTPUT_FLAG_NON_BLOCKING) {
+                /* the writer may have made room since the check above */
+                full = audio_ring_writable(&out->ring) < period_bytes;
+                out->write_ready_pending = full;
+            } else {
+                pthread_mutex_unlock(&out->lock);
+                while (audio_ring_writable(&out->ring) < period_bytes && !out->writer_exit)
+                    pthread_cond_wait(&out->space_cond, &out->writer_lock);
+                full = out->writer_exit;
+                pthread_mutex_unlock(&out->writer_lock);
+                pthread_mutex_lock(&out->lock);
+                pthread_mutex_lock(&out->writer_lock);
+            }
+            pthread_mutex_unlock(&out->writer_lock);
+            if (full)
+                break;
+            continue;
+        }
+
+        data = convert_tiny4412_out(out, (const char *)buffer + done * frame_size,
+                                    chunk, &pcm_bytes);
+        if (data == NULL)
+            return done > 0 ? (ssize_t)done : -ENOMEM;
+
+        if (queue_tiny4412_async(out, data, pcm_bytes) != 0)
+            break;
+        out->written += chunk;
+        done += chunk;
+    }
+
+    return done;
+}
+
+static void reset_tiny4412_in_reader(struct tiny4412_stream_in *in)
+{
+    if (in->resampler)
+        in->resampler->reset(in->resampler);
+
+    in->frames_in = 0;
+    in->frames_buffered = 0;
+}
+
+/* gain and mic mute are set by other threads, the reading thread snapshots them */
+static float get_tiny4412_in_gain(struct tiny4412_stream_in *in)
+{
+    if (atomic_load(&in->dev->mic_mute) || in->route_muted)
+        return 0;
+
+    return atomic_load(&in->gain_value);
+}
+
+/* follow the stream gain, the mic mute and device switches with a ramp. Applied
+ * while the frames are folded to mono, so the stage costs no extra pass */
+static void update_tiny4412_in_gain(struct tiny4412_stream_in *in)
+{
+    float gain = get_tiny4412_in_gain(in);
+
+    conv_gain_set_target(&in->gain, gain, gain,
+                         in->config->rate * AUDIO_HW_GAIN_RAMP_MS / 1000);
+}
+
+/* the first frames after a start carry the pop of the codec powering up:
+ * fade in from silence over CAPTURE_START_RAMP_MS */
+static void ramp_tiny4412_in_gain(struct tiny4412_stream_in *in)
+{
+    float gain = get_tiny4412_in_gain(in);
+
+    conv_gain_init(&in->gain, 0, 0);
+    conv_gain_set_target(&in->gain, gain, gain,
+                         in->config->rate * CAPTURE_START_RAMP_MS / 1000);
+}
+
+static int start_tiny4412_input_stream(struct tiny4412_stream_in *in)
+{
+    struct tiny4412_audio_device *adev = in->dev;
+    int64_t begin = get_tiny4412_time_ns();
+
+    audio_timing_start(&in->timing, begin);
+
+    if (in->pcm) {
+        /* leaving warm standby: the hw params are still in place */
+        if (pcm_prepare(in->pcm) == 0 && (!in->use_mmap || pcm_start(in->pcm) == 0)) {
+            if (!in->async)
+                reset_tiny4412_in_reader(in);
+            ramp_tiny4412_in_gain(in);
+            audio_histogram_add(&in->timing.start, get_tiny4412_time_ns() - begin);
+            return 0;
+        }
+        ALOGW("pcm_prepare() failed: %s, reopening", pcm_get_error(in->pcm));
+        pcm_close(in->pcm);
+        in->pcm = NULL;
+    }
+
+    if (in->use_mmap) {
+        in->pcm = pcm_open(PCM_CARD, PCM_DEVICE, PCM_IN | PCM_MMAP | PCM_NOIRQ | PCM_NORESTART,
+                           in->config);
+        if (in->pcm && !pcm_is_ready(in->pcm)) {
+            /* the driver cannot do mmap: use pcm_read() for this stream from now on */
+            ALOGW("pcm_open(PCM_MMAP) failed: %s, falling back to pcm_read",
+                  pcm_get_error(in->pcm));
+            pcm_close(in->pcm);
+            in->pcm = NULL;
+            in->use_mmap = false;
+        }
+    }
+
+    if (!in->use_mmap)
+        in->pcm = pcm_open(PCM_CARD, PCM_DEVICE, PCM_IN | PCM_NORESTART, in->config);
+
+    if (in->pcm && !pcm_is_ready(in->pcm)) {
+        ALOGE("pcm_open() failed: %s", pcm_get_error(in->pcm));
+        pcm_close(in->pcm);
+        in->pcm = NULL;
+        return -ENOMEM;
+    }
+
+    /* capture does not start on its own when only the mmap pointers move */
+    if (in->use_mmap && pcm_start(in->pcm) < 0) {
+        ALOGE("pcm_start() failed: %s", pcm_get_error(in->pcm));
+        pcm_close(in->pcm);
+        in->pcm = NULL;
+        return -EIO;
+    }
+
+    /* in async mode this runs on the capture thread, in_read() resets the
+     * reader side itself when it restarts the capture */
+    if (!in->async)
+        reset_tiny4412_in_reader(in);
+    ramp_tiny4412_in_gain(in);
+    audio_histogram_add(&in->timing.start, get_tiny4412_time_ns() - begin);
+
+    return 0;
+}
+
+static size_t get_tiny4412_input_buffer_size(unsigned int sample_rate,
+                                    audio_format_t format,
+                                    unsigned int channel_count,
+                                    bool is_low_latency)
+{
+    const struct pcm_config *config = is_low_latency ? &pcm_config_in_fast : &pcm_config_in;
+    size_t size;
+
+    /*
+     * take resampling into account and return the closest majoring
+     * multiple of 16 frames, as audioflinger expects audio buffers to
+     * be a multiple of 16 frames
+     */
+    size = (config->period_size * sample_rate) / config->rate;
+    size = ((size + 15) / 16) * 16;
+
+    return size * channel_count * audio_bytes_per_sample(format);
+}
+
+
+
+/* copy captured frames straight out of the DMA ring of a PCM_MMAP|PCM_NOIRQ pcm
+ * into dst, doing the stereo to mono extraction and the gain on the way. If partial is true,
+ * return as soon as some frames were delivered instead of waiting for all of them.
+ * returns the number of frames read or a negative error */
+static ssize_t read_tiny4412_mmap(struct tiny4412_stream_in *in, int16_t *dst,
+                                  size_t frames, bool partial)
+{
+    struct pcm *pcm = in->pcm;
+    unsigned int buffer_frames = pcm_get_buffer_size(pcm);
+    unsigned int channels = audio_channel_count_from_in_mask(in->channel_mask);
+    size_t frames_rd = 0;
+    int avail;
+    int ret;
+
+    while (frames_rd < frames) {
+        void *areas;
+        unsigned int offset;
+        unsigned int count;
+        const int16_t *src;
+
+        avail = pcm_mmap_avail(pcm);
+        if (avail < 0)
+            return avail;
+
+        if ((unsigned int)avail > buffer_frames) {
+            /* the hardware pointer overtook the application pointer */
+            ALOGW("read_tiny4412_mmap() overrun, avail:%d", avail);
+            /* what was overwritten plus what pcm_prepare() drops */
+            record_tiny4412_in_xrun(in, avail);
+            ret = pcm_prepare(pcm);
+            if (ret == 0)
+                ret = pcm_start(pcm);
+            if (ret < 0)
+                return ret;
+            continue;
+        }
+
+        if (avail == 0) {
+            if (partial && frames_rd > 0)
+                break;
+            /* no irq to wait on: sleep until the missing frames should be there */
+            count = frames - frames_rd;
+            if (count > in->config->period_size)
+                count = in->config->period_size;
+            usleep(count * 1000000LL / in->config->rate);
+            continue;
+        }
+
+        count = frames - frames_rd;
+        ret = pcm_mmap_begin(pcm, &areas, &offset, &count);
+        if (ret < 0)
+            return ret;
+
+        src = (const int16_t *)((char *)areas + pcm_frames_to_bytes(pcm, offset));
+        if (channels == 1)
+            conv_stereo_to_mono_gain(dst + frames_rd, src, count, in->downmix, &in->gain);
+        else
+            conv_gain_s16(dst + frames_rd * channels, src, count, channels, &in->gain);
+
+        ret = pcm_mmap_commit(pcm, offset, count);
+        if (ret < 0)
+            return ret;
+
+        frames_rd += count;
+    }
+
+    return frames_rd;
+}
+
+/* read one period with pcm_read(). Overruns are counted, the pcm re-prepared
+ * and the read retried once, see write_tiny4412_pcm() */
+static int read_tiny4412_pcm(struct tiny4412_stream_in *in, int16_t *dst)
+{
+    size_t bytes = pcm_frames_to_bytes(in->pcm, in->config->period_size);
+    int ret;
+
+    ret = pcm_read(in->pcm, dst, bytes);
+    if (ret == -EPIPE) {
+        ALOGW("read_tiny4412_pcm() overrun");
+        /* the whole kernel buffer was overwritten or is dropped by pcm_prepare() */
+        record_tiny4412_in_xrun(in, pcm_get_buffer_size(in->pcm));
+        ret = pcm_prepare(in->pcm);
+        if (ret == 0)
+            ret = pcm_read(in->pcm, dst, bytes);
+    }
+
+    return ret;
+}
+
+/* read up to one period from the pcm into dst, folded to mono for mono streams
+ * and scaled by the capture gain. returns the number of frames read or a
+ * negative error */
+static ssize_t read_tiny4412_period(struct tiny4412_stream_in *in, int16_t *dst, bool partial)
+{
+    size_t period = in->config->period_size;
+    int64_t begin = get_tiny4412_time_ns();
+    ssize_t frames_rd;
+    int ret;
+
+    update_tiny4412_in_gain(in);
+    if (in->use_mmap) {
+        frames_rd = read_tiny4412_mmap(in, dst, period, partial);
+    } else {
+        ret = read_tiny4412_pcm(in, dst);
+        frames_rd = ret == 0 ? (ssize_t)period : ret;
+        /* Do stereo to mono conversion and the gain in place */
+        if (ret == 0 && in->channel_count == 1)
+            conv_stereo_to_mono_gain(dst, dst, period, in->downmix, &in->gain);
+        else if (ret == 0 && !conv_gain_is_unity(&in->gain))
+            conv_gain_s16(dst, dst, period, in->channel_count, &in->gain);
+    }
+    audio_histogram_add(&in->timing.io, get_tiny4412_time_ns() - begin);
+    if (frames_rd > 0)
+        audio_tap_write(in->taps[AUDIO_TAP_PRE_RESAMPLE], dst,
+                        frames_rd * in->channel_count * sizeof(int16_t));
+
+    return frames_rd;
+}
+
+/* drains the pcm into in->ring one period at a time while capture_run is set.
+ * frames that do not fit in the ring are dropped and counted in frames_lost */
+static void *tiny4412_in_capture_loop(void *context)
+{
+    struct tiny4412_stream_in *in = (struct tiny4412_stream_in *)context;
+    size_t period = in->config->period_size;
+    size_t frame_size = in->channel_count * sizeof(int16_t);
+
+    pthread_mutex_lock(&in->capture_lock);
+    while (!in->capture_exit) {
+        ssize_t frames_rd;
+        size_t bytes;
+        int ret;
+
+        if (!in->capture_run) {
+            do_tiny4412_in_standby(in, false);
+            pthread_cond_broadcast(&in->data_cond);
+            pthread_cond_wait(&in->capture_cond, &in->capture_lock);
+            continue;
+        }
+
+        if (in->standby) {
+            ret = start_tiny4412_input_stream(in);
+            if (ret < 0) {
+                in->capture_status = ret;
+                pthread_cond_broadcast(&in->data_cond);
+                pthread_mutex_unlock(&in->capture_lock);
+                usleep(period * 1000000LL / in->config->rate);
+                pthread_mutex_lock(&in->capture_lock);
+                continue;
+            }
+            in->standby = false;
+        }
+        pthread_mutex_unlock(&in->capture_lock);
+
+        frames_rd = read_tiny4412_period(in, in->capture_buffer, false);
+
+        if (frames_rd < 0) {
+            ALOGE("tiny4412_in_capture_loop() read error %d", (int)frames_rd);
+            atomic_fetch_add(&in->frames_lost, period);
+        } else {
+            bytes = frames_rd * frame_size;
+            if (audio_ring_writable(&in->ring) < bytes) {
+                /* in_read() is not keeping up. Before the first in_read() after
+                 * a start the ring is only warming up, which is not a loss */
+                if (in->capture_reading)
+                    atomic_fetch_add(&in->frames_lost, frames_rd);
+            } else {
+                audio_ring_write(&in->ring, in->capture_buffer, bytes);
+            }
+        }
+
+        pthread_mutex_lock(&in->capture_lock);
+        in->capture_status = frames_rd < 0 ? (int)frames_rd : 0;
+        pthread_cond_broadcast(&in->data_cond);
+    }
+    do_tiny4412_in_standby(in, true);
+    pthread_mutex_unlock(&in->capture_lock);
+
+    return NULL;
+}
+
+/* copy captured frames out of in->ring. If partial is true, return as soon as
+ * some frames were delivered instead of waiting for all of them.
+ * returns the number of frames read or a negative error. must be called with
+ * in->lock held */
+static ssize_t read_tiny4412_ring(struct tiny4412_stream_in *in, int16_t *dst,
+                                  size_t frames, bool partial)
+{
+    size_t frame_size = in->channel_count * sizeof(int16_t);
+    size_t frames_rd = 0;
+
+    if (!in->capture_reading) {
+        /* drop what piled up during warm up, the pcm keeps running */
+        audio_ring_flush(&in->ring);
+        in->capture_reading = true;
+    }
+
+    while (frames_rd < frames) {
+        size_t bytes = audio_ring_read(&in->ring, dst + frames_rd * in->channel_count,
+                                       (frames - frames_rd) * frame_size);
+        int status;
+
+        frames_rd += bytes / frame_size;
+        if (bytes > 0 || frames_rd == frames)
+            continue;
+        if (partial && frames_rd > 0)
+            break;
+
+        pthread_mutex_lock(&in->capture_lock);
+        while (audio_ring_readable(&in->ring) == 0 && in->capture_status == 0 &&
+                !in->capture_exit)
+            pthread_cond_wait(&in->data_cond, &in->capture_lock);
+        status = in->capture_exit ? -ENODEV : in->capture_status;
+        pthread_mutex_unlock(&in->capture_lock);
+        if (status != 0 && audio_ring_readable(&in->ring) == 0)
+            return status;
+    }
+
+    return frames_rd;
+}
+
+/* see do_tiny4412_in_standby(). must be called with engine->lock held */
+static void do_tiny4412_capture_standby(struct tiny4412_capture_engine *engine, bool cold)
+{
+    if (!engine->standby) {
+        if (engine->pcm && !cold && engine->dev->warm_standby_ms > 0) {
+            pcm_stop(engine->pcm);
+            engine->standby_ns = get_tiny4412_time_ns();
+        } else if (engine->pcm) {
+            pcm_close(engine->pcm);
+            engine->pcm = NULL;
+        }
+        engine->standby = true;
+    } else if (engine->pcm && cold) {
+        pcm_close(engine->pcm);
+        engine->pcm = NULL;
+    }
+}
+
+/* must be called with engine->lock held */
+static int start_tiny4412_capture(struct tiny4412_capture_engine *engine)
+{
+    int64_t begin = get_tiny4412_time_ns();
+
+    if (engine->pcm) {
+        if (pcm_prepare(engine->pcm) == 0) {
+            engine->standby = false;
+            audio_histogram_add(&engine->start, get_tiny4412_time_ns() - begin);
+            return 0;
+        }
+        ALOGW("pcm_prepare() failed: %s, reopening", pcm_get_error(engine->pcm));
+        pcm_close(engine->pcm);
+        engine->pcm = NULL;
+    }
+
+    engine->pcm = pcm_open(PCM_CARD, PCM_DEVICE, PCM_IN | PCM_NORESTART, &engine->config);
+    if (engine->pcm && !pcm_is_ready(engine->pcm)) {
+        ALOGE("pcm_open() failed: %s", pcm_get_error(engine->pcm));
+        pcm_close(engine->pcm);
+        engine->pcm = NULL;
+        return -ENOMEM;
+    }
+
+    engine->standby = false;
+    audio_histogram_add(&engine->start, get_tiny4412_time_ns() - begin);
+
+    return 0;
+}
+
+/* read one period into engine->buffer, see read_tiny4412_pcm(). Runs without
+ * engine->lock, the pcm is not touched by anyone else while capturing */
+static ssize_t read_tiny4412_capture(struct tiny4412_capture_engine *engine)
+{
+    size_t period = engine->config.period_size;
+    size_t bytes = pcm_frames_to_bytes(engine->pcm, period);
+    int64_t begin = get_tiny4412_time_ns();
+    int ret;
+
+    ret = pcm_read(engine->pcm, engine->buffer, bytes);
+    if (ret == -EPIPE) {
+        ALOGW("read_tiny4412_capture() overrun");
+        engine->xrun_frames = pcm_get_buffer_size(engine->pcm);
+        update_tiny4412_xrun(&engine->dev->in_xruns, engine->xrun_frames,
+                             get_tiny4412_time_ns());
+        ret = pcm_prepare(engine->pcm);
+        if (ret == 0)
+            ret = pcm_read(engine->pcm, engine->buffer, bytes);
+    }
+    audio_histogram_add(&engine->io, get_tiny4412_time_ns() - begin);
 
+    return ret == 0 ? (ssize_t)period : ret;
+}
 
-void pcm_dump(const void* buffer, size_t bytes)
+/* hand the period just read to every running client: mono fold and gain into
+ * the client capture_buffer, then its ring. A client that is not reading fast
+ * enough loses frames without holding back the others.
+ * must be called with engine->lock held */
+static void fan_out_tiny4412_capture(struct tiny4412_capture_engine *engine, ssize_t frames_rd)
 {
-    int fd;
-    char value[PROPERTY_VALUE_MAX];
+    int64_t now = get_tiny4412_time_ns();
+    int i;
 
-    property_get("debug.audio.dumpdata",value,"0");
+    for (i = 0; i < AUDIO_HW_MAX_INPUTS; i++) {
+        struct tiny4412_stream_in *in = engine->clients[i];
+        size_t bytes;
 
-    if(atoi(value) != 1)
-    {
-        return ;
-    }
+        if (in == NULL || !in->capture_run)
+            continue;
 
-    fd = open("/data/data.pcm",O_WRONLY|O_CREAT|O_APPEND,0777);
-    if(fd < 0)
-    {
-        ALOGE("open file /data/data.pcm failed,errno is %d",errno);
-        return ;
-    }
+        if (engine->xrun_frames > 0) {
+            update_tiny4412_xrun(&in->xruns, engine->xrun_frames, now);
+            atomic_fetch_add(&in->frames_lost, engine->xrun_frames);
+        }
 
-    write(fd,buffer,bytes);
+        if (frames_rd < 0) {
+            atomic_fetch_add(&in->frames_lost, engine->config.period_size);
+        } else {
+            update_tiny4412_in_gain(in);
+            if (in->channel_count == 1)
+                conv_stereo_to_mono_gain(in->capture_buffer, engine->buffer, frames_rd,
+                                         in->downmix, &in->gain);
+            else
+                conv_gain_s16(in->capture_buffer, engine->buffer, frames_rd,
+                              in->channel_count, &in->gain);
+
+            bytes = frames_rd * in->channel_count * sizeof(int16_t);
+            audio_tap_write(in->taps[AUDIO_TAP_PRE_RESAMPLE], in->capture_buffer, bytes);
+            if (audio_ring_writable(&in->ring) < bytes) {
+                /* see tiny4412_in_capture_loop() */
+                if (in->capture_reading)
+                    atomic_fetch_add(&in->frames_lost, frames_rd);
+            } else {
+                audio_ring_write(&in->ring, in->capture_buffer, bytes);
+            }
+        }
 
-    return;
+        pthread_mutex_lock(&in->capture_lock);
+        in->capture_status = frames_rd < 0 ? (int)frames_rd : 0;
+        pthread_cond_broadcast(&in->data_cond);
+        pthread_mutex_unlock(&in->capture_lock);
+    }
+    engine->xrun_frames = 0;
 }
 
-static void do_tiny4412_out_standby(struct tiny4412_stream_out *out)
+/* must be called with engine->lock held */
+static bool has_tiny4412_capture_clients(struct tiny4412_capture_engine *engine)
 {
-    if(!out->standby)
-    {
-        if(out->pcm[out->out_type])
-        {
-            pcm_close(out->pcm[out->out_type]);
-            out->pcm[out->out_type] = NULL;
-        }
-        out->standby = true;
-    }
+    int i;
 
-    return;
+    for (i = 0; i < AUDIO_HW_MAX_INPUTS; i++)
+        if (engine->clients[i] && engine->clients[i]->capture_run)
+            return true;
+
+    return false;
 }
 
-static void do_tiny4412_in_standby(struct tiny4412_stream_in *in)
+/* the pcm is open while at least one client is running */
+static void *tiny4412_capture_loop(void *context)
 {
-    struct tiny4412_audio_device *adev = in->dev;
+    struct tiny4412_capture_engine *engine = (struct tiny4412_capture_engine *)context;
+    size_t period = engine->config.period_size;
+
+    pthread_mutex_lock(&engine->lock);
+    while (!engine->exit) {
+        ssize_t frames_rd;
+        int ret;
+
+        if (!has_tiny4412_capture_clients(engine)) {
+            do_tiny4412_capture_standby(engine, false);
+            pthread_cond_wait(&engine->cond, &engine->lock);
+            continue;
+        }
 
-    if (!in->standby) {
-        pcm_close(in->pcm);
-        in->pcm = NULL;
-        in->standby = true;
+        if (engine->standby) {
+            ret = start_tiny4412_capture(engine);
+            if (ret < 0) {
+                fan_out_tiny4412_capture(engine, ret);
+                pthread_mutex_unlock(&engine->lock);
+                usleep(period * 1000000LL / engine->config.rate);
+                pthread_mutex_lock(&engine->lock);
+                continue;
+            }
+        }
+        pthread_mutex_unlock(&engine->lock);
+
+        frames_rd = read_tiny4412_capture(engine);
+        if (frames_rd < 0)
+            ALOGE("tiny4412_capture_loop() read error %d", (int)frames_rd);
+
+        pthread_mutex_lock(&engine->lock);
+        fan_out_tiny4412_capture(engine, frames_rd);
     }
+    do_tiny4412_capture_standby(engine, true);
+    pthread_mutex_unlock(&engine->lock);
 
+    return NULL;
 }
 
-
-/* must be called with hw device outputs list, output stream, and hw device mutexes locked */
-static int start_tiny4412_output_stream(struct tiny4412_stream_out *out)
+/* the engine always captures with the fast period so that it serves low
+ * latency clients as well, the others only see more frequent ring writes */
+static int start_tiny4412_capture_engine(struct tiny4412_audio_device *adev)
 {
-    struct tiny4412_audio_device *adev = out->dev;
+    struct tiny4412_capture_engine *engine = &adev->capture;
+    int ret;
 
-    out->pcm[out->out_type] = pcm_open(out->pcm_card_type, out->pcm_device,
-                                  PCM_OUT , &out->config);
+    if (engine->started)
+        return 0;
 
-    if (out->pcm[out->out_type] && !pcm_is_ready(out->pcm[out->out_type])) {
-        ALOGE("pcm_open(PCM_CARD) failed: %s",
-              pcm_get_error(out->pcm[out->out_type]));
-        pcm_close(out->pcm[out->out_type]);
+    engine->config = pcm_config_in_fast;
+    engine->buffer = malloc(engine->config.period_size * engine->config.channels *
+                            sizeof(int16_t));
+    if (engine->buffer == NULL)
         return -ENOMEM;
+
+    engine->standby = true;
+    ret = create_tiny4412_rt_thread(&engine->thread, tiny4412_capture_loop, engine);
+    if (ret != 0) {
+        ALOGE("start_tiny4412_capture_engine() cannot create capture thread: %d", ret);
+        free(engine->buffer);
+        engine->buffer = NULL;
+        return ret;
     }
+    engine->started = true;
+
+    return 0;
+}
 
+static void stop_tiny4412_capture_engine(struct tiny4412_audio_device *adev)
+{
+    struct tiny4412_capture_engine *engine = &adev->capture;
 
+    if (!engine->started)
+        return;
 
-    adev->out_device |= out->device;
+    pthread_mutex_lock(&engine->lock);
+    engine->exit = true;
+    pthread_cond_signal(&engine->cond);
+    pthread_mutex_unlock(&engine->lock);
+    pthread_join(engine->thread, NULL);
+    engine->started = false;
 
-    return 0;
+    free(engine->buffer);
+    engine->buffer = NULL;
 }
 
-static int start_tiny4412_input_stream(struct tiny4412_stream_in *in)
+/* start feeding a shared stream: the reader starts from the next period
+ * captured, with the fade in of a pcm start. must be called with in->lock held */
+static void run_tiny4412_in_shared(struct tiny4412_stream_in *in)
 {
-    struct tiny4412_audio_device *adev = in->dev;
+    struct tiny4412_capture_engine *engine = &in->dev->capture;
+
+    pthread_mutex_lock(&engine->lock);
+    if (!in->capture_run) {
+        audio_timing_start(&in->timing, get_tiny4412_time_ns());
+        reset_tiny4412_in_reader(in);
+        ramp_tiny4412_in_gain(in);
+        pthread_mutex_lock(&in->capture_lock);
+        in->capture_status = 0;
+        pthread_mutex_unlock(&in->capture_lock);
+        in->capture_run = true;
+        in->standby = false;
+        pthread_cond_signal(&engine->cond);
+    }
+    pthread_mutex_unlock(&engine->lock);
+}
 
-    ALOGI("ethyn channel:%d,rate:%d,format:%d",in->config->channels,in->config->rate,in->config->format);
+/* set up the ring and, unless shared, the capture thread of an async stream.
+ * a shared stream is registered with the capture engine and stays idle until
+ * in_read() runs it */
+static int start_tiny4412_in_capture(struct tiny4412_stream_in *in, bool shared)
+{
+    struct tiny4412_capture_engine *engine = &in->dev->capture;
+    size_t frame_size = in->config->channels * sizeof(int16_t);
+    int ret;
 
-    in->pcm = pcm_open(PCM_CARD, PCM_DEVICE, PCM_IN, in->config);
+    ret = audio_ring_init(&in->ring,
+                          in->config->period_size * in->config->period_count * 2 * frame_size);
+    if (ret != 0)
+        return ret;
 
-    if (in->pcm && !pcm_is_ready(in->pcm)) {
-        ALOGE("pcm_open() failed: %s", pcm_get_error(in->pcm));
-        pcm_close(in->pcm);
+    in->capture_buffer = malloc(in->config->period_size * frame_size);
+    if (in->capture_buffer == NULL) {
+        audio_ring_release(&in->ring);
         return -ENOMEM;
     }
 
-    if (in->resampler)
-        in->resampler->reset(in->resampler);
+    pthread_mutex_init(&in->capture_lock, NULL);
+    pthread_cond_init(&in->capture_cond, NULL);
+    pthread_cond_init(&in->data_cond, NULL);
+    in->async = true;
 
+    if (shared) {
+        int i;
 
-    in->frames_in = 0;
+        pthread_mutex_lock(&engine->lock);
+        for (i = 0; i < AUDIO_HW_MAX_INPUTS; i++) {
+            if (engine->clients[i] == NULL) {
+                engine->clients[i] = in;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&engine->lock);
+        in->shared = true;
+        in->capture_run = false;
+        return 0;
+    }
+
+    /* warm up: the pcm is opened and filling the ring before the first in_read() */
+    in->capture_run = true;
+
+    ret = create_tiny4412_rt_thread(&in->capture_thread, tiny4412_in_capture_loop, in);
+    if (ret != 0) {
+        ALOGE("start_tiny4412_in_capture() cannot create capture thread: %d", ret);
+        in->async = false;
+        in->capture_run = false;
+        pthread_cond_destroy(&in->data_cond);
+        pthread_cond_destroy(&in->capture_cond);
+        pthread_mutex_destroy(&in->capture_lock);
+        free(in->capture_buffer);
+        in->capture_buffer = NULL;
+        audio_ring_release(&in->ring);
+        return ret;
+    }
 
     return 0;
 }
 
-static size_t get_tiny4412_input_buffer_size(unsigned int sample_rate,
-                                    audio_format_t format,
-                                    unsigned int channel_count,
-                                    bool is_low_latency)
+static void stop_tiny4412_in_capture(struct tiny4412_stream_in *in)
 {
-    const struct pcm_config *config = &pcm_config_in;
-    size_t size;
+    struct tiny4412_capture_engine *engine = &in->dev->capture;
+    int i;
 
-    /*
-     * take resampling into account and return the closest majoring
-     * multiple of 16 frames, as audioflinger expects audio buffers to
-     * be a multiple of 16 frames
-     */
-    size = (config->period_size * sample_rate) / config->rate;
-    size = ((size + 15) / 16) * 16;
+    if (!in->async)
+        return;
 
-    return size * channel_count * audio_bytes_per_sample(format);
+    if (in->shared) {
+        pthread_mutex_lock(&engine->lock);
+        for (i = 0; i < AUDIO_HW_MAX_INPUTS; i++)
+            if (engine->clients[i] == in)
+                engine->clients[i] = NULL;
+        in->capture_run = false;
+        pthread_mutex_unlock(&engine->lock);
+        in->shared = false;
+    } else {
+        pthread_mutex_lock(&in->capture_lock);
+        in->capture_exit = true;
+        pthread_cond_signal(&in->capture_cond);
+        pthread_mutex_unlock(&in->capture_lock);
+        pthread_join(in->capture_thread, NULL);
+    }
+    in->async = false;
+    in->capture_exit = false;
+
+    pthread_cond_destroy(&in->data_cond);
+    pthread_cond_destroy(&in->capture_cond);
+    pthread_mutex_destroy(&in->capture_lock);
+    free(in->capture_buffer);
+    in->capture_buffer = NULL;
+    audio_ring_release(&in->ring);
 }
 
+/* put the stream in standby. In async mode the capture thread owns the pcm so
+ * the request is handed over to it, a shared stream only stops being fed.
+ * must be called with in->lock held */
+static void standby_tiny4412_in(struct tiny4412_stream_in *in)
+{
+    struct tiny4412_capture_engine *engine = &in->dev->capture;
+
+    if (!in->async) {
+        do_tiny4412_in_standby(in, false);
+        return;
+    }
+
+    if (in->shared) {
+        pthread_mutex_lock(&engine->lock);
+        in->capture_run = false;
+        in->standby = true;
+        pthread_mutex_unlock(&engine->lock);
+    } else {
+        pthread_mutex_lock(&in->capture_lock);
+        in->capture_run = false;
+        pthread_cond_signal(&in->capture_cond);
+        while (!in->standby && !in->capture_exit)
+            pthread_cond_wait(&in->data_cond, &in->capture_lock);
+        pthread_mutex_unlock(&in->capture_lock);
+    }
 
+    /* the capture thread is idle now, in_read() is excluded by in->lock */
+    audio_ring_flush(&in->ring);
+    in->capture_reading = false;
+}
 
 static int get_tiny4412_next_buffer(struct resampler_buffer_provider *buffer_provider,
                                    struct resampler_buffer* buffer)
 {
     struct tiny4412_stream_in *in;
-    size_t i;
 
     if (buffer_provider == NULL || buffer == NULL)
         return -EINVAL;
@@ -196,41 +2119,47 @@ static int get_tiny4412_next_buffer(struct resampler_buffer_provider *buffer_pro
     in = (struct tiny4412_stream_in *)((char *)buffer_provider -
                                    offsetof(struct tiny4412_stream_in, buf_provider));
 
-    if (in->pcm == NULL) {
+    if (!in->async && in->pcm == NULL) {
         buffer->raw = NULL;
         buffer->frame_count = 0;
         in->read_status = -ENODEV;
         return -ENODEV;
     }
 
-    if (in->frames_in == 0) {
-        in->read_status = pcm_read(in->pcm,
-                                   (void*)in->buffer,
-                                   pcm_frames_to_bytes(in->pcm, in->config->period_size));
+    if (in->frames_in == 0 && in->async) {
+        ssize_t frames_rd = read_tiny4412_ring(in, in->buffer, in->config->period_size, true);
+
+        in->read_status = frames_rd < 0 ? frames_rd : 0;
         if (in->read_status != 0) {
-            ALOGE("get_next_buffer() pcm_read error %d", in->read_status);
+            ALOGE("get_next_buffer() read_tiny4412_ring error %d", in->read_status);
             buffer->raw = NULL;
             buffer->frame_count = 0;
             return in->read_status;
         }
 
-        in->frames_in = in->config->period_size;
+        in->frames_in = frames_rd;
+        in->frames_buffered = frames_rd;
+    } else if (in->frames_in == 0) {
+        ssize_t frames_rd = read_tiny4412_period(in, in->buffer, true);
 
-        /* Do stereo to mono conversion in place by discarding right channel */
-        if (in->channel_mask == AUDIO_CHANNEL_IN_MONO)
-            for (i = 1; i < in->frames_in; i++)
-                in->buffer[i] = in->buffer[i * 2];
-        
+        in->read_status = frames_rd < 0 ? frames_rd : 0;
+        if (in->read_status != 0) {
+            ALOGE("get_next_buffer() read error %d", in->read_status);
+            buffer->raw = NULL;
+            buffer->frame_count = 0;
+            return in->read_status;
+        }
+
+        in->frames_in = frames_rd;
+        in->frames_buffered = frames_rd;
     }
 
     buffer->frame_count = (buffer->frame_count > in->frames_in) ?
                                 in->frames_in : buffer->frame_count;
     buffer->i16 = in->buffer +
-            (in->config->period_size - in->frames_in) *
+            (in->frames_buffered - in->frames_in) *
                 audio_channel_count_from_in_mask(in->channel_mask);
 
-    pcm_dump(in->buffer,pcm_bytes_to_frames(in->pcm,buffer->frame_count));
-
     return in->read_status;
 
 }
@@ -256,6 +2185,21 @@ static ssize_t read_tiny4412_frames(struct tiny4412_stream_in *in, void *buffer,
     ssize_t frames_wr = 0;
     size_t frame_size = audio_stream_in_frame_size(&in->stream);
 
+    /* no resampling: deliver straight from the capture ring into the caller's buffer */
+    if (in->async && in->resampler == NULL && in->frames_in == 0) {
+        frames_wr = read_tiny4412_ring(in, (int16_t *)buffer, frames, false);
+        in->read_status = frames_wr < 0 ? frames_wr : 0;
+        return frames_wr;
+    }
+
+    /* no resampling: deliver straight from the DMA ring into the caller's buffer */
+    if (in->use_mmap && in->resampler == NULL && in->frames_in == 0) {
+        update_tiny4412_in_gain(in);
+        frames_wr = read_tiny4412_mmap(in, (int16_t *)buffer, frames, false);
+        in->read_status = frames_wr < 0 ? frames_wr : 0;
+        return frames_wr;
+    }
+
     while (frames_wr < frames) {
         size_t frames_rd = frames - frames_wr;
         if (in->resampler != NULL) {
@@ -294,33 +2238,279 @@ static ssize_t read_tiny4412_frames(struct tiny4412_stream_in *in, void *buffer,
 
 
 
+static uint32_t get_tiny4412_route_paths(struct audio_route_engine *route,
+                                         const struct tiny4412_route *routes,
+                                         size_t count, audio_devices_t devices)
+{
+    uint32_t paths = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int path;
+
+        if (!(devices & routes[i].devices & ~AUDIO_DEVICE_BIT_IN))
+            continue;
+        path = audio_route_engine_find_path(route, routes[i].path);
+        if (path >= 0)
+            paths |= 1u << path;
+    }
+
+    return paths;
+}
+
+/* program the codec for adev->out_device and adev->in_device. Only the
+ * controls that differ from the current route are written.
+ * must be called with adev->lock held */
+static int select_tiny4412_route(struct tiny4412_audio_device *adev)
+{
+    uint32_t paths;
+    int ret;
+
+    if (adev->route == NULL)
+        return 0;
+
+    paths = get_tiny4412_route_paths(adev->route, out_routes,
+                                     sizeof(out_routes) / sizeof(out_routes[0]),
+                                     adev->out_device);
+    paths |= get_tiny4412_route_paths(adev->route, in_routes,
+                                      sizeof(in_routes) / sizeof(in_routes[0]),
+                                      adev->in_device);
+
+    ret = audio_route_engine_apply(adev->route, paths);
+    ALOGV("select_tiny4412_route() out:%#x,in:%#x,paths:%#x,written:%d",
+          adev->out_device, adev->in_device, paths, ret);
+
+    return ret < 0 ? ret : 0;
+}
+
+/* adev->out_device and adev->in_device are the devices of the open streams.
+ * must be called with adev->lock held */
+static int update_tiny4412_devices(struct tiny4412_audio_device *adev)
+{
+    struct tiny4412_mixer_engine *mixer = &adev->mixer;
+    int i;
+
+    adev->out_device = AUDIO_DEVICE_NONE;
+    for (i = 0; i < OUTPUT_TOTAL; i++)
+        if (adev->outputs[i])
+            adev->out_device |= adev->outputs[i]->device;
+    pthread_mutex_lock(&mixer->lock);
+    for (i = 0; i < AUDIO_HW_MAX_MIXER_CLIENTS; i++)
+        if (mixer->clients[i])
+            adev->out_device |= mixer->clients[i]->device;
+    pthread_mutex_unlock(&mixer->lock);
+
+    adev->in_device = AUDIO_DEVICE_NONE;
+    for (i = 0; i < AUDIO_HW_MAX_INPUTS; i++)
+        if (adev->inputs[i])
+            adev->in_device |= adev->inputs[i]->device;
+
+    return select_tiny4412_route(adev);
+}
+
+/* how long audio written now waits before reaching the codec: the kernel
+ * buffer, plus the ring for an async stream. An upper bound, the buffers are
+ * seldom full. must be called with out->lock held */
+static int64_t get_tiny4412_out_delay_ns(struct tiny4412_stream_out *out)
+{
+    const struct pcm_config *config = out->mixed ? &out->dev->mixer.config : &out->config;
+    int64_t frames = config->period_size * config->period_count;
+
+    if (out->async)
+        frames += audio_ring_readable(&out->ring) /
+                  (out->config.channels * sizeof(int16_t));
+
+    return frames * 1000000000LL / out->config.rate;
+}
+
+/* must be called with out->lock held */
+static void switch_tiny4412_out_device(struct tiny4412_stream_out *out,
+                                       audio_devices_t device)
+{
+    struct tiny4412_audio_device *adev = out->dev;
+
+    pthread_mutex_lock(&adev->lock);
+    out->device = device;
+    update_tiny4412_devices(adev);
+    pthread_mutex_unlock(&adev->lock);
+
+    /* the gain ramps up again on the next write */
+    out->route_device = AUDIO_DEVICE_NONE;
+    out->route_muted = false;
+}
+
+/* move a playing stream to device without standby: the next writes ramp down
+ * to silence, the codec path is switched by out_write() once that silence is
+ * at the codec, and the gain ramps back up. The pcm keeps running, the switch
+ * costs the ramp and the queued audio instead of a close and reopen.
+ * must be called with out->lock held */
+static void set_tiny4412_out_device(struct tiny4412_stream_out *out,
+                                    audio_devices_t device)
+{
+    if (device == out->device) {
+        /* back before the pending switch happened */
+        out->route_device = AUDIO_DEVICE_NONE;
+        out->route_muted = false;
+        return;
+    }
+
+    if (out->standby) {
+        switch_tiny4412_out_device(out, device);
+        return;
+    }
+
+    if (out->route_device == AUDIO_DEVICE_NONE)
+        out->route_switch_ns = get_tiny4412_time_ns() + get_tiny4412_out_delay_ns(out) +
+                               AUDIO_HW_GAIN_RAMP_MS * 1000000LL;
+    out->route_device = device;
+    out->route_muted = true;
+}
+
+/* must be called with out->lock held */
+static void check_tiny4412_out_device(struct tiny4412_stream_out *out)
+{
+    if (out->route_device != AUDIO_DEVICE_NONE &&
+            get_tiny4412_time_ns() >= out->route_switch_ns)
+        switch_tiny4412_out_device(out, out->route_device);
+}
+
+/* how long a frame captured now waits in the kernel buffer before being read.
+ * must be called with in->lock held */
+static int64_t get_tiny4412_in_delay_ns(struct tiny4412_stream_in *in)
+{
+    const struct pcm_config *config = in->shared ? &in->dev->capture.config : in->config;
+
+    return (int64_t)config->period_size * config->period_count * 1000000000LL / config->rate;
+}
+
+/* must be called with in->lock held */
+static void switch_tiny4412_in_device(struct tiny4412_stream_in *in,
+                                      audio_devices_t device)
+{
+    struct tiny4412_audio_device *adev = in->dev;
+
+    pthread_mutex_lock(&adev->lock);
+    in->device = device;
+    update_tiny4412_devices(adev);
+    pthread_mutex_unlock(&adev->lock);
+
+    in->route_device = AUDIO_DEVICE_NONE;
+}
+
+/* same as set_tiny4412_out_device() for capture: the gain fades out, the path
+ * is switched once the frames being read were captured after the fade, and it
+ * fades back in when the first frames captured on the new device are read.
+ * must be called with in->lock held */
+static void set_tiny4412_in_device(struct tiny4412_stream_in *in,
+                                   audio_devices_t device)
+{
+    if (device == in->device) {
+        /* the gain comes back at route_switch_ns */
+        in->route_device = AUDIO_DEVICE_NONE;
+        return;
+    }
+
+    if (in->standby) {
+        switch_tiny4412_in_device(in, device);
+        in->route_muted = false;
+        return;
+    }
+
+    if (in->route_device == AUDIO_DEVICE_NONE && !in->route_muted)
+        in->route_switch_ns = get_tiny4412_time_ns() + AUDIO_HW_GAIN_RAMP_MS * 1000000LL;
+    in->route_device = device;
+    in->route_muted = true;
+}
+
+/* must be called with in->lock held */
+static void check_tiny4412_in_device(struct tiny4412_stream_in *in)
+{
+    int64_t now;
+
+    if (!in->route_muted)
+        return;
+
+    now = get_tiny4412_time_ns();
+    if (now < in->route_switch_ns)
+        return;
+
+    if (in->route_device != AUDIO_DEVICE_NONE) {
+        switch_tiny4412_in_device(in, in->route_device);
+        /* what is in the kernel buffer was captured on the old path */
+        in->route_switch_ns = now + get_tiny4412_in_delay_ns(in);
+    } else {
+        in->route_muted = false;
+    }
+}
+
 static uint32_t out_get_sample_rate(const struct audio_stream *stream)
 {
-    return AUDIO_HW_OUT_SAMPLERATE;
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+
+    return out->sample_rate;
 }
 
 static int out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 {
-    return 0;
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+    int ret;
+
+    if (rate == out->sample_rate)
+        return 0;
+    /* the HDMI rate is negotiated with the sink at open */
+    if (out->out_type == OUTPUT_HDMI)
+        return -ENOSYS;
+
+    pthread_mutex_lock(&out->lock);
+    standby_tiny4412_out(out, true);
+    ret = set_tiny4412_out_sample_rate(out, rate);
+    pthread_mutex_unlock(&out->lock);
+
+    return ret;
 }
 
 static size_t out_get_buffer_size(const struct audio_stream *stream)
 {
-    return 4096;
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+
+    size_t size;
+
+    /* one period of the active pcm profile at the client rate, rounded up to
+     * a multiple of 16 frames as audioflinger expects */
+    size = (out->config.period_size * out->sample_rate) / out->config.rate;
+    size = ((size + 15) / 16) * 16;
+
+    return size * audio_stream_out_frame_size((const struct audio_stream_out *)stream);
 }
 
 static audio_channel_mask_t out_get_channels(const struct audio_stream *stream)
 {
-    return AUDIO_CHANNEL_OUT_STEREO;
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+
+    return out->channel_mask;
 }
 
 static audio_format_t out_get_format(const struct audio_stream *stream)
 {
-    return AUDIO_FORMAT_PCM_16_BIT;
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+
+    return out->format;
 }
 
 static int out_set_format(struct audio_stream *stream, audio_format_t format)
 {
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+
+    if (format == out->format)
+        return 0;
+    if (out->out_type == OUTPUT_HDMI || !is_tiny4412_out_format_supported(format))
+        return -ENOSYS;
+
+    pthread_mutex_lock(&out->lock);
+    standby_tiny4412_out(out, true);
+    out->format = format;
+    pthread_mutex_unlock(&out->lock);
+
     return 0;
 }
 
@@ -330,7 +2520,10 @@ static int out_standby(struct audio_stream *stream)
     struct tiny4412_audio_device *adev = out->dev;
 
     pthread_mutex_lock(&out->lock);
-    do_tiny4412_out_standby(out);
+    standby_tiny4412_out(out, false);
+    /* nothing left to fade */
+    if (out->route_device != AUDIO_DEVICE_NONE)
+        switch_tiny4412_out_device(out, out->route_device);
     pthread_mutex_unlock(&out->lock);
     return 0;
 }
@@ -340,9 +2533,18 @@ static int out_dump(const struct audio_stream *stream, int fd)
     struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
     struct tiny4412_audio_device *adev = out->dev;
 
-    dprintf(fd,"out:%#x\n",out);
-    dprintf(fd,"output_type:%d,standby:%d,muted:%d\n",out->out_type,out->standby,out->muted);
-    dprintf(fd,"pcm_card_type:%d,pcm_device:%d,written:%d\n",out->pcm_card_type,out->pcm_device,out->written);
+    dprintf(fd,"out:%p\n",out);
+    dprintf(fd,"output_type:%d,flags:%#x,standby:%d,muted:%d\n",out->out_type,out->flags,out->standby,out->muted);
+    dprintf(fd,"device:%#x,route_device:%#x,route_muted:%d\n",out->device,out->route_device,out->route_muted);
+    dprintf(fd,"pcm_card_type:%d,pcm_device:%d,written:%llu\n",out->pcm_card_type,out->pcm_device,(unsigned long long)out->written);
+    dprintf(fd,"period_size:%u,period_count:%u,rate:%u,latency_ms:%u\n",out->config.period_size,out->config.period_count,out->config.rate,out->latency_ms);
+    dprintf(fd,"use_mmap:%d,mmap_running:%d\n",out->use_mmap,out->mmap_running);
+    dprintf(fd,"sample_rate:%u,format:%#x,resampler:%p\n",out->sample_rate,out->format,out->resampler);
+    dprintf(fd,"volume:%.3f/%.3f,gain:%.3f/%.3f,ramp_frames:%zu\n",out->volume[0],out->volume[1],out->gain.current[0],out->gain.current[1],out->gain.ramp_frames);
+    if (out->async)
+        dprintf(fd,"async mixed:%d,ring size:%zu,fill:%zu,fill_min:%zu,underruns:%u\n",out->mixed,out->ring.size,audio_ring_readable(&out->ring),out->ring_fill_min,out->ring_underruns);
+    dump_tiny4412_xruns(fd, "xruns", &out->xruns);
+    audio_timing_dump(&out->timing, fd);
         
    
     return 0;
@@ -350,22 +2552,119 @@ static int out_dump(const struct audio_stream *stream, int fd)
 
 static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
 {
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+    struct str_parms *parms;
+    int value;
+
+    parms = str_parms_create_str(kvpairs);
+    if (str_parms_get_int(parms, AUDIO_PARAMETER_STREAM_ROUTING, &value) >= 0 &&
+            value != AUDIO_DEVICE_NONE) {
+        pthread_mutex_lock(&out->lock);
+        set_tiny4412_out_device(out, value);
+        pthread_mutex_unlock(&out->lock);
+    }
+    str_parms_destroy(parms);
+
     return 0;
 }
 
+/* machine readable cost of a stream, for comparing builds on the target */
+static void add_tiny4412_perf_parms(struct str_parms *query, struct str_parms *reply,
+                                    struct audio_timing *timing)
+{
+    if (str_parms_has_key(query, AUDIO_PARAMETER_TINY4412_CPU_NS_PER_FRAME))
+        str_parms_add_float(reply, AUDIO_PARAMETER_TINY4412_CPU_NS_PER_FRAME,
+                            audio_cost_per_frame(&timing->cost));
+
+    if (str_parms_has_key(query, AUDIO_PARAMETER_TINY4412_FIRST_SAMPLE_US))
+        str_parms_add_int(reply, AUDIO_PARAMETER_TINY4412_FIRST_SAMPLE_US,
+                          audio_histogram_percentile(&timing->first_sample, 50));
+
+    if (str_parms_has_key(query, AUDIO_PARAMETER_TINY4412_CALL_P99_US))
+        str_parms_add_int(reply, AUDIO_PARAMETER_TINY4412_CALL_P99_US,
+                          audio_histogram_percentile(&timing->call, 99));
+}
+
 static char * out_get_parameters(const struct audio_stream *stream, const char *keys)
 {
-    return strdup("");
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+    struct str_parms *query = str_parms_create_str(keys);
+    struct str_parms *reply = str_parms_create();
+    char value[256];
+    char *str;
+    size_t i, j;
+    bool first = true;
+
+    if (str_parms_has_key(query, AUDIO_PARAMETER_STREAM_SUP_CHANNELS)) {
+        value[0] = '\0';
+        for (i = 0; out->supported_channel_masks[i] != 0 &&
+                    i < MAX_SUPPORTED_CHANNEL_MASKS; i++) {
+            for (j = 0; j < ARRAY_SIZE(out_channels_name_to_enum_table); j++) {
+                if (out_channels_name_to_enum_table[j].value == out->supported_channel_masks[i]) {
+                    if (!first)
+                        strlcat(value, "|", sizeof(value));
+                    strlcat(value, out_channels_name_to_enum_table[j].name, sizeof(value));
+                    first = false;
+                    break;
+                }
+            }
+        }
+        str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_CHANNELS, value);
+    }
+
+    if (str_parms_has_key(query, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES)) {
+        char rate[16];
+
+        value[0] = '\0';
+        first = true;
+        if (out->out_type == OUTPUT_HDMI) {
+            for (i = 0; i < ARRAY_SIZE(hdmi_sample_rates); i++) {
+                if (!is_tiny4412_hdmi_rate_supported(out, hdmi_sample_rates[i]))
+                    continue;
+                snprintf(rate, sizeof(rate), "%s%u", first ? "" : "|", hdmi_sample_rates[i]);
+                strlcat(value, rate, sizeof(value));
+                first = false;
+            }
+        } else {
+            for (i = 0; i < ARRAY_SIZE(out_sample_rates); i++) {
+                snprintf(rate, sizeof(rate), "%s%u", first ? "" : "|", out_sample_rates[i]);
+                strlcat(value, rate, sizeof(value));
+                first = false;
+            }
+        }
+        str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES, value);
+    }
+
+    add_tiny4412_perf_parms(query, reply, &out->timing);
+
+    str = str_parms_to_str(reply);
+    str_parms_destroy(query);
+    str_parms_destroy(reply);
+
+    return str;
 }
 
 static uint32_t out_get_latency(const struct audio_stream_out *stream)
 {
-    return 0;
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+
+    return out->latency_ms;
 }
 
 static int out_set_volume(struct audio_stream_out *stream, float left,
                           float right)
 {
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+
+    if (left < 0 || left > 1 || right < 0 || right > 1)
+        return -EINVAL;
+
+    /* the next write ramps to the new gain */
+    pthread_mutex_lock(&out->lock);
+    out->volume[0] = left;
+    out->volume[1] = right;
+    pthread_mutex_unlock(&out->lock);
+
     return 0;
 }
 
@@ -376,8 +2675,29 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
     int ret = 0;
     struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
     struct tiny4412_audio_device *adev = out->dev;
+    size_t frames = bytes / audio_stream_out_frame_size(stream);
+    const void *data;
+    size_t pcm_bytes;
+    int64_t begin = get_tiny4412_time_ns();
+    int64_t cpu_begin = get_tiny4412_cpu_time_ns();
 
     pthread_mutex_lock(&out->lock);
+    check_tiny4412_out_device(out);
+    if (out->async) {
+        ssize_t frames_wr;
+
+        if (out->mixed)
+            run_tiny4412_out_mixed(out);
+        frames_wr = write_tiny4412_async(out, buffer, frames);
+        pthread_mutex_unlock(&out->lock);
+        if (frames_wr < 0)
+            return frames_wr;
+        audio_timing_call(&out->timing, begin, get_tiny4412_time_ns(),
+                          frames_wr * 1000000000LL / out->sample_rate);
+        audio_cost_add(&out->timing.cost, get_tiny4412_cpu_time_ns() - cpu_begin, frames_wr);
+        return frames_wr * audio_stream_out_frame_size(stream);
+    }
+
     if (out->standby) {
         
         ret = start_tiny4412_output_stream(out);
@@ -387,34 +2707,113 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
         out->standby = false;
     }
 
-
-    if (out->muted)
-        memset((void *)buffer, 0, bytes);
+    data = convert_tiny4412_out(out, buffer, frames, &pcm_bytes);
+    if (data == NULL) {
+        ret = -ENOMEM;
+        goto final_exit;
+    }
 
     if (out->pcm[out->out_type]) {
-        ret = pcm_write(out->pcm[out->out_type], (void *)buffer, bytes);
-        
-    if (ret == 0)
-        out->written += bytes / (out->config.channels * sizeof(short));
-     }
+        ret = write_tiny4412_pcm(out, data, pcm_bytes);
+        if (ret == 0)
+            out->written += frames;
+        else /* xruns were recovered already: reopen the pcm on the next write */
+            do_tiny4412_out_standby(out, true);
+    }
 
-    //ALOGD("buffer:%#x,bytes:%u,ret=%d",buffer,bytes,ret);
-    
 final_exit:
-    
     pthread_mutex_unlock(&out->lock);
-    if (ret != 0) {
-        usleep(bytes * 1000000 / audio_stream_out_frame_size(stream) /
-               out_get_sample_rate(&stream->common));
-    }
-    
+    audio_timing_call(&out->timing, begin, get_tiny4412_time_ns(),
+                      frames * 1000000000LL / out->sample_rate);
+    if (ret != 0)
+        return ret;
+
+    audio_cost_add(&out->timing.cost, get_tiny4412_cpu_time_ns() - cpu_begin, frames);
     return bytes;
 }
 
+/* must be called with out->lock held */
+static int get_tiny4412_presentation_position(struct tiny4412_stream_out *out,
+                                              uint64_t *frames,
+                                              struct timespec *timestamp)
+{
+    struct tiny4412_mixer_engine *mixer = &out->dev->mixer;
+    pthread_mutex_t *lock = NULL;
+    struct pcm *pcm;
+    unsigned int avail;
+    int64_t queued;
+    int64_t signed_frames;
+    int ret = -ENODATA;
+
+    /* in async mode the writer thread may close the pcm at any time, the
+     * mixer thread or the reaper the mixer pcm */
+    if (out->mixed)
+        lock = &mixer->lock;
+    else if (out->async)
+        lock = &out->writer_lock;
+    if (lock)
+        pthread_mutex_lock(lock);
+
+    pcm = out->mixed ? mixer->pcm : out->pcm[out->out_type];
+    if (out->standby || pcm == NULL)
+        goto exit;
+
+    if (pcm_get_htimestamp(pcm, &avail, timestamp) < 0)
+        goto exit;
+
+    /* frames still queued in the kernel buffer, and in the ring in async mode,
+     * have not been presented yet. written counts client frames, the kernel
+     * buffer and the ring hold pcm frames */
+    queued = pcm_get_buffer_size(pcm) - avail;
+    if (out->async)
+        queued += audio_ring_readable(&out->ring) /
+                  (out->config.channels * sizeof(int16_t));
+    signed_frames = (int64_t)out->written - queued * out->sample_rate / out->config.rate;
+    if (signed_frames < 0)
+        goto exit;
+
+    *frames = signed_frames;
+    ret = 0;
+
+exit:
+    if (lock)
+        pthread_mutex_unlock(lock);
+
+    return ret;
+}
+
+static int out_set_callback(struct audio_stream_out *stream,
+                            stream_callback_t callback, void *cookie)
+{
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+
+    if (!out->async || !(out->flags & AUDIO_OUTPUT_FLAG_NON_BLOCKING))
+        return -ENOSYS;
+
+    pthread_mutex_lock(&out->writer_lock);
+    out->callback = callback;
+    out->callback_cookie = cookie;
+    pthread_mutex_unlock(&out->writer_lock);
+
+    return 0;
+}
+
 static int out_get_render_position(const struct audio_stream_out *stream,
                                    uint32_t *dsp_frames)
 {
-    return -EINVAL;
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+    struct timespec timestamp;
+    uint64_t frames;
+    int ret;
+
+    pthread_mutex_lock(&out->lock);
+    ret = get_tiny4412_presentation_position(out, &frames, &timestamp);
+    pthread_mutex_unlock(&out->lock);
+
+    if (ret == 0)
+        *dsp_frames = (uint32_t)frames;
+
+    return ret;
 }
 
 static int out_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
@@ -436,13 +2835,22 @@ static int out_get_next_write_timestamp(const struct audio_stream_out *stream,
 static int out_get_presentation_position(const struct audio_stream_out *stream,
                                    uint64_t *frames, struct timespec *timestamp)
 {
-    return -EINVAL;
+    struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
+    int ret;
+
+    pthread_mutex_lock(&out->lock);
+    ret = get_tiny4412_presentation_position(out, frames, timestamp);
+    pthread_mutex_unlock(&out->lock);
+
+    return ret;
 }
 
 /** audio_stream_in implementation **/
 static uint32_t in_get_sample_rate(const struct audio_stream *stream)
 {
-    return 48000;
+    struct tiny4412_stream_in *in = (struct tiny4412_stream_in *)stream;
+
+    return in->requested_rate;
 }
 
 static int in_set_sample_rate(struct audio_stream *stream, uint32_t rate)
@@ -484,7 +2892,11 @@ static int in_standby(struct audio_stream *stream)
     struct tiny4412_audio_device *adev = in->dev;
 
     pthread_mutex_lock(&in->lock);
-    do_tiny4412_in_standby(in);
+    standby_tiny4412_in(in);
+    if (in->route_device != AUDIO_DEVICE_NONE)
+        switch_tiny4412_in_device(in, in->route_device);
+    /* the next start fades in anyway */
+    in->route_muted = false;
     pthread_mutex_unlock(&in->lock);
     
     return 0;
@@ -495,26 +2907,64 @@ static int in_dump(const struct audio_stream *stream, int fd)
     struct tiny4412_stream_in *in = (struct tiny4412_stream_in *)stream;
     struct tiny4412_audio_device *adev = in->dev;
 
-    dprintf(fd,"in:%#x\n",in);
+    dprintf(fd,"in:%p\n",in);
     dprintf(fd,"standby:%d,muted:%d,channel_count:%d\n",in->standby,in->muted,in->channel_count);
-    dprintf(fd,"channel_mask:%#x,requested_rate:%d,flags:%d,frames_in:%d\n",in->channel_mask,in->requested_rate,in->flags,in->frames_in);
-    dprintf(fd,"resampler:%p\n",in->resampler);
+    dprintf(fd,"channel_mask:%#x,requested_rate:%d,flags:%d,frames_in:%zu\n",in->channel_mask,in->requested_rate,in->flags,in->frames_in);
+    dprintf(fd,"resampler:%p,use_mmap:%d,input_source:%d\n",in->resampler,in->use_mmap,in->input_source);
+    dprintf(fd,"gain:%f,mic_mute:%d\n",(double)atomic_load(&in->gain_value),atomic_load(&adev->mic_mute));
+    dprintf(fd,"device:%#x,route_device:%#x,route_muted:%d\n",in->device,in->route_device,in->route_muted);
+    if (in->async)
+        dprintf(fd,"async shared:%d,ring size:%zu,fill:%zu,frames_lost:%u\n",in->shared,in->ring.size,audio_ring_readable(&in->ring),atomic_load(&in->frames_lost));
+    dump_tiny4412_xruns(fd, "xruns", &in->xruns);
+    audio_timing_dump(&in->timing, fd);
     return 0;
 }
 
 static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
 {
+    struct tiny4412_stream_in *in = (struct tiny4412_stream_in *)stream;
+    struct str_parms *parms;
+    int value;
+
+    parms = str_parms_create_str(kvpairs);
+    if (str_parms_get_int(parms, AUDIO_PARAMETER_STREAM_ROUTING, &value) >= 0 &&
+            (value & ~AUDIO_DEVICE_BIT_IN) != AUDIO_DEVICE_NONE) {
+        pthread_mutex_lock(&in->lock);
+        set_tiny4412_in_device(in, value & ~AUDIO_DEVICE_BIT_IN);
+        pthread_mutex_unlock(&in->lock);
+    }
+    str_parms_destroy(parms);
+
     return 0;
 }
 
 static char * in_get_parameters(const struct audio_stream *stream,
                                 const char *keys)
 {
-    return strdup("");
+    struct tiny4412_stream_in *in = (struct tiny4412_stream_in *)stream;
+    struct str_parms *query = str_parms_create_str(keys);
+    struct str_parms *reply = str_parms_create();
+    char *str;
+
+    add_tiny4412_perf_parms(query, reply, &in->timing);
+
+    str = str_parms_to_str(reply);
+    str_parms_destroy(query);
+    str_parms_destroy(reply);
+
+    return str;
 }
 
+/* picked up by the reading thread on its next period, see update_tiny4412_in_gain() */
 static int in_set_gain(struct audio_stream_in *stream, float gain)
 {
+    struct tiny4412_stream_in *in = (struct tiny4412_stream_in *)stream;
+
+    if (gain < 0 || gain > 1)
+        return -EINVAL;
+
+    atomic_store(&in->gain_value, gain);
+
     return 0;
 }
 
@@ -522,12 +2972,12 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
                        size_t bytes)
 {
     int ret = 0;
-    unsigned int i,read_frame_count,frames_rd;
     struct tiny4412_stream_in *in = (struct tiny4412_stream_in *)stream;
     struct tiny4412_audio_device *adev = in->dev;
     size_t frames_rq = bytes / audio_stream_in_frame_size(stream);
+    int64_t begin = get_tiny4412_time_ns();
+    int64_t cpu_begin = get_tiny4412_cpu_time_ns();
 
-    ALOGD("in_read frames_rq:%u,bytes:%u",frames_rq,bytes);
     /*
      * acquiring hw device mutex systematically is useful if a low
      * priority thread is waiting on the input stream mutex - e.g.
@@ -535,7 +2985,18 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
      * mutex
      */
     pthread_mutex_lock(&in->lock);
-    if (in->standby) {
+    check_tiny4412_in_device(in);
+    if (in->shared) {
+        run_tiny4412_in_shared(in);
+    } else if (in->async) {
+        pthread_mutex_lock(&in->capture_lock);
+        if (!in->capture_run) {
+            reset_tiny4412_in_reader(in);
+            in->capture_run = true;
+            pthread_cond_signal(&in->capture_cond);
+        }
+        pthread_mutex_unlock(&in->capture_lock);
+    } else if (in->standby) {
         pthread_mutex_lock(&adev->lock);
         ret = start_tiny4412_input_stream(in);
         pthread_mutex_unlock(&adev->lock);
@@ -544,52 +3005,35 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
         in->standby = false;
     }
 
-    ALOGD("in_read frames_rq:%u,bytes:%u",frames_rq,bytes);
-
     ret = read_tiny4412_frames(in, buffer, frames_rq);
 
-    if (ret > 0)
+    if (ret > 0) {
+        audio_tap_write(in->taps[AUDIO_TAP_POST_RESAMPLE], buffer, ret * in->channel_count * sizeof(int16_t));
+        audio_timing_first_sample(&in->timing, get_tiny4412_time_ns());
         ret = 0;
-
-#if 0
-    frames_rd = 0;
-    while(frames_rd < frames_rq)
-    {
-         in->read_status = pcm_read(in->pcm,
-                                   (void*)in->buffer,
-                                   pcm_frames_to_bytes(in->pcm, in->config->period_size));
-        if (in->read_status != 0) {
-            ALOGE("in_read() pcm_read error %d", in->read_status);
-            return in->read_status;
-        }
-
-        in->frames_in += in->config->period_size;
-        read_frame_count = in->config->period_size;
-        frames_rd +=  in->config->period_size;
-        /* Do stereo to mono conversion in place by discarding right channel */
-        if (in->channel_mask == AUDIO_CHANNEL_IN_MONO)
-        {
-            for (i = 1; i < read_frame_count; i++)
-                in->buffer[i] = in->buffer[i * 2];
-        }
     }
-#endif
-   
-    if (ret == 0 && adev->mic_mute)
-        memset(buffer, 0, bytes);
+
+    /* xruns were recovered already: reopen the pcm on the next read */
+    if (ret < 0 && !in->async)
+        do_tiny4412_in_standby(in, true);
 
 exit:
+    pthread_mutex_unlock(&in->lock);
+    audio_timing_call(&in->timing, begin, get_tiny4412_time_ns(),
+                      frames_rq * 1000000000LL / in->requested_rate);
     if (ret < 0)
-        usleep(bytes * 1000000 / audio_stream_in_frame_size(stream) /
-               in_get_sample_rate(&stream->common));
+        return ret;
 
-    pthread_mutex_unlock(&in->lock);
+    audio_cost_add(&in->timing.cost, get_tiny4412_cpu_time_ns() - cpu_begin, frames_rq);
     return bytes;
 }
 
 static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
 {
-    return 0;
+    struct tiny4412_stream_in *in = (struct tiny4412_stream_in *)stream;
+
+    /* frames lost since the last call */
+    return atomic_exchange(&in->frames_lost, 0);
 }
 
 static int in_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
@@ -602,6 +3046,28 @@ static int in_remove_audio_effect(const struct audio_stream *stream, effect_hand
     return 0;
 }
 
+static void open_tiny4412_taps(struct audio_tap **taps, const char *prefix,
+                               unsigned int pre_rate, unsigned int post_rate,
+                               unsigned int channels)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "%s_pre", prefix);
+    taps[AUDIO_TAP_PRE_RESAMPLE] = audio_tap_open(name, pre_rate, channels);
+    snprintf(name, sizeof(name), "%s_post", prefix);
+    taps[AUDIO_TAP_POST_RESAMPLE] = audio_tap_open(name, post_rate, channels);
+}
+
+static void close_tiny4412_taps(struct audio_tap **taps)
+{
+    int i;
+
+    for (i = 0; i < AUDIO_TAP_POINTS; i++) {
+        audio_tap_close(taps[i]);
+        taps[i] = NULL;
+    }
+}
+
 static int adev_open_output_stream(struct audio_hw_device *dev,
                                    audio_io_handle_t handle,
                                    audio_devices_t devices,
@@ -612,6 +3078,7 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
 {
      struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)dev;
     struct tiny4412_stream_out *out;
+    char tap_name[16];
     int ret;
 
     out = (struct tiny4412_stream_out *)calloc(1, sizeof(struct tiny4412_stream_out));
@@ -619,19 +3086,73 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         return -ENOMEM;
 
     out->channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    out->supported_channel_masks[0] = AUDIO_CHANNEL_OUT_STEREO;
     if (devices == AUDIO_DEVICE_NONE)
         devices = AUDIO_DEVICE_OUT_SPEAKER;
     out->device = devices;
+    out->flags = flags;
 
     if (flags & AUDIO_OUTPUT_FLAG_DIRECT &&
                    devices == AUDIO_DEVICE_OUT_AUX_DIGITAL) {
-        
+        ret = read_tiny4412_hdmi_caps(out);
+        if (ret != 0)
+            goto err_open;
+
+        ret = negotiate_tiny4412_hdmi_config(out, config);
+        if (ret != 0)
+            goto err_open;
+
+        out->channel_mask = config->channel_mask;
+        out->config = pcm_out_config_hdmi;
+        out->config.rate = config->sample_rate;
+        out->config.channels = audio_channel_count_from_out_mask(config->channel_mask);
+        out->pcm_device = PCM_DEVICE;
+        out->pcm_card_type = PCM_CARD_SPDIF;
+        out->out_type = OUTPUT_HDMI;
+    } else if (flags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) {
+        out->config = pcm_out_config_deep;
+        out->pcm_device = PCM_DEVICE_DEEP;
+        out->pcm_card_type = PCM_CARD;
+        out->out_type = OUTPUT_DEEP_BUFFER;
     } else {
-        out->config = pcm_out_config;
+        if (flags & AUDIO_OUTPUT_FLAG_FAST)
+            out->config = pcm_out_config_fast;
+        else
+            out->config = pcm_out_config;
         out->pcm_device = PCM_DEVICE;
         out->pcm_card_type = PCM_CARD;
         out->out_type = OUTPUT_LOW_LATENCY;
+        out->use_mmap = (flags & AUDIO_OUTPUT_FLAG_FAST) && is_tiny4412_mmap_enabled(PCM_OUT);
+    }
+
+    /* known before the rate is picked: mixed streams run at the mixer rate */
+    out->mixed = adev->mixer.enabled && out->out_type != OUTPUT_HDMI;
+
+    if (out->out_type == OUTPUT_HDMI) {
+        out->sample_rate = out->config.rate;
+        out->format = AUDIO_FORMAT_PCM_16_BIT;
+    } else {
+        /* convert in the HAL rather than in the mixer thread */
+        if (config->sample_rate == 0)
+            config->sample_rate = AUDIO_HW_OUT_SAMPLERATE;
+        if (config->format == AUDIO_FORMAT_DEFAULT)
+            config->format = AUDIO_FORMAT_PCM_16_BIT;
+        if (!is_tiny4412_out_rate_supported(config->sample_rate) ||
+                !is_tiny4412_out_format_supported(config->format)) {
+            if (!is_tiny4412_out_rate_supported(config->sample_rate))
+                config->sample_rate = AUDIO_HW_OUT_SAMPLERATE;
+            if (!is_tiny4412_out_format_supported(config->format))
+                config->format = AUDIO_FORMAT_PCM_16_BIT;
+            ret = -EINVAL;
+            goto err_open;
+        }
+
+        out->format = config->format;
+        ret = set_tiny4412_out_sample_rate(out, config->sample_rate);
+        if (ret != 0)
+            goto err_open;
     }
+    update_tiny4412_out_latency(out);
 
     out->stream.common.get_sample_rate = out_get_sample_rate;
     out->stream.common.set_sample_rate = out_set_sample_rate;
@@ -651,8 +3172,11 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->stream.get_render_position = out_get_render_position;
     out->stream.get_next_write_timestamp = out_get_next_write_timestamp;
     out->stream.get_presentation_position = out_get_presentation_position;
+    out->stream.set_callback = out_set_callback;
 
     out->dev = adev;
+    out->volume[0] = out->volume[1] = 1.0f;
+    conv_gain_init(&out->gain, 1.0f, 1.0f);
 
     config->format = out_get_format(&out->stream.common);
     config->channel_mask = out_get_channels(&out->stream.common);
@@ -660,20 +3184,55 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
 
     out->standby = true;
 
-    pthread_mutex_lock(&adev->lock);
-    if (adev->outputs[out->out_type]) {
+    if (out->mixed) {
+        /* no pcm of its own: any number of streams per output type */
+        out->use_mmap = false;
+        ret = start_tiny4412_mixer_engine(adev);
+        if (ret == 0)
+            ret = start_tiny4412_out_writer(out, true);
+        if (ret != 0)
+            goto err_open;
+    } else {
+        pthread_mutex_lock(&adev->lock);
+        if (adev->outputs[out->out_type]) {
+            pthread_mutex_unlock(&adev->lock);
+            ret = -EBUSY;
+            goto err_open;
+        }
+        adev->outputs[out->out_type] = out;
         pthread_mutex_unlock(&adev->lock);
-        ret = -EBUSY;
-        goto err_open;
+
+        if ((flags & AUDIO_OUTPUT_FLAG_NON_BLOCKING) || is_tiny4412_async_enabled(PCM_OUT)) {
+            ret = start_tiny4412_out_writer(out, false);
+            if (ret != 0) {
+                pthread_mutex_lock(&adev->lock);
+                adev->outputs[out->out_type] = NULL;
+                pthread_mutex_unlock(&adev->lock);
+                goto err_open;
+            }
+        }
     }
-    adev->outputs[out->out_type] = out;
+
+    pthread_mutex_lock(&adev->lock);
+    update_tiny4412_devices(adev);
     pthread_mutex_unlock(&adev->lock);
 
+    if (out->mixed)
+        snprintf(tap_name, sizeof(tap_name), "out%d_%d", out->out_type, handle);
+    else
+        snprintf(tap_name, sizeof(tap_name), "out%d", out->out_type);
+    open_tiny4412_taps(out->taps, tap_name, out->sample_rate, out->config.rate,
+                       out->config.channels);
+    /* the first start is measured from here */
+    audio_timing_start(&out->timing, get_tiny4412_time_ns());
+
     *stream_out = &out->stream;
 
     return 0;
 
 err_open:
+    if (out->resampler)
+        release_tiny4412_resampler(out->resampler);
     free(out);
     *stream_out = NULL;
     return ret;
@@ -685,28 +3244,102 @@ static void adev_close_output_stream(struct audio_hw_device *dev,
     struct tiny4412_stream_out *out = (struct tiny4412_stream_out *)stream;
     struct tiny4412_audio_device *adev = out->dev;
 
-    if(out->pcm[out->out_type])
-    {
-        pcm_close(out->pcm[out->out_type]);
-        out->pcm[out->out_type] = NULL;
-    }
-        
-    
+    /* out of reach of the standby reaper first */
+    pthread_mutex_lock(&adev->lock);
+    if (adev->outputs[out->out_type] == out)
+        adev->outputs[out->out_type] = NULL;
+    pthread_mutex_unlock(&adev->lock);
+
+    out_standby(&stream->common);
+    stop_tiny4412_out_writer(out);
+    do_tiny4412_out_standby(out, true);
+    close_tiny4412_taps(out->taps);
+
+    /* a mixed stream left the mixer clients in stop_tiny4412_out_writer() */
+    pthread_mutex_lock(&adev->lock);
+    update_tiny4412_devices(adev);
+    pthread_mutex_unlock(&adev->lock);
+
+    if (out->resampler)
+        release_tiny4412_resampler(out->resampler);
+    free(out->fmt_buffer);
+    free(out->rs_buffer);
+    free(out->gain_buffer);
     free(stream);
 }
 
 static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
 {
+    struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)dev;
+    struct str_parms *parms;
+    int i;
 
     ALOGD("<%s,%d> kvpairs:%s",__FUNCTION__,__LINE__,kvpairs);
 
-    return -ENOSYS;
+    parms = str_parms_create_str(kvpairs);
+    if (str_parms_has_key(parms, AUDIO_PARAMETER_TINY4412_STATS_RESET)) {
+        /* timings are atomics, the stream locks are not needed */
+        pthread_mutex_lock(&adev->lock);
+        for (i = 0; i < OUTPUT_TOTAL; i++)
+            if (adev->outputs[i])
+                audio_timing_reset(&adev->outputs[i]->timing);
+        for (i = 0; i < AUDIO_HW_MAX_INPUTS; i++)
+            if (adev->inputs[i])
+                audio_timing_reset(&adev->inputs[i]->timing);
+        for (i = 0; i < AUDIO_HW_MAX_MIXER_CLIENTS; i++)
+            if (adev->mixer.clients[i])
+                audio_timing_reset(&adev->mixer.clients[i]->timing);
+        audio_histogram_reset(&adev->capture.io);
+        audio_histogram_reset(&adev->capture.start);
+        audio_histogram_reset(&adev->mixer.io);
+        audio_histogram_reset(&adev->mixer.start);
+        pthread_mutex_unlock(&adev->lock);
+    }
+    str_parms_destroy(parms);
+
+    /* keys meant for other HALs are ignored, not failed */
+    return 0;
+}
+
+static void add_tiny4412_xrun_parms(struct str_parms *query, struct str_parms *reply,
+                                    const char *prefix, struct tiny4412_xrun_stats *stats)
+{
+    char key[64];
+    char value[32];
+
+    snprintf(key, sizeof(key), "%s_xruns", prefix);
+    if (str_parms_has_key(query, key))
+        str_parms_add_int(reply, key, atomic_load(&stats->count));
+
+    snprintf(key, sizeof(key), "%s_xrun_frames", prefix);
+    if (str_parms_has_key(query, key)) {
+        snprintf(value, sizeof(value), "%llu", atomic_load(&stats->frames_lost));
+        str_parms_add_str(reply, key, value);
+    }
+
+    snprintf(key, sizeof(key), "%s_last_xrun_ns", prefix);
+    if (str_parms_has_key(query, key)) {
+        snprintf(value, sizeof(value), "%lld", atomic_load(&stats->last_ns));
+        str_parms_add_str(reply, key, value);
+    }
 }
 
 static char * adev_get_parameters(const struct audio_hw_device *dev,
                                   const char *keys)
 {
-    return NULL;
+    struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)dev;
+    struct str_parms *query = str_parms_create_str(keys);
+    struct str_parms *reply = str_parms_create();
+    char *str;
+
+    add_tiny4412_xrun_parms(query, reply, AUDIO_PARAMETER_TINY4412_OUT, &adev->out_xruns);
+    add_tiny4412_xrun_parms(query, reply, AUDIO_PARAMETER_TINY4412_IN, &adev->in_xruns);
+
+    str = str_parms_to_str(reply);
+    str_parms_destroy(query);
+    str_parms_destroy(reply);
+
+    return str;
 }
 
 static int adev_init_check(const struct audio_hw_device *dev)
@@ -719,24 +3352,44 @@ static int adev_set_voice_volume(struct audio_hw_device *dev, float volume)
     return -ENOSYS;
 }
 
+/* applied by the output streams on their next write, see update_tiny4412_out_gain() */
 static int adev_set_master_volume(struct audio_hw_device *dev, float volume)
 {
-    return -ENOSYS;
+    struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)dev;
+
+    if (volume < 0 || volume > 1)
+        return -EINVAL;
+
+    atomic_store(&adev->master_volume, volume);
+
+    return 0;
 }
 
 static int adev_get_master_volume(struct audio_hw_device *dev, float *volume)
 {
-    return -ENOSYS;
+    struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)dev;
+
+    *volume = atomic_load(&adev->master_volume);
+
+    return 0;
 }
 
 static int adev_set_master_mute(struct audio_hw_device *dev, bool muted)
 {
-    return -ENOSYS;
+    struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)dev;
+
+    atomic_store(&adev->master_mute, muted);
+
+    return 0;
 }
 
 static int adev_get_master_mute(struct audio_hw_device *dev, bool *muted)
 {
-    return -ENOSYS;
+    struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)dev;
+
+    *muted = atomic_load(&adev->master_mute);
+
+    return 0;
 }
 
 static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
@@ -744,20 +3397,57 @@ static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
     return 0;
 }
 
+/* applied by the input streams on their next period, see update_tiny4412_in_gain() */
 static int adev_set_mic_mute(struct audio_hw_device *dev, bool state)
 {
-    return -ENOSYS;
+    struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)dev;
+
+    atomic_store(&adev->mic_mute, state);
+
+    return 0;
 }
 
 static int adev_get_mic_mute(const struct audio_hw_device *dev, bool *state)
 {
-    return -ENOSYS;
+    struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)dev;
+
+    *state = atomic_load(&adev->mic_mute);
+
+    return 0;
 }
 
 static size_t adev_get_input_buffer_size(const struct audio_hw_device *dev,
                                          const struct audio_config *config)
 {
-    return 2048;
+    audio_format_t format = config->format;
+
+    /* only 16 bit capture is supported */
+    if (format == AUDIO_FORMAT_DEFAULT)
+        format = AUDIO_FORMAT_PCM_16_BIT;
+    if (config->sample_rate == 0)
+        return 0;
+
+    return get_tiny4412_input_buffer_size(config->sample_rate, format,
+                                 audio_channel_count_from_in_mask(config->channel_mask),
+                                 false);
+}
+
+/* move an open input stream from its own pcm over to the capture engine. The
+ * pcm is closed first, the engine opens it again on the next in_read() */
+static int share_tiny4412_in(struct tiny4412_stream_in *in)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&in->lock);
+    if (!in->shared) {
+        standby_tiny4412_in(in);
+        stop_tiny4412_in_capture(in);
+        do_tiny4412_in_standby(in, true);
+        ret = start_tiny4412_in_capture(in, true);
+    }
+    pthread_mutex_unlock(&in->lock);
+
+    return ret;
 }
 
 static int adev_open_input_stream(struct audio_hw_device *dev,
@@ -765,15 +3455,31 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
                                   audio_devices_t devices,
                                   struct audio_config *config,
                                   struct audio_stream_in **stream_in,
-                                  audio_input_flags_t flags __unused,
+                                  audio_input_flags_t flags,
                                   const char *address __unused,
-                                  audio_source_t source __unused)
+                                  audio_source_t source)
 {
     struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)dev;
     struct tiny4412_stream_in *in;
+    struct tiny4412_stream_in *others[AUDIO_HW_MAX_INPUTS];
+    int slot = -1;
+    int i, n = 0;
     int ret;
 
-    in = (struct stub_stream_in *)calloc(1, sizeof(struct tiny4412_stream_in));
+    /* the framework serializes stream open and close, the list cannot change
+     * until this returns */
+    pthread_mutex_lock(&adev->lock);
+    for (i = 0; i < AUDIO_HW_MAX_INPUTS; i++) {
+        if (adev->inputs[i])
+            others[n++] = adev->inputs[i];
+        else if (slot < 0)
+            slot = i;
+    }
+    pthread_mutex_unlock(&adev->lock);
+    if (slot < 0)
+        return -EBUSY;
+
+    in = (struct tiny4412_stream_in *)calloc(1, sizeof(struct tiny4412_stream_in));
     if (!in)
         return -ENOMEM;
 
@@ -797,13 +3503,18 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     in->dev = adev;
     in->standby = true;
     in->requested_rate = config->sample_rate;
-    in->input_source = AUDIO_SOURCE_DEFAULT;
+    in->input_source = source;
     /* strip AUDIO_DEVICE_BIT_IN to allow bitwise comparisons */
     in->device = devices & ~AUDIO_DEVICE_BIT_IN;
     in->io_handle = handle;
     in->channel_mask = config->channel_mask;
     in->flags = flags;
-    struct pcm_config *pcm_config = &pcm_config_in;
+    in->use_mmap = (flags & AUDIO_INPUT_FLAG_FAST) && is_tiny4412_mmap_enabled(PCM_IN);
+    in->downmix = get_tiny4412_downmix_mode();
+    atomic_init(&in->gain_value, 1.0f);
+    conv_gain_init(&in->gain, 1.0f, 1.0f);
+    struct pcm_config *pcm_config = (flags & AUDIO_INPUT_FLAG_FAST) ?
+                                        &pcm_config_in_fast : &pcm_config_in;
     in->config = pcm_config;
 
     in->buffer = malloc(pcm_config->period_size * pcm_config->channels
@@ -821,10 +3532,10 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
         in->buf_provider.get_next_buffer = get_tiny4412_next_buffer;
         in->buf_provider.release_buffer = release_tiny4412_buffer;
 
-        ret = create_resampler(pcm_config->rate,
+        ret = create_tiny4412_resampler(pcm_config->rate,
                                in->requested_rate,
                                audio_channel_count_from_in_mask(in->channel_mask),
-                               RESAMPLER_QUALITY_DEFAULT,
+                               get_tiny4412_resampler_tier(source),
                                &in->buf_provider,
                                &in->resampler);
         if (ret != 0) {
@@ -833,9 +3544,38 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
         }
     }
 
+    /* before the capture thread starts using them */
+    open_tiny4412_taps(in->taps, "in", pcm_config->rate, in->requested_rate,
+                       in->channel_count);
+    audio_timing_start(&in->timing, get_tiny4412_time_ns());
+
+    /* one pcm cannot be opened twice: as soon as a second stream opens, all of
+     * them are fed by the capture engine. They stay on it until closed */
+    if (n > 0) {
+        ret = start_tiny4412_capture_engine(adev);
+        for (i = 0; i < n && ret == 0; i++)
+            ret = share_tiny4412_in(others[i]);
+        if (ret == 0)
+            ret = start_tiny4412_in_capture(in, true);
+        if (ret != 0)
+            goto err_capture;
+    } else if (is_tiny4412_async_enabled(PCM_IN)) {
+        ret = start_tiny4412_in_capture(in, false);
+        if (ret != 0)
+            goto err_capture;
+    }
+
     *stream_in = &in->stream;
-    adev->mic_input = in;
+    pthread_mutex_lock(&adev->lock);
+    adev->inputs[slot] = in;
+    update_tiny4412_devices(adev);
+    pthread_mutex_unlock(&adev->lock);
     return 0;
+err_capture:
+    close_tiny4412_taps(in->taps);
+    if (in->resampler)
+        release_tiny4412_resampler(in->resampler);
+
 err_resampler:
     free(in->buffer);
 
@@ -850,16 +3590,24 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
 {
     struct tiny4412_stream_in *streamin = (struct tiny4412_stream_in *)in;
     struct tiny4412_audio_device *adev = streamin->dev;
+    int i;
 
-    if(streamin->pcm)
-    {
-        pcm_close(streamin->pcm);
-        free(streamin->buffer);
-        streamin->pcm = NULL;
-    }
+    /* out of reach of the standby reaper first */
+    pthread_mutex_lock(&adev->lock);
+    for (i = 0; i < AUDIO_HW_MAX_INPUTS; i++)
+        if (adev->inputs[i] == streamin)
+            adev->inputs[i] = NULL;
+    update_tiny4412_devices(adev);
+    pthread_mutex_unlock(&adev->lock);
+
+    in_standby(&in->common);
+    stop_tiny4412_in_capture(streamin);
+    do_tiny4412_in_standby(streamin, true);
+    close_tiny4412_taps(streamin->taps);
+    free(streamin->buffer);
 
     if (streamin->resampler) {
-        release_resampler(streamin->resampler);
+        release_tiny4412_resampler(streamin->resampler);
         streamin->resampler = NULL;
     }
     
@@ -874,21 +3622,158 @@ static int adev_dump(const audio_hw_device_t *device, int fd)
     
     dprintf(fd,"audio hal dump info:\n");
     dprintf(fd,"out_device:%#x,in_device:%#x\n",adev->out_device,adev->in_device);
+    dprintf(fd,"warm_standby_ms:%u,master_volume:%.3f,master_mute:%d\n",adev->warm_standby_ms,
+            (double)atomic_load(&adev->master_volume),atomic_load(&adev->master_mute));
+    if (adev->route)
+        audio_route_engine_dump(adev->route, fd);
+    dump_tiny4412_xruns(fd, "out_xruns", &adev->out_xruns);
+    dump_tiny4412_xruns(fd, "in_xruns", &adev->in_xruns);
     for(i = 0; i < OUTPUT_TOTAL ; i++)
     {
         if(adev->outputs[i])
         {
-            out_dump(adev->outputs[i],fd);
+            out_dump(&adev->outputs[i]->stream.common,fd);
         }
     }
 
-    in_dump(adev->mic_input,fd);
+    if (adev->mixer.started) {
+        dprintf(fd,"mixer standby:%d,period_size:%u,period_count:%u\n",adev->mixer.standby,adev->mixer.config.period_size,adev->mixer.config.period_count);
+        dump_tiny4412_xruns(fd, "mixer_xruns", &adev->mixer.xruns);
+        audio_histogram_dump(&adev->mixer.io, fd, "mixer_io");
+        audio_histogram_dump(&adev->mixer.start, fd, "mixer_start");
+        pthread_mutex_lock(&adev->mixer.lock);
+        for (i = 0; i < AUDIO_HW_MAX_MIXER_CLIENTS; i++)
+            if (adev->mixer.clients[i])
+                out_dump(&adev->mixer.clients[i]->stream.common, fd);
+        pthread_mutex_unlock(&adev->mixer.lock);
+    }
+    if (adev->capture.started) {
+        dprintf(fd,"capture engine standby:%d,period_size:%u,period_count:%u\n",adev->capture.standby,adev->capture.config.period_size,adev->capture.config.period_count);
+        audio_histogram_dump(&adev->capture.io, fd, "capture_io");
+        audio_histogram_dump(&adev->capture.start, fd, "capture_start");
+    }
+    for(i = 0; i < AUDIO_HW_MAX_INPUTS ; i++)
+    {
+        if(adev->inputs[i])
+        {
+            in_dump(&adev->inputs[i]->stream.common,fd);
+        }
+    }
     
     return 0;
 }
 
+/* really close the pcm of an output left in warm standby for too long. The
+ * stream is skipped if busy, it is then not in standby anyway.
+ * must be called with adev->lock held */
+static void reap_tiny4412_out(struct tiny4412_stream_out *out, int64_t now)
+{
+    int64_t timeout = out->dev->warm_standby_ms * 1000000LL;
+
+    if (pthread_mutex_trylock(&out->lock) != 0)
+        return;
+    if (out->async)
+        pthread_mutex_lock(&out->writer_lock);
+
+    if (out->standby && out->pcm[out->out_type] && now - out->standby_ns >= timeout)
+        do_tiny4412_out_standby(out, true);
+
+    if (out->async)
+        pthread_mutex_unlock(&out->writer_lock);
+    pthread_mutex_unlock(&out->lock);
+}
+
+static void reap_tiny4412_mixer(struct tiny4412_mixer_engine *mixer, int64_t now)
+{
+    int64_t timeout = mixer->dev->warm_standby_ms * 1000000LL;
+
+    pthread_mutex_lock(&mixer->lock);
+    if (mixer->standby && mixer->pcm && now - mixer->standby_ns >= timeout)
+        do_tiny4412_mixer_standby(mixer, true);
+    pthread_mutex_unlock(&mixer->lock);
+}
+
+static void reap_tiny4412_capture(struct tiny4412_capture_engine *engine, int64_t now)
+{
+    int64_t timeout = engine->dev->warm_standby_ms * 1000000LL;
+
+    pthread_mutex_lock(&engine->lock);
+    if (engine->standby && engine->pcm && now - engine->standby_ns >= timeout)
+        do_tiny4412_capture_standby(engine, true);
+    pthread_mutex_unlock(&engine->lock);
+}
+
+static void reap_tiny4412_in(struct tiny4412_stream_in *in, int64_t now)
+{
+    int64_t timeout = in->dev->warm_standby_ms * 1000000LL;
+
+    if (pthread_mutex_trylock(&in->lock) != 0)
+        return;
+    if (in->async)
+        pthread_mutex_lock(&in->capture_lock);
+
+    if (in->standby && in->pcm && now - in->standby_ns >= timeout)
+        do_tiny4412_in_standby(in, true);
+
+    if (in->async)
+        pthread_mutex_unlock(&in->capture_lock);
+    pthread_mutex_unlock(&in->lock);
+}
+
+/* bounds the power cost of warm standby */
+static void *tiny4412_standby_reaper_loop(void *context)
+{
+    struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)context;
+    int i;
+
+    pthread_mutex_lock(&adev->lock);
+    while (!adev->reaper_exit) {
+        int64_t now = get_tiny4412_time_ns();
+        struct timespec ts;
+
+        for (i = 0; i < OUTPUT_TOTAL; i++)
+            if (adev->outputs[i])
+                reap_tiny4412_out(adev->outputs[i], now);
+        for (i = 0; i < AUDIO_HW_MAX_INPUTS; i++)
+            if (adev->inputs[i])
+                reap_tiny4412_in(adev->inputs[i], now);
+        reap_tiny4412_mixer(&adev->mixer, now);
+        reap_tiny4412_capture(&adev->capture, now);
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += AUDIO_HW_WARM_STANDBY_POLL_MS * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&adev->reaper_cond, &adev->lock, &ts);
+    }
+    pthread_mutex_unlock(&adev->lock);
+
+    return NULL;
+}
+
 static int adev_close(hw_device_t *device)
 {
+    struct tiny4412_audio_device *adev = (struct tiny4412_audio_device *)device;
+
+    if (adev->warm_standby_ms > 0) {
+        pthread_mutex_lock(&adev->lock);
+        adev->reaper_exit = true;
+        pthread_cond_signal(&adev->reaper_cond);
+        pthread_mutex_unlock(&adev->lock);
+        pthread_join(adev->reaper_thread, NULL);
+    }
+
+    stop_tiny4412_capture_engine(adev);
+    pthread_cond_destroy(&adev->capture.cond);
+    pthread_mutex_destroy(&adev->capture.lock);
+    stop_tiny4412_mixer_engine(adev);
+    pthread_cond_destroy(&adev->mixer.cond);
+    pthread_mutex_destroy(&adev->mixer.lock);
+    if (adev->route)
+        audio_route_engine_close(adev->route);
+    audio_tap_stop();
     free(device);
     return 0;
 }
@@ -929,7 +3814,33 @@ static int adev_open(const hw_module_t* module, const char* name,
     adev->device.close_input_stream = adev_close_input_stream;
     adev->device.dump = adev_dump;
 
-    adev->mic_mute = false;
+    atomic_init(&adev->mic_mute, false);
+    atomic_init(&adev->master_volume, 1.0f);
+
+    pthread_mutex_init(&adev->lock, NULL);
+    pthread_cond_init(&adev->reaper_cond, NULL);
+    pthread_mutex_init(&adev->capture.lock, NULL);
+    pthread_cond_init(&adev->capture.cond, NULL);
+    adev->capture.dev = adev;
+    pthread_mutex_init(&adev->mixer.lock, NULL);
+    pthread_cond_init(&adev->mixer.cond, NULL);
+    adev->mixer.dev = adev;
+    adev->mixer.enabled = is_tiny4412_mixer_enabled();
+
+    /* the handles are looked up once, routing changes then only write what differs */
+    adev->route = audio_route_engine_open(MIXER_CARD, MIXER_PATHS_CONFIG);
+    if (adev->route == NULL)
+        ALOGW("adev_open() no mixer paths, routing disabled");
+    adev->warm_standby_ms = get_tiny4412_warm_standby_ms();
+    if (adev->warm_standby_ms > 0 &&
+            pthread_create(&adev->reaper_thread, NULL, tiny4412_standby_reaper_loop, adev) != 0) {
+        ALOGW("adev_open() cannot create standby reaper, warm standby disabled");
+        adev->warm_standby_ms = 0;
+    }
+
+    /* the dump itself stays off until debug.audio.dumpdata=1 */
+    if (audio_tap_start() != 0)
+        ALOGW("adev_open() pcm dump not available");
 
     *device = &adev->device.common;
 
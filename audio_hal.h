@@ -1,8 +1,9 @@
-#ifndef __AUDIO_HAL_H__
-#define __AUDIO_HAL_H__
-
+#ifndef __AUDIO_HAL_H__
+#define __AUDIO_HAL_H__
+
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/time.h>
@@ -10,45 +11,90 @@
 
 #include <cutils/log.h>
 #include <cutils/properties.h>
-#include <cutils/str_parms.h>
+#include <cutils/str_parms.h>
 #include <hardware/audio.h>
-#include <hardware/hardware.h>
-
+#include <hardware/hardware.h>
+
 #include <system/audio.h>
 
 #include <tinyalsa/asoundlib.h>
 
 #include <audio_utils/resampler.h>
-//#include <audio_route/audio_route.h>
-
-#include <pthread.h>
-
+#include "audio_conv.h"
+#include "audio_resampler.h"
+#include "audio_ring.h"
+#include "audio_route_engine.h"
+#include "audio_stats.h"
+#include "audio_tap.h"
+
+#include <pthread.h>
+
 // Additionnal latency introduced by audio DSP and hardware in ms
 #define AUDIO_HW_OUT_LATENCY_MS 0
 // Default audio output sample rate
-#define AUDIO_HW_OUT_SAMPLERATE 48000
+#define AUDIO_HW_OUT_SAMPLERATE 48000
 // Default audio output channel mask
-#define AUDIO_HW_OUT_CHANNELS (AUDIO_CHANNEL_OUT_STEREO)
+#define AUDIO_HW_OUT_CHANNELS (AUDIO_CHANNEL_OUT_STEREO)
 // Default audio output sample format
-#define AUDIO_HW_OUT_FORMAT (AUDIO_FORMAT_PCM)//(AudioSystem::PCM_16_BIT)
+#define AUDIO_HW_OUT_FORMAT (AUDIO_FORMAT_PCM)//(AudioSystem::PCM_16_BIT)
 // Kernel pcm out buffer size in frames at 44.1kHz
 #define AUDIO_HW_OUT_PERIOD_SZ 2048     // <== 1024
 #define AUDIO_HW_OUT_PERIOD_CNT 4
 // Default audio output buffer size in bytes
 #define AUDIO_HW_OUT_PERIOD_BYTES (AUDIO_HW_OUT_PERIOD_SZ * 2 * sizeof(int16_t))
+// Kernel pcm out buffer size in frames for AUDIO_OUTPUT_FLAG_FAST streams
+#define AUDIO_HW_OUT_FAST_PERIOD_SZ 256
+#define AUDIO_HW_OUT_FAST_PERIOD_CNT 2
+// Kernel pcm out buffer size in frames for AUDIO_OUTPUT_FLAG_DEEP_BUFFER streams (~1s)
+#define AUDIO_HW_OUT_DEEP_PERIOD_SZ 6144
+#define AUDIO_HW_OUT_DEEP_PERIOD_CNT 8
+
+// Default HDMI multichannel output sample rate
+#define AUDIO_HW_HDMI_SAMPLERATE 48000
+// Kernel pcm out buffer size in frames for the HDMI multichannel output
+#define AUDIO_HW_HDMI_PERIOD_SZ 1024
+#define AUDIO_HW_HDMI_PERIOD_CNT 4
 
 // Default audio input sample rate
-#define AUDIO_HW_IN_SAMPLERATE 48000
+#define AUDIO_HW_IN_SAMPLERATE 48000
 // Default audio input channel mask
-#define AUDIO_HW_IN_CHANNELS (AUDIO_CHANNEL_IN_MONO)//(AudioSystem::CHANNEL_IN_MONO)
+#define AUDIO_HW_IN_CHANNELS (AUDIO_CHANNEL_IN_MONO)//(AudioSystem::CHANNEL_IN_MONO)
 // Default audio input sample format
-#define AUDIO_HW_IN_FORMAT (AUDIO_FORMAT_PCM)//(AudioSystem::PCM_16_BIT)
+#define AUDIO_HW_IN_FORMAT (AUDIO_FORMAT_PCM)//(AudioSystem::PCM_16_BIT)
 // Kernel pcm in buffer size in frames at 44.1kHz (before resampling)
 #define AUDIO_HW_IN_PERIOD_SZ 2048      // <== 1024
 #define AUDIO_HW_IN_PERIOD_CNT 2
+// Kernel pcm in buffer size in frames for AUDIO_INPUT_FLAG_FAST streams
+#define AUDIO_HW_IN_FAST_PERIOD_SZ 256
+#define AUDIO_HW_IN_FAST_PERIOD_CNT 4
 // Default audio input buffer size in bytes (8kHz mono)
-#define AUDIO_HW_IN_PERIOD_BYTES ((AUDIO_HW_IN_PERIOD_SZ*sizeof(int16_t))/8)
-
+#define AUDIO_HW_IN_PERIOD_BYTES ((AUDIO_HW_IN_PERIOD_SZ*sizeof(int16_t))/8)
+
+// length of the volume and mute ramps
+#define AUDIO_HW_GAIN_RAMP_MS 20
+// how often pcms left open in warm standby are checked against their timeout
+#define AUDIO_HW_WARM_STANDBY_POLL_MS 100
+// SCHED_FIFO priority of the HAL real-time threads
+#define AUDIO_HW_RT_PRIORITY 2
+// Room left for resampler rounding when sizing converted output chunks, in frames
+#define AUDIO_HW_OUT_RS_MARGIN 16
+// input streams open at the same time, all but a single one share the capture engine
+#define AUDIO_HW_MAX_INPUTS 4
+// output streams the software mixer accepts, see audio.tiny4412.mixer
+#define AUDIO_HW_MAX_MIXER_CLIENTS 8
+
+/* adev_get_parameters() key prefixes for device wide statistics, e.g.
+ * tiny4412_out_xruns, tiny4412_in_xrun_frames, tiny4412_out_last_xrun_ns */
+#define AUDIO_PARAMETER_TINY4412_OUT "tiny4412_out"
+#define AUDIO_PARAMETER_TINY4412_IN "tiny4412_in"
+/* adev_set_parameters() key clearing the latency histograms of open streams */
+#define AUDIO_PARAMETER_TINY4412_STATS_RESET "tiny4412_stats_reset"
+/* stream get_parameters() keys: CPU time per frame of out_write()/in_read(),
+ * median open or standby exit to first sample, p99 duration of a call */
+#define AUDIO_PARAMETER_TINY4412_CPU_NS_PER_FRAME "tiny4412_cpu_ns_per_frame"
+#define AUDIO_PARAMETER_TINY4412_FIRST_SAMPLE_US "tiny4412_first_sample_us"
+#define AUDIO_PARAMETER_TINY4412_CALL_P99_US "tiny4412_call_p99_us"
+
 #define PCM_CARD 0
 #define PCM_CARD_SPDIF 1
 #define PCM_TOTAL 2
@@ -58,81 +104,227 @@
 #define PCM_DEVICE_VOICE 2
 #define PCM_DEVICE_SCO 3
 
-#define MIXER_CARD 0
-
-#define NULL 0
+#define MIXER_CARD 0
+/* mixer paths for the devices, see tiny4412_mixer_paths.conf */
+#define MIXER_PATHS_CONFIG "/system/etc/tiny4412_mixer_paths.conf"
 
 /* duration in ms of volume ramp applied when starting capture to remove plop */
 #define CAPTURE_START_RAMP_MS 100
 
-
+
 /* maximum number of channel mask configurations supported. Currently the primary
  * output only supports 1 (stereo) and the multi channel HDMI output 2 (5.1 and 7.1) */
-#define MAX_SUPPORTED_CHANNEL_MASKS 2
-
-
-enum output_type {
+#define MAX_SUPPORTED_CHANNEL_MASKS 2
+
+
+enum output_type {
     OUTPUT_LOW_LATENCY,   // low latency output stream
+    OUTPUT_DEEP_BUFFER,   // deep buffer output stream
     OUTPUT_HDMI,          // HDMI multi channel
     OUTPUT_TOTAL
 };
-
-
-struct tiny4412_audio_device;
-
-struct tiny4412_stream_out {
-    struct audio_stream_out stream;
-    struct tiny4412_audio_device *dev;
-    pthread_mutex_t lock; /* see note below on mutex acquisition order */
-    bool standby; /* true if all PCMs are inactive */
-    bool muted;
-    audio_devices_t device;
-    audio_channel_mask_t channel_mask;
-    unsigned int pcm_card_type;
-    unsigned int pcm_device;
-    unsigned int out_type;
-    unsigned int written;
-    struct pcm_config config;
-    struct pcm *pcm[PCM_TOTAL];
+
+
+struct tiny4412_audio_device;
+
+/* xrun accounting, updated without locks from the i/o paths and threads */
+struct tiny4412_xrun_stats {
+    atomic_uint count;
+    atomic_ullong frames_lost; /* frames overwritten (capture) or skipped (playback) */
+    atomic_llong last_ns; /* CLOCK_MONOTONIC time of the last xrun, 0 if none */
+};
+
+struct tiny4412_stream_out {
+    struct audio_stream_out stream;
+    struct tiny4412_audio_device *dev;
+    pthread_mutex_t lock; /* see note below on mutex acquisition order */
+    bool standby; /* true if all PCMs are inactive */
+    bool muted;
+    audio_devices_t device;
+    /* device switch without standby: the gain ramps to silence and device
+     * becomes route_device at route_switch_ns, once the faded audio has played */
+    audio_devices_t route_device; /* AUDIO_DEVICE_NONE when no switch is pending */
+    bool route_muted;
+    int64_t route_switch_ns;
+    audio_channel_mask_t channel_mask;
+    /* Array of supported channel mask configurations. +1 so that the last entry is always 0 */
+    audio_channel_mask_t supported_channel_masks[MAX_SUPPORTED_CHANNEL_MASKS + 1];
+    unsigned int min_rate; /* sample rate range supported by the sink */
+    unsigned int max_rate;
+    audio_output_flags_t flags;
+    unsigned int pcm_card_type;
+    unsigned int pcm_device;
+    unsigned int out_type;
+    uint64_t written; /* frames written since open, not reset on standby */
+    uint32_t latency_ms; /* kernel buffer + DSP latency for config */
+    uint32_t sample_rate; /* rate of the client data, config.rate is the pcm one */
+    audio_format_t format; /* format of the client data, the pcm is always 16 bit */
+    struct resampler_itfe *resampler; /* sample_rate -> config.rate if they differ */
+    int16_t *fmt_buffer; /* client data converted to 16 bit */
+    size_t fmt_buffer_size;
+    int16_t *rs_buffer; /* 16 bit data resampled to config.rate */
+    size_t rs_buffer_size;
+    int16_t *gain_buffer; /* gain output when no other conversion took place */
+    size_t gain_buffer_size;
+    float volume[2]; /* out_set_volume() left and right */
+    struct conv_gain gain; /* volume, mute and master volume, applied at config.rate.
+                              owned by the mixer thread when mixed */
+    bool use_mmap; /* write straight into the DMA ring of a PCM_MMAP|PCM_NOIRQ pcm */
+    bool mmap_running; /* mmap pcm has been started by pcm_start() */
+    int64_t standby_ns; /* when the pcm was left open in warm standby */
+    struct pcm_config config;
+    struct pcm *pcm[OUTPUT_TOTAL];
+
+    /* asynchronous mode: out_write() only queues converted audio in ring and
+     * writer_thread drains it into the pcm. The writer thread then owns the pcm,
+     * standby and pcm handle changes happen under writer_lock */
+    bool async;
+    bool mixed; /* drained by the device mixer instead of a writer thread */
+    struct audio_ring ring;
+    int16_t *writer_buffer; /* one period read from ring */
+    pthread_t writer_thread;
+    pthread_mutex_t writer_lock; /* acquired after lock */
+    pthread_cond_t writer_cond; /* wakes the writer: data, standby or exit */
+    pthread_cond_t space_cond; /* wakes out_write: room in ring, standby done */
+    bool writer_exit;
+    bool writer_standby; /* standby requested, cleared by the writer when done */
+    bool writer_cold; /* the requested standby must close the pcm */
+    bool write_ready_pending; /* non blocking write was short, callback owed */
+    stream_callback_t callback;
+    void *callback_cookie;
+    uint32_t ring_underruns; /* times the ring ran dry while streaming */
+    size_t ring_fill_min; /* lowest ring fill seen by the writer, in bytes */
+
+    struct tiny4412_xrun_stats xruns;
+    struct audio_timing timing;
+    struct audio_tap *taps[AUDIO_TAP_POINTS];
 };
 
-struct tiny4412_stream_in {
-    struct audio_stream_in stream;
-    struct tiny4412_audio_device *dev;
-    audio_devices_t device;
-    struct pcm_config *config;
-    pthread_mutex_t lock; /* see note below on mutex acquisition order */
-
-    struct pcm *pcm;
-    bool standby;
-    bool muted;
-    struct resampler_itfe *resampler;
-    struct resampler_buffer_provider buf_provider;
-    int16_t *buffer;
-    unsigned int channel_count;
+struct tiny4412_stream_in {
+    struct audio_stream_in stream;
+    struct tiny4412_audio_device *dev;
+    audio_devices_t device;
+    struct pcm_config *config;
+    pthread_mutex_t lock; /* see note below on mutex acquisition order */
+
+    struct pcm *pcm;
+    bool standby;
+    bool muted;
+    /* device switch without standby, see tiny4412_stream_out. After the switch
+     * route_switch_ns is when the frames captured on the new device come out */
+    audio_devices_t route_device;
+    bool route_muted;
+    int64_t route_switch_ns;
+    struct resampler_itfe *resampler;
+    struct resampler_buffer_provider buf_provider;
+    int16_t *buffer;
+    unsigned int channel_count;
     unsigned int requested_rate;
-    size_t frames_in;
+    size_t frames_in; /* frames left to consume in buffer */
+    size_t frames_buffered; /* frames placed in buffer by the last read */
     int read_status;
+    bool use_mmap; /* read straight from the DMA ring of a PCM_MMAP|PCM_NOIRQ pcm */
+    int64_t standby_ns; /* when the pcm was left open in warm standby */
+    enum conv_downmix downmix; /* stereo to mono fold for mono streams */
+    _Atomic float gain_value; /* set by in_set_gain(), read by the reading thread */
+    struct conv_gain gain; /* fused with the mono fold, owned by the reading thread */
     audio_source_t input_source;
-    audio_io_handle_t io_handle;
+    audio_io_handle_t io_handle;
     audio_channel_mask_t channel_mask;
-    audio_input_flags_t flags;
-    
+    audio_input_flags_t flags;
+
+    /* asynchronous mode: capture_thread drains the pcm into ring and in_read()
+     * only copies out of it. The capture thread then owns the pcm, standby and
+     * pcm handle changes happen under capture_lock */
+    bool async;
+    bool shared; /* fed by the device capture engine instead of a thread of its own */
+    struct audio_ring ring;
+    int16_t *capture_buffer; /* one period read from the pcm */
+    pthread_t capture_thread;
+    pthread_mutex_t capture_lock; /* acquired after lock */
+    pthread_cond_t capture_cond; /* wakes the capture thread: start, standby or exit */
+    pthread_cond_t data_cond; /* wakes in_read: data, error, standby done */
+    bool capture_exit;
+    bool capture_run; /* capture requested, cleared to go to standby. under the
+                         engine lock instead of capture_lock when shared */
+    bool capture_reading; /* in_read() consumed since the last start */
+    int capture_status; /* last pcm error seen by the capture thread */
+    atomic_uint frames_lost; /* dropped since the last get_input_frames_lost() */
+
+    struct tiny4412_xrun_stats xruns;
+    struct audio_timing timing;
+    struct audio_tap *taps[AUDIO_TAP_POINTS];
+};
+
+/* one pcm read loop feeding several input streams. The thread reads stereo
+ * periods at config.rate and hands every running client its own copy, folded
+ * and scaled for it, in the client ring. Each client then resamples on its own.
+ * lock is acquired after the stream lock and before the client capture_lock */
+struct tiny4412_capture_engine {
+    struct tiny4412_audio_device *dev;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* wakes the thread: client started or exit */
+    pthread_t thread;
+    bool started; /* thread created, on the first shared stream */
+    bool exit;
+    struct pcm *pcm;
+    struct pcm_config config;
+    bool standby;
+    int64_t standby_ns; /* when the pcm was left open in warm standby */
+    int16_t *buffer; /* one period read from the pcm */
+    size_t xrun_frames; /* lost by the last read, to charge to the clients */
+    struct tiny4412_stream_in *clients[AUDIO_HW_MAX_INPUTS];
+    struct audio_histogram io;
+    struct audio_histogram start;
 };
-
-
-struct tiny4412_audio_device {
-    struct audio_hw_device device;
-    pthread_mutex_t lock; /* see note below on mutex acquisition order */
-    audio_devices_t out_device; /* "or" of stream_out.device for all active output streams */
-    audio_devices_t in_device;
-    bool mic_mute;
-    struct tiny4412_stream_out *outputs[OUTPUT_TOTAL];
-    struct tiny4412_stream_in *mic_input;
-};
-
-
-
-
-
-#endif
+
+/* software mixer running the non HDMI outputs on the single PCM_DEVICE pcm.
+ * Clients queue converted audio in their ring like async streams, the thread
+ * mixes one period of every running client with its gain and writes it.
+ * lock is acquired after the stream lock and before the client writer_lock */
+struct tiny4412_mixer_engine {
+    struct tiny4412_audio_device *dev;
+    bool enabled; /* audio.tiny4412.mixer, read at open */
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* wakes the thread: client started or exit */
+    pthread_t thread;
+    bool started; /* thread created, on the first client */
+    bool exit;
+    struct pcm *pcm;
+    struct pcm_config config;
+    bool standby;
+    int64_t standby_ns; /* when the pcm was left open in warm standby */
+    int16_t *buffer; /* one period of mixed audio */
+    struct tiny4412_stream_out *clients[AUDIO_HW_MAX_MIXER_CLIENTS];
+    struct tiny4412_xrun_stats xruns;
+    struct audio_histogram io;
+    struct audio_histogram start;
+};
+
+struct tiny4412_audio_device {
+    struct audio_hw_device device;
+    pthread_mutex_t lock; /* see note below on mutex acquisition order */
+    audio_devices_t out_device; /* "or" of stream_out.device for all open output streams */
+    audio_devices_t in_device; /* same for the input streams, without AUDIO_DEVICE_BIT_IN */
+    /* read by every stream and the mixer and capture threads, without the lock */
+    atomic_bool mic_mute;
+    _Atomic float master_volume;
+    atomic_bool master_mute;
+    struct tiny4412_stream_out *outputs[OUTPUT_TOTAL];
+    struct tiny4412_stream_in *inputs[AUDIO_HW_MAX_INPUTS];
+    struct tiny4412_capture_engine capture; /* as soon as two inputs are open */
+    struct tiny4412_mixer_engine mixer; /* outputs that are not in outputs[] */
+    struct audio_route_engine *route; /* NULL: the codec mixer is left alone */
+    struct tiny4412_xrun_stats out_xruns; /* all output streams */
+    struct tiny4412_xrun_stats in_xruns; /* all input streams */
+    uint32_t warm_standby_ms; /* 0: standby closes the pcms */
+    pthread_t reaper_thread; /* closes pcms in warm standby after warm_standby_ms */
+    pthread_cond_t reaper_cond;
+    bool reaper_exit;
+};
+
+
+
+
+
+#endif
@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hal_resampler"
+//#define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "audio_resampler.h"
+#include "audio_conv.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLER_USE_NEON
+#endif
+
+/* input frames pulled from the provider per refill */
+#define POLYPHASE_CHUNK_FRAMES 512
+
+/* polyphase FIR resampler for rational ratios up/down. Each output frame is
+ * the dot product of one filter phase with a window of taps input frames, so
+ * integer decimations like 48kHz -> 16kHz or 8kHz only compute the outputs
+ * they keep */
+struct polyphase_resampler {
+    struct resampler_itfe itfe; /* must be first */
+    struct resampler_buffer_provider *provider;
+    uint32_t in_rate;
+    uint32_t channels;
+    uint32_t up;        /* interpolation factor */
+    uint32_t down;      /* decimation factor */
+    uint32_t taps;      /* coefficients per phase, multiple of 8 */
+    int16_t *coefs;     /* up phases of taps Q15 coefficients, in input window order */
+    int16_t *hist[2];   /* planar input history per channel */
+    size_t hist_size;   /* capacity of each history in frames */
+    size_t hist_frames; /* valid frames in history */
+    size_t pos;         /* history index of the newest input frame of the next output */
+    uint32_t phase;     /* filter phase of the next output */
+};
+
+/* filter length per phase and passband edge, relative to the lowest nyquist
+ * frequency, of each tier */
+static const uint32_t tier_taps[] = { 8, 16, 32 };
+static const double tier_rolloff[] = { 0.80, 0.88, 0.92 };
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static inline int16_t polyphase_dot(const int16_t *x, const int16_t *c, uint32_t taps)
+{
+    int32_t acc;
+    uint32_t j;
+
+#ifdef RESAMPLER_USE_NEON
+    int32x4_t sum = vdupq_n_s32(0);
+    int32x2_t sum2;
+
+    for (j = 0; j < taps; j += 8) {
+        int16x8_t vx = vld1q_s16(x + j);
+        int16x8_t vc = vld1q_s16(c + j);
+
+        sum = vmlal_s16(sum, vget_low_s16(vx), vget_low_s16(vc));
+        sum = vmlal_s16(sum, vget_high_s16(vx), vget_high_s16(vc));
+    }
+    sum2 = vadd_s32(vget_low_s32(sum), vget_high_s32(sum));
+    acc = vget_lane_s32(vpadd_s32(sum2, sum2), 0);
+#else
+    acc = 0;
+    for (j = 0; j < taps; j++)
+        acc += (int32_t)x[j] * c[j];
+#endif
+
+    acc = (acc + (1 << 14)) >> 15;
+    if (acc > INT16_MAX)
+        acc = INT16_MAX;
+    else if (acc < INT16_MIN)
+        acc = INT16_MIN;
+
+    return (int16_t)acc;
+}
+
+/* blackman windowed sinc low pass at the upsampled rate, split into phases.
+ * Each phase is normalized to unity DC gain */
+static int polyphase_design(struct polyphase_resampler *pr, double rolloff)
+{
+    size_t n_taps = (size_t)pr->up * pr->taps;
+    double fc = 0.5 * rolloff / (pr->up > pr->down ? pr->up : pr->down);
+    double center = (n_taps - 1) / 2.0;
+    double *h;
+    size_t n;
+    uint32_t p, k;
+
+    h = malloc(n_taps * sizeof(double));
+    if (h == NULL)
+        return -ENOMEM;
+
+    for (n = 0; n < n_taps; n++) {
+        double x = n - center;
+        double w = 0.42 - 0.5 * cos(2 * M_PI * n / (n_taps - 1)) +
+                   0.08 * cos(4 * M_PI * n / (n_taps - 1));
+
+        h[n] = (x == 0.0 ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x)) * w;
+    }
+
+    /* phase p holds h[p + k * up]. Coefficient k multiplies the input k frames
+     * before the newest one, so store them reversed to match the window order */
+    for (p = 0; p < pr->up; p++) {
+        double sum = 0;
+
+        for (k = 0; k < pr->taps; k++)
+            sum += h[p + k * pr->up];
+        for (k = 0; k < pr->taps; k++) {
+            double v = sum != 0 ? h[p + k * pr->up] / sum * 32768.0 : 0;
+
+            if (v > INT16_MAX)
+                v = INT16_MAX;
+            else if (v < INT16_MIN)
+                v = INT16_MIN;
+            pr->coefs[p * pr->taps + (pr->taps - 1 - k)] = (int16_t)lrint(v);
+        }
+    }
+
+    free(h);
+    return 0;
+}
+
+static void polyphase_reset(struct resampler_itfe *resampler)
+{
+    struct polyphase_resampler *pr = (struct polyphase_resampler *)resampler;
+    uint32_t c;
+
+    /* start with taps - 1 frames of silence so that the first output is aligned
+     * on the first input frame */
+    for (c = 0; c < pr->channels; c++)
+        memset(pr->hist[c], 0, pr->hist_size * sizeof(int16_t));
+    pr->hist_frames = pr->taps - 1;
+    pr->pos = pr->taps - 1;
+    pr->phase = 0;
+}
+
+static void polyphase_append(struct polyphase_resampler *pr, const int16_t *in, size_t frames)
+{
+    if (pr->channels == 2)
+        conv_deinterleave_stereo(pr->hist[0] + pr->hist_frames,
+                                 pr->hist[1] + pr->hist_frames, in, frames);
+    else
+        memcpy(pr->hist[0] + pr->hist_frames, in, frames * sizeof(int16_t));
+    pr->hist_frames += frames;
+}
+
+/* drop the history no future output needs and append new input, taken from
+ * *in if not NULL or else from the provider. returns the number of frames added */
+static size_t polyphase_refill(struct polyphase_resampler *pr,
+                               const int16_t **in, size_t *in_frames)
+{
+    size_t keep_from = pr->pos + 1 - pr->taps;
+    size_t frames;
+    uint32_t c;
+
+    if (keep_from > pr->hist_frames)
+        keep_from = pr->hist_frames;
+    if (keep_from > 0) {
+        for (c = 0; c < pr->channels; c++)
+            memmove(pr->hist[c], pr->hist[c] + keep_from,
+                    (pr->hist_frames - keep_from) * sizeof(int16_t));
+        pr->hist_frames -= keep_from;
+        pr->pos -= keep_from;
+    }
+
+    frames = pr->hist_size - pr->hist_frames;
+    if (frames == 0)
+        return 0;
+
+    if (in != NULL) {
+        if (frames > *in_frames)
+            frames = *in_frames;
+        polyphase_append(pr, *in, frames);
+        *in += frames * pr->channels;
+        *in_frames -= frames;
+    } else {
+        struct resampler_buffer buf;
+
+        if (pr->provider == NULL)
+            return 0;
+
+        buf.frame_count = frames;
+        pr->provider->get_next_buffer(pr->provider, &buf);
+        if (buf.raw == NULL)
+            return 0;
+        frames = buf.frame_count;
+        polyphase_append(pr, buf.i16, frames);
+        pr->provider->release_buffer(pr->provider, &buf);
+    }
+
+    return frames;
+}
+
+static size_t polyphase_run(struct polyphase_resampler *pr, int16_t *out, size_t out_frames,
+                            const int16_t **in, size_t *in_frames)
+{
+    size_t n = 0;
+    uint32_t c;
+
+    while (n < out_frames) {
+        const int16_t *coef;
+
+        if (pr->pos >= pr->hist_frames) {
+            if (polyphase_refill(pr, in, in_frames) == 0)
+                break;
+            continue;
+        }
+
+        coef = pr->coefs + pr->phase * pr->taps;
+        for (c = 0; c < pr->channels; c++)
+            out[n * pr->channels + c] =
+                    polyphase_dot(pr->hist[c] + pr->pos + 1 - pr->taps, coef, pr->taps);
+        n++;
+
+        pr->phase += pr->down;
+        pr->pos += pr->phase / pr->up;
+        pr->phase %= pr->up;
+    }
+
+    return n;
+}
+
+static int polyphase_resample_from_provider(struct resampler_itfe *resampler,
+                                            int16_t *out, size_t *outFrameCount)
+{
+    struct polyphase_resampler *pr = (struct polyphase_resampler *)resampler;
+
+    if (pr == NULL || out == NULL || outFrameCount == NULL)
+        return -EINVAL;
+    if (pr->provider == NULL) {
+        *outFrameCount = 0;
+        return -ENOSYS;
+    }
+
+    *outFrameCount = polyphase_run(pr, out, *outFrameCount, NULL, NULL);
+
+    return 0;
+}
+
+static int polyphase_resample_from_input(struct resampler_itfe *resampler,
+                                         int16_t *in, size_t *inFrameCount,
+                                         int16_t *out, size_t *outFrameCount)
+{
+    struct polyphase_resampler *pr = (struct polyphase_resampler *)resampler;
+    const int16_t *src = in;
+    size_t in_frames;
+
+    if (pr == NULL || in == NULL || inFrameCount == NULL ||
+            out == NULL || outFrameCount == NULL)
+        return -EINVAL;
+
+    in_frames = *inFrameCount;
+    *outFrameCount = polyphase_run(pr, out, *outFrameCount, &src, &in_frames);
+
+    /* keep whatever input still fits for the next call */
+    while (in_frames > 0 && polyphase_refill(pr, &src, &in_frames) > 0)
+        ;
+    *inFrameCount -= in_frames;
+
+    return 0;
+}
+
+static int32_t polyphase_delay_ns(struct resampler_itfe *resampler)
+{
+    struct polyphase_resampler *pr = (struct polyphase_resampler *)resampler;
+
+    /* center of the filter, in input frames */
+    return (int32_t)(((int64_t)pr->up * pr->taps - 1) * 1000000000LL /
+                     (2LL * pr->up * pr->in_rate));
+}
+
+static void polyphase_free(struct polyphase_resampler *pr)
+{
+    free(pr->hist[0]);
+    free(pr->hist[1]);
+    free(pr->coefs);
+    free(pr);
+}
+
+int create_tiny4412_resampler(uint32_t in_rate,
+                              uint32_t out_rate,
+                              uint32_t channels,
+                              enum resampler_tier tier,
+                              struct resampler_buffer_provider *provider,
+                              struct resampler_itfe **resampler)
+{
+    struct polyphase_resampler *pr;
+    uint32_t g;
+    uint32_t c;
+
+    if (resampler == NULL || in_rate == 0 || out_rate == 0)
+        return -EINVAL;
+
+    *resampler = NULL;
+
+    g = gcd(in_rate, out_rate);
+    if (tier >= RESAMPLER_TIER_SPEEX || channels < 1 || channels > 2 ||
+            out_rate / g > RESAMPLER_MAX_PHASES) {
+        ALOGV("create_tiny4412_resampler() %u -> %u using libaudioutils", in_rate, out_rate);
+        return create_resampler(in_rate, out_rate, channels,
+                                RESAMPLER_QUALITY_DEFAULT, provider, resampler);
+    }
+
+    pr = (struct polyphase_resampler *)calloc(1, sizeof(struct polyphase_resampler));
+    if (pr == NULL)
+        return -ENOMEM;
+
+    pr->itfe.reset = polyphase_reset;
+    pr->itfe.resample_from_provider = polyphase_resample_from_provider;
+    pr->itfe.resample_from_input = polyphase_resample_from_input;
+    pr->itfe.delay_ns = polyphase_delay_ns;
+    pr->provider = provider;
+    pr->in_rate = in_rate;
+    pr->channels = channels;
+    pr->up = out_rate / g;
+    pr->down = in_rate / g;
+    /* the filter must span the same input duration whatever the decimation */
+    pr->taps = tier_taps[tier] * ((pr->down + pr->up - 1) / pr->up);
+    pr->hist_size = pr->taps + POLYPHASE_CHUNK_FRAMES;
+
+    pr->coefs = malloc((size_t)pr->up * pr->taps * sizeof(int16_t));
+    for (c = 0; c < channels; c++)
+        pr->hist[c] = malloc(pr->hist_size * sizeof(int16_t));
+    if (pr->coefs == NULL || pr->hist[0] == NULL || (channels == 2 && pr->hist[1] == NULL) ||
+            polyphase_design(pr, tier_rolloff[tier]) != 0) {
+        polyphase_free(pr);
+        return -ENOMEM;
+    }
+
+    polyphase_reset(&pr->itfe);
+
+    ALOGV("create_tiny4412_resampler() %u -> %u up:%u down:%u taps:%u",
+          in_rate, out_rate, pr->up, pr->down, pr->taps);
+
+    *resampler = &pr->itfe;
+
+    return 0;
+}
+
+void release_tiny4412_resampler(struct resampler_itfe *resampler)
+{
+    if (resampler == NULL)
+        return;
+
+    if (resampler->reset == polyphase_reset)
+        polyphase_free((struct polyphase_resampler *)resampler);
+    else
+        release_resampler(resampler);
+}
@@ -0,0 +1,33 @@
+#ifndef __AUDIO_RESAMPLER_H__
+#define __AUDIO_RESAMPLER_H__
+
+#include <stdint.h>
+
+#include <audio_utils/resampler.h>
+
+/* quality/CPU tiers of the polyphase resampler */
+enum resampler_tier {
+    RESAMPLER_TIER_LOW,     // short filters, for voice
+    RESAMPLER_TIER_MEDIUM,
+    RESAMPLER_TIER_HIGH,    // long filters, for recording
+    RESAMPLER_TIER_SPEEX,   // libaudioutils resampler
+};
+
+/* largest interpolation factor, after reduction of the rate ratio, handled by
+ * the polyphase resampler. Other ratios use the libaudioutils resampler */
+#define RESAMPLER_MAX_PHASES 160
+
+/* create a resampler converting in_rate to out_rate for 1 or 2 channels of
+ * 16 bit samples. The returned interface is the libaudioutils one so callers
+ * do not need to know which implementation was picked. provider can be NULL
+ * if only resample_from_input() is used */
+int create_tiny4412_resampler(uint32_t in_rate,
+                              uint32_t out_rate,
+                              uint32_t channels,
+                              enum resampler_tier tier,
+                              struct resampler_buffer_provider *provider,
+                              struct resampler_itfe **resampler);
+
+void release_tiny4412_resampler(struct resampler_itfe *resampler);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_ring.h"
+
+int audio_ring_init(struct audio_ring *ring, size_t size)
+{
+    size_t rounded = 1;
+
+    while (rounded < size)
+        rounded <<= 1;
+
+    ring->data = malloc(rounded);
+    if (ring->data == NULL) {
+        ring->size = 0;
+        return -ENOMEM;
+    }
+    ring->size = rounded;
+    atomic_init(&ring->front, 0);
+    atomic_init(&ring->rear, 0);
+
+    return 0;
+}
+
+void audio_ring_release(struct audio_ring *ring)
+{
+    free(ring->data);
+    ring->data = NULL;
+    ring->size = 0;
+}
+
+size_t audio_ring_writable(struct audio_ring *ring)
+{
+    size_t front = atomic_load_explicit(&ring->front, memory_order_acquire);
+    size_t rear = atomic_load_explicit(&ring->rear, memory_order_relaxed);
+
+    return ring->size - (rear - front);
+}
+
+size_t audio_ring_readable(struct audio_ring *ring)
+{
+    size_t rear = atomic_load_explicit(&ring->rear, memory_order_acquire);
+    size_t front = atomic_load_explicit(&ring->front, memory_order_relaxed);
+
+    return rear - front;
+}
+
+size_t audio_ring_write(struct audio_ring *ring, const void *data, size_t bytes)
+{
+    size_t rear = atomic_load_explicit(&ring->rear, memory_order_relaxed);
+    size_t offset = rear & (ring->size - 1);
+    size_t part;
+
+    if (bytes > audio_ring_writable(ring))
+        bytes = audio_ring_writable(ring);
+
+    part = ring->size - offset;
+    if (part > bytes)
+        part = bytes;
+    memcpy(ring->data + offset, data, part);
+    memcpy(ring->data, (const uint8_t *)data + part, bytes - part);
+
+    /* publish the data before the new rear */
+    atomic_store_explicit(&ring->rear, rear + bytes, memory_order_release);
+
+    return bytes;
+}
+
+size_t audio_ring_read(struct audio_ring *ring, void *data, size_t bytes)
+{
+    size_t front = atomic_load_explicit(&ring->front, memory_order_relaxed);
+    size_t offset = front & (ring->size - 1);
+    size_t part;
+
+    if (bytes > audio_ring_readable(ring))
+        bytes = audio_ring_readable(ring);
+
+    part = ring->size - offset;
+    if (part > bytes)
+        part = bytes;
+    memcpy(data, ring->data + offset, part);
+    memcpy((uint8_t *)data + part, ring->data, bytes - part);
+
+    /* release the space only once the data has been copied out */
+    atomic_store_explicit(&ring->front, front + bytes, memory_order_release);
+
+    return bytes;
+}
+
+void audio_ring_flush(struct audio_ring *ring)
+{
+    atomic_store_explicit(&ring->front,
+                          atomic_load_explicit(&ring->rear, memory_order_acquire),
+                          memory_order_release);
+}
@@ -0,0 +1,34 @@
+#ifndef __AUDIO_RING_H__
+#define __AUDIO_RING_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* lock-free single producer / single consumer byte ring. One thread may call
+ * audio_ring_write() while another calls audio_ring_read() without any lock.
+ * front and rear count bytes since the last flush and wrap naturally, the
+ * size is a power of two so that the difference stays valid */
+struct audio_ring {
+    uint8_t *data;
+    size_t size;
+    atomic_size_t front; /* bytes consumed, only moved by the consumer */
+    atomic_size_t rear;  /* bytes produced, only moved by the producer */
+};
+
+/* allocate a ring of at least size bytes. returns 0 or -ENOMEM */
+int audio_ring_init(struct audio_ring *ring, size_t size);
+void audio_ring_release(struct audio_ring *ring);
+
+/* producer side: copy up to bytes into the ring, returns the bytes copied */
+size_t audio_ring_write(struct audio_ring *ring, const void *data, size_t bytes);
+size_t audio_ring_writable(struct audio_ring *ring);
+
+/* consumer side: copy up to bytes out of the ring, returns the bytes copied */
+size_t audio_ring_read(struct audio_ring *ring, void *data, size_t bytes);
+size_t audio_ring_readable(struct audio_ring *ring);
+/* drop everything queued. consumer side */
+void audio_ring_flush(struct audio_ring *ring);
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hal_route"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <tinyalsa/asoundlib.h>
+
+#include "audio_route_engine.h"
+
+// longest config line, ALSA control names are at most 44 characters
+#define AUDIO_ROUTE_LINE_MAX 256
+#define AUDIO_ROUTE_TOKENS 3
+
+/* the config file is made of sections, each followed by its settings:
+ *
+ *   default
+ *       "Speaker Playback Volume" 121
+ *   path speaker
+ *       "Left Speaker Mixer PCM Playback Switch" 1
+ *
+ * a setting is a control name, quoted if it contains spaces, and an integer or
+ * an enum string. # starts a comment */
+enum route_section {
+    ROUTE_SECTION_NONE,
+    ROUTE_SECTION_DEFAULT,
+    ROUTE_SECTION_PATH,
+};
+
+/* split line in place into words and "quoted strings", dropping comments.
+ * returns the number of tokens or -EINVAL */
+static int split_route_line(char *line, char **tokens, int max)
+{
+    int n = 0;
+    char *p = line;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+        if (*p == '\0' || *p == '#')
+            break;
+        if (n == max)
+            return -EINVAL;
+
+        if (*p == '"') {
+            tokens[n++] = ++p;
+            p = strchr(p, '"');
+            if (p == NULL)
+                return -EINVAL;
+        } else {
+            tokens[n++] = p;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                p++;
+            if (*p == '\0')
+                break;
+        }
+        *p++ = '\0';
+    }
+
+    return n;
+}
+
+/* returns the index of the control in engine->ctls, looking it up in the mixer
+ * and reading its value the first time. -ENOENT if the mixer has no such control */
+static int get_route_ctl(struct audio_route_engine *engine, const char *name)
+{
+    struct audio_route_ctl *ctls;
+    struct audio_route_ctl *rc;
+    struct mixer_ctl *ctl;
+    unsigned int i;
+
+    for (i = 0; i < engine->num_ctls; i++)
+        if (strcmp(engine->ctls[i].name, name) == 0)
+            return i;
+
+    ctl = mixer_get_ctl_by_name(engine->mixer, name);
+    if (ctl == NULL)
+        return -ENOENT;
+
+    ctls = realloc(engine->ctls, (engine->num_ctls + 1) * sizeof(*ctls));
+    if (ctls == NULL)
+        return -ENOMEM;
+    engine->ctls = ctls;
+
+    rc = &ctls[engine->num_ctls];
+    rc->name = strdup(name);
+    if (rc->name == NULL)
+        return -ENOMEM;
+    rc->ctl = ctl;
+    rc->num_values = mixer_ctl_get_num_values(ctl);
+    /* what the other channels hold does not matter: all are written together */
+    rc->current = mixer_ctl_get_value(ctl, 0);
+    rc->reset = rc->current;
+
+    return engine->num_ctls++;
+}
+
+/* integer, or the index of an enum string. returns 0 or -EINVAL */
+static int parse_route_value(struct mixer_ctl *ctl, const char *token, int *value)
+{
+    char *end;
+    unsigned int i;
+
+    *value = strtol(token, &end, 0);
+    if (*token != '\0' && *end == '\0')
+        return 0;
+
+    if (mixer_ctl_get_type(ctl) != MIXER_CTL_TYPE_ENUM)
+        return -EINVAL;
+
+    for (i = 0; i < mixer_ctl_get_num_enums(ctl); i++) {
+        if (strcmp(mixer_ctl_get_enum_string(ctl, i), token) == 0) {
+            *value = i;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+static int add_route_setting(struct audio_route_path *path, unsigned int ctl, int value)
+{
+    struct audio_route_setting *settings;
+    unsigned int i;
+
+    /* the last setting of a control in a path wins */
+    for (i = 0; i < path->count; i++) {
+        if (path->settings[i].ctl == ctl) {
+            path->settings[i].value = value;
+            return 0;
+        }
+    }
+
+    settings = realloc(path->settings, (path->count + 1) * sizeof(*settings));
+    if (settings == NULL)
+        return -ENOMEM;
+
+    settings[path->count].ctl = ctl;
+    settings[path->count].value = value;
+    path->settings = settings;
+    path->count++;
+
+    return 0;
+}
+
+/* unknown controls and bad values are skipped with a warning so that one
+ * typo does not cost the whole routing. returns 0 or a negative error */
+static int load_route_config(struct audio_route_engine *engine, const char *config)
+{
+    char line[AUDIO_ROUTE_LINE_MAX];
+    char *tokens[AUDIO_ROUTE_TOKENS];
+    enum route_section section = ROUTE_SECTION_NONE;
+    struct audio_route_path *path = NULL;
+    unsigned int line_no = 0;
+    FILE *file;
+    int ret = 0;
+
+    file = fopen(config, "r");
+    if (file == NULL) {
+        ALOGE("load_route_config() cannot open %s: %s", config, strerror(errno));
+        return -errno;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        int n = split_route_line(line, tokens, AUDIO_ROUTE_TOKENS);
+        int ctl;
+        int value;
+
+        line_no++;
+        if (n == 0)
+            continue;
+        if (n < 0) {
+            ALOGW("%s:%u: syntax error", config, line_no);
+            continue;
+        }
+
+        if (n == 1 && strcmp(tokens[0], "default") == 0) {
+            section = ROUTE_SECTION_DEFAULT;
+            continue;
+        }
+        if (n == 2 && strcmp(tokens[0], "path") == 0) {
+            if (audio_route_engine_find_path(engine, tokens[1]) >= 0 ||
+                    engine->num_paths == AUDIO_ROUTE_MAX_PATHS) {
+                ALOGW("%s:%u: path %s ignored", config, line_no, tokens[1]);
+                section = ROUTE_SECTION_NONE;
+                continue;
+            }
+            path = &engine->paths[engine->num_paths++];
+            strlcpy(path->name, tokens[1], sizeof(path->name));
+            section = ROUTE_SECTION_PATH;
+            continue;
+        }
+
+        if (n != 2 || section == ROUTE_SECTION_NONE) {
+            ALOGW("%s:%u: unexpected line", config, line_no);
+            continue;
+        }
+
+        ctl = get_route_ctl(engine, tokens[0]);
+        if (ctl == -ENOMEM) {
+            ret = ctl;
+            break;
+        }
+        if (ctl < 0) {
+            ALOGW("%s:%u: no control %s", config, line_no, tokens[0]);
+            continue;
+        }
+        if (parse_route_value(engine->ctls[ctl].ctl, tokens[1], &value) != 0) {
+            ALOGW("%s:%u: bad value %s for %s", config, line_no, tokens[1], tokens[0]);
+            continue;
+        }
+
+        if (section == ROUTE_SECTION_DEFAULT) {
+            engine->ctls[ctl].reset = value;
+        } else {
+            ret = add_route_setting(path, ctl, value);
+            if (ret != 0)
+                break;
+        }
+    }
+
+    fclose(file);
+
+    return ret;
+}
+
+struct audio_route_engine *audio_route_engine_open(unsigned int card, const char *config)
+{
+    struct audio_route_engine *engine;
+
+    engine = calloc(1, sizeof(*engine));
+    if (engine == NULL)
+        return NULL;
+
+    engine->mixer = mixer_open(card);
+    if (engine->mixer == NULL) {
+        ALOGE("audio_route_engine_open() cannot open mixer of card %u", card);
+        free(engine);
+        return NULL;
+    }
+
+    if (load_route_config(engine, config) != 0) {
+        audio_route_engine_close(engine);
+        return NULL;
+    }
+
+    /* the only full pass: from here on only what changes is written */
+    audio_route_engine_apply(engine, 0);
+    ALOGI("audio_route_engine_open() %u paths, %u controls, %u written",
+          engine->num_paths, engine->num_ctls, engine->writes);
+
+    return engine;
+}
+
+void audio_route_engine_close(struct audio_route_engine *engine)
+{
+    unsigned int i;
+
+    for (i = 0; i < engine->num_paths; i++)
+        free(engine->paths[i].settings);
+    for (i = 0; i < engine->num_ctls; i++)
+        free(engine->ctls[i].name);
+    free(engine->ctls);
+    mixer_close(engine->mixer);
+    free(engine);
+}
+
+int audio_route_engine_find_path(struct audio_route_engine *engine, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < engine->num_paths; i++)
+        if (strcmp(engine->paths[i].name, name) == 0)
+            return i;
+
+    return -ENOENT;
+}
+
+int audio_route_engine_apply(struct audio_route_engine *engine, uint32_t paths)
+{
+    unsigned int written = 0;
+    unsigned int i, j;
+    int ret = 0;
+
+    for (i = 0; i < engine->num_ctls; i++)
+        engine->ctls[i].target = engine->ctls[i].reset;
+
+    for (i = 0; i < engine->num_paths; i++) {
+        const struct audio_route_path *path = &engine->paths[i];
+
+        if (!(paths & (1u << i)))
+            continue;
+        for (j = 0; j < path->count; j++)
+            engine->ctls[path->settings[j].ctl].target = path->settings[j].value;
+    }
+
+    for (i = 0; i < engine->num_ctls; i++) {
+        struct audio_route_ctl *rc = &engine->ctls[i];
+
+        if (rc->target == rc->current)
+            continue;
+
+        for (j = 0; j < rc->num_values; j++)
+            if (mixer_ctl_set_value(rc->ctl, j, rc->target) != 0)
+                break;
+
+        if (j < rc->num_values) {
+            ALOGE("audio_route_engine_apply() cannot set %s to %d", rc->name, rc->target);
+            /* try again on the next apply */
+            rc->current = AUDIO_ROUTE_UNKNOWN;
+            ret = -EIO;
+            continue;
+        }
+        rc->current = rc->target;
+        written++;
+    }
+
+    engine->active = paths;
+    engine->writes += written;
+
+    return ret < 0 ? ret : (int)written;
+}
+
+void audio_route_engine_dump(struct audio_route_engine *engine, int fd)
+{
+    unsigned int i;
+
+    dprintf(fd,"route active:%#x,paths:%u,ctls:%u,writes:%u\n",
+            engine->active,engine->num_paths,engine->num_ctls,engine->writes);
+    for (i = 0; i < engine->num_paths; i++)
+        if (engine->active & (1u << i))
+            dprintf(fd,"route path:%s\n",engine->paths[i].name);
+}
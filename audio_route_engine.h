@@ -0,0 +1,64 @@
+#ifndef __AUDIO_ROUTE_ENGINE_H__
+#define __AUDIO_ROUTE_ENGINE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// paths a config may define, one bit each in the active mask
+#define AUDIO_ROUTE_MAX_PATHS 32
+// current value of a control that must be written on the next apply
+#define AUDIO_ROUTE_UNKNOWN INT32_MIN
+
+struct mixer;
+struct mixer_ctl;
+
+/* a mixer control used by the config. The handle is looked up once at open,
+ * every value is written to all the channels of the control */
+struct audio_route_ctl {
+    struct mixer_ctl *ctl;
+    char *name;
+    unsigned int num_values;
+    int reset;      // value with no path active: the default section or the boot value
+    int current;    // last value written or read, AUDIO_ROUTE_UNKNOWN after a failed write
+    int target;     // scratch for audio_route_engine_apply()
+};
+
+struct audio_route_setting {
+    unsigned int ctl;   // index in ctls
+    int value;
+};
+
+struct audio_route_path {
+    char name[32];
+    struct audio_route_setting *settings;
+    unsigned int count;
+};
+
+/* not thread safe, the HAL calls it with the device lock held */
+struct audio_route_engine {
+    struct mixer *mixer;
+    struct audio_route_ctl *ctls;
+    unsigned int num_ctls;
+    struct audio_route_path paths[AUDIO_ROUTE_MAX_PATHS];
+    unsigned int num_paths;
+    uint32_t active;    // bit per path
+    unsigned int writes;    // controls written since open
+};
+
+/* open the mixer of card and load the paths of the config file. The controls
+ * are set to their default values. returns NULL on failure */
+struct audio_route_engine *audio_route_engine_open(unsigned int card, const char *config);
+void audio_route_engine_close(struct audio_route_engine *engine);
+
+/* returns the index of the named path or -ENOENT */
+int audio_route_engine_find_path(struct audio_route_engine *engine, const char *name);
+
+/* make exactly the paths in the mask active. Settings of later paths in the
+ * config win over earlier ones, controls no path sets go back to their reset
+ * value. Only the controls whose value changes are written.
+ * returns the number of controls written or a negative error */
+int audio_route_engine_apply(struct audio_route_engine *engine, uint32_t paths);
+
+void audio_route_engine_dump(struct audio_route_engine *engine, int fd);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "audio_stats.h"
+
+static unsigned int audio_histogram_index(uint32_t us)
+{
+    unsigned int octave;
+    unsigned int index;
+
+    if (us < AUDIO_HISTOGRAM_SUB_BUCKETS)
+        return us;
+
+    /* position of the top bit, the next two bits pick the sub bucket */
+    octave = 31 - __builtin_clz(us);
+    index = AUDIO_HISTOGRAM_SUB_BUCKETS * (octave - 1) +
+            ((us >> (octave - 2)) & (AUDIO_HISTOGRAM_SUB_BUCKETS - 1));
+
+    return index < AUDIO_HISTOGRAM_BUCKETS ? index : AUDIO_HISTOGRAM_BUCKETS - 1;
+}
+
+static uint32_t audio_histogram_upper_us(unsigned int index)
+{
+    unsigned int octave;
+    unsigned int sub;
+
+    if (index < AUDIO_HISTOGRAM_SUB_BUCKETS)
+        return index;
+
+    octave = index / AUDIO_HISTOGRAM_SUB_BUCKETS + 1;
+    sub = index % AUDIO_HISTOGRAM_SUB_BUCKETS;
+
+    return ((AUDIO_HISTOGRAM_SUB_BUCKETS + sub + 1) << (octave - 2)) - 1;
+}
+
+void audio_histogram_add(struct audio_histogram *hist, int64_t ns)
+{
+    uint32_t us = ns <= 0 ? 0 : ns / 1000 > UINT32_MAX ? UINT32_MAX : ns / 1000;
+    uint32_t max = atomic_load_explicit(&hist->max_us, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&hist->buckets[audio_histogram_index(us)], 1,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_us, us, memory_order_relaxed);
+    while (us > max &&
+           !atomic_compare_exchange_weak_explicit(&hist->max_us, &max, us,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void audio_histogram_reset(struct audio_histogram *hist)
+{
+    unsigned int i;
+
+    for (i = 0; i < AUDIO_HISTOGRAM_BUCKETS; i++)
+        atomic_store_explicit(&hist->buckets[i], 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->sum_us, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->max_us, 0, memory_order_relaxed);
+}
+
+uint32_t audio_histogram_percentile(struct audio_histogram *hist, unsigned int percent)
+{
+    uint64_t total = 0;
+    uint64_t target;
+    uint64_t seen = 0;
+    unsigned int i;
+
+    /* sum the buckets rather than trusting count, they may be updated meanwhile */
+    for (i = 0; i < AUDIO_HISTOGRAM_BUCKETS; i++)
+        total += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    if (total == 0)
+        return 0;
+
+    target = (total * percent + 99) / 100;
+    for (i = 0; i < AUDIO_HISTOGRAM_BUCKETS; i++) {
+        seen += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        if (seen >= target)
+            break;
+    }
+    if (i == AUDIO_HISTOGRAM_BUCKETS - 1 || i == AUDIO_HISTOGRAM_BUCKETS)
+        return atomic_load_explicit(&hist->max_us, memory_order_relaxed);
+
+    return audio_histogram_upper_us(i);
+}
+
+void audio_histogram_dump(struct audio_histogram *hist, int fd, const char *name)
+{
+    unsigned long long count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+    unsigned long long sum = atomic_load_explicit(&hist->sum_us, memory_order_relaxed);
+
+    dprintf(fd,"%s count:%llu,mean_us:%llu,p50_us:%u,p90_us:%u,p99_us:%u,max_us:%u\n",name,
+            count,count ? sum / count : 0,
+            audio_histogram_percentile(hist, 50),
+            audio_histogram_percentile(hist, 90),
+            audio_histogram_percentile(hist, 99),
+            atomic_load_explicit(&hist->max_us, memory_order_relaxed));
+}
+
+void audio_timing_call(struct audio_timing *timing, int64_t begin_ns, int64_t end_ns,
+                       int64_t expected_ns)
+{
+    int64_t last = atomic_exchange_explicit(&timing->last_call_ns, begin_ns,
+                                            memory_order_relaxed);
+    int64_t last_expected = atomic_exchange_explicit(&timing->last_expected_ns, expected_ns,
+                                                     memory_order_relaxed);
+
+    audio_histogram_add(&timing->call, end_ns - begin_ns);
+    if (last != 0) {
+        int64_t interval = begin_ns - last;
+
+        audio_histogram_add(&timing->interval, interval);
+        /* a steady client comes back once the audio it handed over has played */
+        audio_histogram_add(&timing->jitter,
+                            interval > last_expected ? interval - last_expected :
+                                                       last_expected - interval);
+    }
+}
+
+void audio_timing_start(struct audio_timing *timing, int64_t now_ns)
+{
+    int64_t none = 0;
+
+    atomic_compare_exchange_strong_explicit(&timing->start_ns, &none, now_ns,
+                                            memory_order_relaxed, memory_order_relaxed);
+}
+
+void audio_timing_first_sample(struct audio_timing *timing, int64_t now_ns)
+{
+    int64_t start;
+
+    if (atomic_load_explicit(&timing->start_ns, memory_order_relaxed) == 0)
+        return;
+
+    start = atomic_exchange_explicit(&timing->start_ns, 0, memory_order_relaxed);
+    if (start != 0)
+        audio_histogram_add(&timing->first_sample, now_ns - start);
+}
+
+void audio_cost_add(struct audio_cost *cost, int64_t cpu_ns, size_t frames)
+{
+    atomic_fetch_add_explicit(&cost->cpu_ns, cpu_ns > 0 ? cpu_ns : 0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&cost->frames, frames, memory_order_relaxed);
+}
+
+float audio_cost_per_frame(struct audio_cost *cost)
+{
+    unsigned long long frames = atomic_load_explicit(&cost->frames, memory_order_relaxed);
+
+    if (frames == 0)
+        return 0;
+
+    return (float)atomic_load_explicit(&cost->cpu_ns, memory_order_relaxed) / frames;
+}
+
+void audio_timing_reset(struct audio_timing *timing)
+{
+    audio_histogram_reset(&timing->call);
+    audio_histogram_reset(&timing->io);
+    audio_histogram_reset(&timing->start);
+    audio_histogram_reset(&timing->interval);
+    audio_histogram_reset(&timing->jitter);
+    audio_histogram_reset(&timing->first_sample);
+    atomic_store_explicit(&timing->cost.cpu_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&timing->cost.frames, 0, memory_order_relaxed);
+    atomic_store_explicit(&timing->last_call_ns, 0, memory_order_relaxed);
+}
+
+void audio_timing_dump(struct audio_timing *timing, int fd)
+{
+    audio_histogram_dump(&timing->call, fd, "call");
+    audio_histogram_dump(&timing->io, fd, "pcm_io");
+    audio_histogram_dump(&timing->start, fd, "start");
+    audio_histogram_dump(&timing->interval, fd, "interval");
+    audio_histogram_dump(&timing->jitter, fd, "jitter");
+    audio_histogram_dump(&timing->first_sample, fd, "first_sample");
+    dprintf(fd,"cpu frames:%llu,ns_per_frame:%.1f\n",
+            atomic_load_explicit(&timing->cost.frames, memory_order_relaxed),
+            audio_cost_per_frame(&timing->cost));
+}
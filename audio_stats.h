@@ -0,0 +1,59 @@
+#ifndef __AUDIO_STATS_H__
+#define __AUDIO_STATS_H__
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* log-linear buckets in microseconds: 0..3 us one bucket each, then 4 buckets
+ * per octave up to about 8.4 s. The last bucket also takes everything above */
+#define AUDIO_HISTOGRAM_SUB_BUCKETS 4
+#define AUDIO_HISTOGRAM_BUCKETS 88
+
+/* fixed bucket histogram, safe to update from any thread without a lock */
+struct audio_histogram {
+    atomic_uint buckets[AUDIO_HISTOGRAM_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong sum_us;
+    atomic_uint max_us;
+};
+
+/* CPU time spent per processed frame */
+struct audio_cost {
+    atomic_ullong cpu_ns;
+    atomic_ullong frames;
+};
+
+/* timings of one stream direction */
+struct audio_timing {
+    struct audio_histogram call;     /* out_write() / in_read() */
+    struct audio_histogram io;       /* pcm write / read, mmap included */
+    struct audio_histogram start;    /* pcm open and start */
+    struct audio_histogram interval; /* time between two calls */
+    struct audio_histogram jitter;   /* |interval - duration of the previous call's audio| */
+    struct audio_histogram first_sample; /* open or standby exit to first audio moved */
+    struct audio_cost cost;          /* thread CPU time of out_write() / in_read() */
+    atomic_llong last_call_ns;
+    atomic_llong last_expected_ns;
+    atomic_llong start_ns;           /* pending open or standby exit, 0 if none */
+};
+
+void audio_histogram_add(struct audio_histogram *hist, int64_t ns);
+void audio_histogram_reset(struct audio_histogram *hist);
+/* upper bound in us of the bucket holding the given percentile, 0 if empty */
+uint32_t audio_histogram_percentile(struct audio_histogram *hist, unsigned int percent);
+void audio_histogram_dump(struct audio_histogram *hist, int fd, const char *name);
+
+/* account one call that ran from begin_ns to end_ns and carried expected_ns of audio */
+void audio_timing_call(struct audio_timing *timing, int64_t begin_ns, int64_t end_ns,
+                       int64_t expected_ns);
+/* a stream was opened or left standby at now_ns. An earlier pending start wins */
+void audio_timing_start(struct audio_timing *timing, int64_t now_ns);
+/* audio went through the stream at now_ns, completes a pending start */
+void audio_timing_first_sample(struct audio_timing *timing, int64_t now_ns);
+void audio_cost_add(struct audio_cost *cost, int64_t cpu_ns, size_t frames);
+/* CPU nanoseconds per frame, 0 when nothing was processed */
+float audio_cost_per_frame(struct audio_cost *cost);
+void audio_timing_reset(struct audio_timing *timing);
+void audio_timing_dump(struct audio_timing *timing, int fd);
+
+#endif
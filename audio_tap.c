@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hal_tap"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "audio_tap.h"
+
+#ifndef AUDIO_TAP_DIR
+#define AUDIO_TAP_DIR "/data/misc/audio"
+#endif
+// ring per tap, about 1.3 s of 48 kHz stereo: the thread drains it every AUDIO_TAP_POLL_MS
+#define AUDIO_TAP_RING_SIZE (256 * 1024)
+#define AUDIO_TAP_POLL_MS 20
+// how often debug.audio.dumpdata is read again
+#define AUDIO_TAP_PROPERTY_MS 1000
+#define AUDIO_TAP_DEFAULT_FILE_SIZE (32 * 1024 * 1024)
+// files per tap, the oldest one is overwritten
+#define AUDIO_TAP_FILES 4
+#define AUDIO_TAP_NICE 10
+#define AUDIO_TAP_WAV_HEADER_SIZE 44
+
+static pthread_mutex_t tap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tap_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t tap_idle_cond = PTHREAD_COND_INITIALIZER; // a tap is no longer busy
+static pthread_t tap_thread;
+static unsigned int tap_users;
+static bool tap_exit;
+static bool tap_enabled;
+static size_t tap_file_size;
+static struct audio_tap *tap_list;
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* (re)write the wav header for the current file size */
+static void write_tap_header(struct audio_tap *tap)
+{
+    uint8_t header[AUDIO_TAP_WAV_HEADER_SIZE];
+    unsigned int block_align = tap->channels * sizeof(int16_t);
+
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, 36 + tap->file_bytes);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le32(header + 16, 16);
+    put_le16(header + 20, 1);
+    put_le16(header + 22, tap->channels);
+    put_le32(header + 24, tap->rate);
+    put_le32(header + 28, tap->rate * block_align);
+    put_le16(header + 32, block_align);
+    put_le16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    put_le32(header + 40, tap->file_bytes);
+
+    if (pwrite(tap->fd, header, sizeof(header), 0) != sizeof(header))
+        ALOGW("write_tap_header() %s: %s", tap->name, strerror(errno));
+}
+
+static void close_tap_file(struct audio_tap *tap)
+{
+    if (tap->fd < 0)
+        return;
+
+    write_tap_header(tap);
+    close(tap->fd);
+    tap->fd = -1;
+    tap->file_index = (tap->file_index + 1) % AUDIO_TAP_FILES;
+}
+
+static int open_tap_file(struct audio_tap *tap)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s_%u.wav", AUDIO_TAP_DIR, tap->name, tap->file_index);
+    tap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (tap->fd < 0) {
+        ALOGE("open_tap_file() %s: %s", path, strerror(errno));
+        return -errno;
+    }
+
+    tap->file_bytes = 0;
+    write_tap_header(tap);
+
+    return 0;
+}
+
+/* move everything queued in the tap to its file, rotating by file_size.
+ * the caller owns the tap, see acquire_tap() */
+static void drain_tap(struct audio_tap *tap, size_t file_size)
+{
+    uint8_t chunk[4096];
+    size_t bytes;
+    unsigned int dropped;
+
+    while ((bytes = audio_ring_read(&tap->ring, chunk, sizeof(chunk))) > 0) {
+        if (tap->fd < 0 && open_tap_file(tap) != 0) {
+            audio_ring_flush(&tap->ring);
+            return;
+        }
+
+        /* the header is written with pwrite(), the file offset stays at 0 */
+        if (pwrite(tap->fd, chunk, bytes, AUDIO_TAP_WAV_HEADER_SIZE + tap->file_bytes) !=
+                (ssize_t)bytes) {
+            ALOGE("drain_tap() %s: %s", tap->name, strerror(errno));
+            close_tap_file(tap);
+            audio_ring_flush(&tap->ring);
+            return;
+        }
+
+        tap->file_bytes += bytes;
+        if (tap->file_bytes >= file_size)
+            close_tap_file(tap);
+    }
+
+    if (tap->fd >= 0)
+        write_tap_header(tap);
+
+    dropped = atomic_load_explicit(&tap->dropped, memory_order_relaxed);
+    if (dropped != tap->dropped_reported) {
+        ALOGW("drain_tap() %s: %u bytes dropped", tap->name, dropped - tap->dropped_reported);
+        tap->dropped_reported = dropped;
+    }
+}
+
+/* the file of a tap is written outside tap_lock: whoever marks the tap busy
+ * owns it until release_tap(). must be called with tap_lock held */
+static void acquire_tap(struct audio_tap *tap)
+{
+    while (tap->busy)
+        pthread_cond_wait(&tap_idle_cond, &tap_lock);
+    tap->busy = true;
+}
+
+/* must be called with tap_lock held */
+static void release_tap(struct audio_tap *tap)
+{
+    tap->busy = false;
+    pthread_cond_broadcast(&tap_idle_cond);
+}
+
+static void read_tap_properties(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("debug.audio.dumpdata", value, "0");
+    tap_enabled = atoi(value) == 1;
+
+    property_get("debug.audio.dumpsize", value, "0");
+    tap_file_size = atoi(value) > 0 ? (size_t)atoi(value) : AUDIO_TAP_DEFAULT_FILE_SIZE;
+}
+
+static void *tap_thread_loop(void *context)
+{
+    unsigned int polls = 0;
+
+    /* on linux the nice value is per thread: this only lowers the tap thread */
+    setpriority(PRIO_PROCESS, 0, AUDIO_TAP_NICE);
+
+    pthread_mutex_lock(&tap_lock);
+    while (!tap_exit) {
+        struct audio_tap *tap;
+        struct timespec ts;
+
+        if (polls++ % (AUDIO_TAP_PROPERTY_MS / AUDIO_TAP_POLL_MS) == 0)
+            read_tap_properties();
+
+        /* a busy tap stays in the list, so tap->next is still valid once the
+         * lock is taken back. Taps busy in a close or a format change are
+         * drained there */
+        for (tap = tap_list; tap != NULL; tap = tap->next) {
+            bool enabled = tap_enabled;
+            size_t file_size = tap_file_size;
+
+            if (tap->busy)
+                continue;
+            if (enabled && tap->ring.data == NULL &&
+                    audio_ring_init(&tap->ring, AUDIO_TAP_RING_SIZE) != 0)
+                continue;
+
+            if (enabled)
+                atomic_store_explicit(&tap->active, true, memory_order_release);
+            else if (atomic_load_explicit(&tap->active, memory_order_relaxed))
+                atomic_store_explicit(&tap->active, false, memory_order_release);
+            else
+                continue;
+
+            acquire_tap(tap);
+            pthread_mutex_unlock(&tap_lock);
+            drain_tap(tap, file_size);
+            if (!enabled)
+                close_tap_file(tap);
+            pthread_mutex_lock(&tap_lock);
+            release_tap(tap);
+        }
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += AUDIO_TAP_POLL_MS * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&tap_cond, &tap_lock, &ts);
+    }
+    pthread_mutex_unlock(&tap_lock);
+
+    return NULL;
+}
+
+int audio_tap_start(void)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&tap_lock);
+    if (tap_users++ == 0) {
+        tap_exit = false;
+        read_tap_properties();
+        ret = -pthread_create(&tap_thread, NULL, tap_thread_loop, NULL);
+        if (ret != 0) {
+            ALOGE("audio_tap_start() cannot create tap thread: %d", ret);
+            tap_users--;
+        }
+    }
+    pthread_mutex_unlock(&tap_lock);
+
+    return ret;
+}
+
+void audio_tap_stop(void)
+{
+    pthread_mutex_lock(&tap_lock);
+    if (tap_users == 0 || --tap_users > 0) {
+        pthread_mutex_unlock(&tap_lock);
+        return;
+    }
+    tap_exit = true;
+    pthread_cond_signal(&tap_cond);
+    pthread_mutex_unlock(&tap_lock);
+
+    pthread_join(tap_thread, NULL);
+}
+
+struct audio_tap *audio_tap_open(const char *name, unsigned int rate, unsigned int channels)
+{
+    struct audio_tap *tap = calloc(1, sizeof(struct audio_tap));
+
+    if (tap == NULL)
+        return NULL;
+
+    strlcpy(tap->name, name, sizeof(tap->name));
+    tap->rate = rate;
+    tap->channels = channels;
+    tap->fd = -1;
+
+    pthread_mutex_lock(&tap_lock);
+    tap->next = tap_list;
+    tap_list = tap;
+    pthread_mutex_unlock(&tap_lock);
+
+    return tap;
+}
+
+/* the stream must not call audio_tap_write() anymore */
+void audio_tap_close(struct audio_tap *tap)
+{
+    struct audio_tap **prev;
+    size_t file_size;
+
+    if (tap == NULL)
+        return;
+
+    /* once out of the list the tap is ours for good */
+    pthread_mutex_lock(&tap_lock);
+    acquire_tap(tap);
+    for (prev = &tap_list; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == tap) {
+            *prev = tap->next;
+            break;
+        }
+    }
+    file_size = tap_file_size;
+    pthread_mutex_unlock(&tap_lock);
+
+    drain_tap(tap, file_size);
+    close_tap_file(tap);
+
+    audio_ring_release(&tap->ring);
+    free(tap);
+}
+
+/* the stream must not call audio_tap_write() meanwhile */
+void audio_tap_set_format(struct audio_tap *tap, unsigned int rate, unsigned int channels)
+{
+    size_t file_size;
+
+    if (tap == NULL)
+        return;
+
+    pthread_mutex_lock(&tap_lock);
+    acquire_tap(tap);
+    file_size = tap_file_size;
+    pthread_mutex_unlock(&tap_lock);
+
+    if (tap->rate != rate || tap->channels != channels) {
+        drain_tap(tap, file_size);
+        close_tap_file(tap);
+        tap->rate = rate;
+        tap->channels = channels;
+    }
+
+    pthread_mutex_lock(&tap_lock);
+    release_tap(tap);
+    pthread_mutex_unlock(&tap_lock);
+}
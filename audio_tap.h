@@ -0,0 +1,59 @@
+#ifndef __AUDIO_TAP_H__
+#define __AUDIO_TAP_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "audio_ring.h"
+
+/* where in a stream the audio is tapped */
+enum audio_tap_point {
+    AUDIO_TAP_PRE_RESAMPLE,     // 16 bit pcm at the client rate (out) or the pcm rate (in)
+    AUDIO_TAP_POST_RESAMPLE,    // 16 bit pcm at the pcm rate (out) or the client rate (in)
+    AUDIO_TAP_POINTS,
+};
+
+/* one tapped point of one stream. Only audio_tap_write() is called from the
+ * audio threads, the file belongs to whoever marked the tap busy: the tap
+ * thread, a close or a format change */
+struct audio_tap {
+    struct audio_ring ring;     // allocated by the tap thread when dumping is enabled
+    atomic_bool active;         // audio_tap_write() copies into ring
+    atomic_uint dropped;        // bytes lost on a full ring since the open
+    unsigned int dropped_reported;
+    char name[32];
+    unsigned int rate;
+    unsigned int channels;
+    int fd;
+    size_t file_bytes;
+    unsigned int file_index;
+    bool busy;                  // the file is written outside tap_lock
+    struct audio_tap *next;
+};
+
+/* start and stop the low priority thread writing the taps to wav files
+ * under AUDIO_TAP_DIR. Reference counted */
+int audio_tap_start(void);
+void audio_tap_stop(void);
+
+/* register a tap, dumped to <name>_<n>.wav when debug.audio.dumpdata=1 */
+struct audio_tap *audio_tap_open(const char *name, unsigned int rate, unsigned int channels);
+void audio_tap_close(struct audio_tap *tap);
+/* start a new file with another format */
+void audio_tap_set_format(struct audio_tap *tap, unsigned int rate, unsigned int channels);
+
+/* copy audio into the tap, never blocks. tap may be NULL */
+static inline void audio_tap_write(struct audio_tap *tap, const void *data, size_t bytes)
+{
+    size_t written;
+
+    if (tap == NULL || !atomic_load_explicit(&tap->active, memory_order_acquire))
+        return;
+
+    written = audio_ring_write(&tap->ring, data, bytes);
+    if (written < bytes)
+        atomic_fetch_add_explicit(&tap->dropped, bytes - written, memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* microbenchmark of the audio_conv.c kernels. The Makefile links it once
+ * against the default build of audio_conv.c and once against the scalar one
+ * (CONV_NO_NEON), so on a NEON target the two outputs compare both paths.
+ *
+ * One line per kernel and buffer size:
+ *   kernel:<name>,impl:<neon|scalar>,frames:<n>,ns_per_frame:<best of runs>,checksum:<output>
+ * The checksum of the output must match between the two builds */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio_conv.h"
+
+#if defined(__ARM_NEON__) && !defined(CONV_NO_NEON)
+#define BENCH_IMPL "neon"
+#else
+#define BENCH_IMPL "scalar"
+#endif
+
+/* the fast and the normal period */
+static const size_t bench_frames[] = { 256, 2048 };
+#define BENCH_MAX_FRAMES 2048
+#define BENCH_RUNS 7
+#define BENCH_RUN_NS 5000000LL
+
+struct bench_buffers {
+    int16_t s16[BENCH_MAX_FRAMES * 2];
+    int16_t mono[BENCH_MAX_FRAMES];
+    float f32[BENCH_MAX_FRAMES * 2];
+    int32_t s32[BENCH_MAX_FRAMES * 2];
+    uint8_t s24[BENCH_MAX_FRAMES * 2 * 3];
+    int16_t dst[BENCH_MAX_FRAMES * 2];
+    int16_t dst2[BENCH_MAX_FRAMES];
+    struct conv_gain gain;
+};
+
+struct bench_kernel {
+    const char *name;
+    void (*run)(struct bench_buffers *b, size_t frames);
+    /* bytes of b->dst, then of b->dst2, the kernel writes per frame */
+    size_t dst_bytes;
+    size_t dst2_bytes;
+};
+
+static void run_stereo_to_mono_left(struct bench_buffers *b, size_t frames)
+{
+    conv_stereo_to_mono(b->dst, b->s16, frames, CONV_DOWNMIX_LEFT);
+}
+
+static void run_stereo_to_mono_right(struct bench_buffers *b, size_t frames)
+{
+    conv_stereo_to_mono(b->dst, b->s16, frames, CONV_DOWNMIX_RIGHT);
+}
+
+static void run_stereo_to_mono_average(struct bench_buffers *b, size_t frames)
+{
+    conv_stereo_to_mono(b->dst, b->s16, frames, CONV_DOWNMIX_AVERAGE);
+}
+
+static void run_mono_to_stereo(struct bench_buffers *b, size_t frames)
+{
+    conv_mono_to_stereo(b->dst, b->mono, frames);
+}
+
+static void run_deinterleave_stereo(struct bench_buffers *b, size_t frames)
+{
+    conv_deinterleave_stereo(b->dst, b->dst2, b->s16, frames);
+}
+
+static void run_float_to_s16(struct bench_buffers *b, size_t frames)
+{
+    conv_float_to_s16(b->dst, b->f32, frames * 2);
+}
+
+static void run_s32_to_s16(struct bench_buffers *b, size_t frames)
+{
+    conv_s32_to_s16(b->dst, b->s32, frames * 2);
+}
+
+static void run_q8_23_to_s16(struct bench_buffers *b, size_t frames)
+{
+    conv_q8_23_to_s16(b->dst, b->s32, frames * 2);
+}
+
+static void run_s24_packed_to_s16(struct bench_buffers *b, size_t frames)
+{
+    conv_s24_packed_to_s16(b->dst, b->s24, frames * 2);
+}
+
+static void run_gain_s16(struct bench_buffers *b, size_t frames)
+{
+    conv_gain_init(&b->gain, 0.5f, 0.75f);
+    conv_gain_s16(b->dst, b->s16, frames, 2, &b->gain);
+}
+
+static void run_gain_ramp_s16(struct bench_buffers *b, size_t frames)
+{
+    conv_gain_init(&b->gain, 0, 0);
+    conv_gain_set_target(&b->gain, 1.0f, 1.0f, frames);
+    conv_gain_s16(b->dst, b->s16, frames, 2, &b->gain);
+}
+
+static void run_stereo_to_mono_gain(struct bench_buffers *b, size_t frames)
+{
+    conv_gain_init(&b->gain, 0.5f, 0.5f);
+    conv_stereo_to_mono_gain(b->dst, b->s16, frames, CONV_DOWNMIX_LEFT, &b->gain);
+}
+
+static void run_mix_s16(struct bench_buffers *b, size_t frames)
+{
+    /* mixing into a buffer already holding the same signal saturates often */
+    memcpy(b->dst, b->s16, frames * 2 * sizeof(int16_t));
+    conv_gain_init(&b->gain, 0.5f, 0.75f);
+    conv_mix_s16(b->dst, b->s16, frames, &b->gain);
+}
+
+static const struct bench_kernel kernels[] = {
+    { "stereo_to_mono_left", run_stereo_to_mono_left, 2, 0 },
+    { "stereo_to_mono_right", run_stereo_to_mono_right, 2, 0 },
+    { "stereo_to_mono_average", run_stereo_to_mono_average, 2, 0 },
+    { "mono_to_stereo", run_mono_to_stereo, 4, 0 },
+    { "deinterleave_stereo", run_deinterleave_stereo, 2, 2 },
+    { "float_to_s16", run_float_to_s16, 4, 0 },
+    { "s32_to_s16", run_s32_to_s16, 4, 0 },
+    { "q8_23_to_s16", run_q8_23_to_s16, 4, 0 },
+    { "s24_packed_to_s16", run_s24_packed_to_s16, 4, 0 },
+    { "gain_s16", run_gain_s16, 4, 0 },
+    { "gain_ramp_s16", run_gain_ramp_s16, 4, 0 },
+    { "stereo_to_mono_gain", run_stereo_to_mono_gain, 2, 0 },
+    { "mix_s16", run_mix_s16, 4, 0 },
+};
+
+static int64_t get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* deterministic input covering the full range, with out of range float and
+ * 32 bit samples so that the saturating paths run too */
+static void fill_buffers(struct bench_buffers *b)
+{
+    uint32_t seed = 0x12345678;
+    size_t i;
+
+    for (i = 0; i < BENCH_MAX_FRAMES * 2; i++) {
+        seed = seed * 1664525 + 1013904223;
+        b->s16[i] = (int16_t)(seed >> 16);
+        b->f32[i] = (int16_t)(seed >> 16) / 27000.0f;
+        b->s32[i] = (int32_t)seed;
+        b->s24[i * 3] = seed >> 8;
+        b->s24[i * 3 + 1] = seed >> 16;
+        b->s24[i * 3 + 2] = seed >> 24;
+    }
+    memcpy(b->mono, b->s16, sizeof(b->mono));
+}
+
+/* FNV-1a */
+static uint32_t hash(uint32_t h, const void *data, size_t bytes)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    while (bytes--)
+        h = (h ^ *p++) * 16777619u;
+
+    return h;
+}
+
+static uint32_t get_checksum(const struct bench_kernel *k, struct bench_buffers *b,
+                             size_t frames)
+{
+    uint32_t h = 2166136261u;
+
+    memset(b->dst, 0, sizeof(b->dst));
+    memset(b->dst2, 0, sizeof(b->dst2));
+    k->run(b, frames);
+    h = hash(h, b->dst, frames * k->dst_bytes);
+
+    return hash(h, b->dst2, frames * k->dst2_bytes);
+}
+
+static double measure(const struct bench_kernel *k, struct bench_buffers *b, size_t frames)
+{
+    double best = 0;
+    long reps = 1;
+    int64_t begin, elapsed;
+    long i;
+    int run;
+
+    /* enough repetitions for a run to last BENCH_RUN_NS */
+    for (;;) {
+        begin = get_time_ns();
+        for (i = 0; i < reps; i++)
+            k->run(b, frames);
+        elapsed = get_time_ns() - begin;
+        if (elapsed >= BENCH_RUN_NS)
+            break;
+        reps = elapsed > 0 ? reps * (BENCH_RUN_NS + BENCH_RUN_NS / 4) / elapsed + 1 : reps * 2;
+    }
+
+    for (run = 0; run < BENCH_RUNS; run++) {
+        double ns;
+
+        begin = get_time_ns();
+        for (i = 0; i < reps; i++)
+            k->run(b, frames);
+        ns = (double)(get_time_ns() - begin) / ((double)reps * frames);
+        if (run == 0 || ns < best)
+            best = ns;
+    }
+
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_buffers *b;
+    unsigned int i, j;
+
+    b = calloc(1, sizeof(struct bench_buffers));
+    if (b == NULL)
+        return 1;
+    fill_buffers(b);
+
+    for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (argc > 1 && strcmp(argv[1], kernels[i].name) != 0)
+            continue;
+
+        for (j = 0; j < sizeof(bench_frames) / sizeof(bench_frames[0]); j++) {
+            size_t frames = bench_frames[j];
+            uint32_t checksum = get_checksum(&kernels[i], b, frames);
+
+            printf("kernel:%s,impl:%s,frames:%zu,ns_per_frame:%.3f,checksum:%08x\n",
+                   kernels[i].name, BENCH_IMPL, frames, measure(&kernels[i], b, frames),
+                   checksum);
+        }
+    }
+    free(b);
+
+    return 0;
+}
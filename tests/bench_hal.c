@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* CPU cost of out_write() and in_read() and open to first sample time, for
+ * every output profile and a range of client rates, on fake_tinyalsa.c.
+ *
+ * The fake clock is free running: the pcms never make the caller sleep, so
+ * the thread CPU time of the calls is the cost of the HAL path, plus a copy
+ * and a peak scan in the fake pcm. Frames are client frames. Each case is run
+ * BENCH_RUNS times from a fresh stream and the best run is kept. One line per
+ * case:
+ *
+ *   bench:<out_write|in_read>,profile:<p>,rate:<client rate>,pcm_rate:<r>,
+ *   period:<frames>,mmap:<0|1>,frames:<n>,cpu_ns_per_frame:<measured>,
+ *   hal_cpu_ns_per_frame:<tiny4412_cpu_ns_per_frame of the stream>,
+ *   first_sample_us:<open to first call returned>,
+ *   first_sample_virtual_us:<the same on the pcm clock, the device waits>,xruns:<n>
+ *
+ * usage: bench_hal [seconds of audio per case, default 5] */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio_hal.h"
+#include "fake_tinyalsa.h"
+
+#define BENCH_RUNS 5
+
+/* what the HAL loader would dlsym() */
+extern struct audio_module HAL_MODULE_INFO_SYM;
+
+struct bench_profile {
+    const char *name;
+    unsigned int flags;
+};
+
+static const struct bench_profile out_profiles[] = {
+    { "fast", AUDIO_OUTPUT_FLAG_PRIMARY | AUDIO_OUTPUT_FLAG_FAST },
+    { "normal", AUDIO_OUTPUT_FLAG_PRIMARY },
+    { "deep", AUDIO_OUTPUT_FLAG_DEEP_BUFFER },
+};
+
+static const struct bench_profile in_profiles[] = {
+    { "fast", AUDIO_INPUT_FLAG_FAST },
+    { "normal", AUDIO_INPUT_FLAG_NONE },
+};
+
+static const uint32_t out_rates[] = { 48000, 44100, 16000 };
+static const uint32_t in_rates[] = { 48000, 44100, 16000, 8000 };
+
+struct bench_result {
+    uint32_t pcm_rate;
+    unsigned int period;
+    uint64_t frames;
+    double cpu_ns_per_frame;
+    double hal_cpu_ns_per_frame;
+    double first_sample_us;
+    double first_sample_virtual_us;
+    unsigned int xruns;
+    bool mmap;
+};
+
+static int64_t get_time_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double get_stream_cost(const struct audio_stream *stream)
+{
+    char *str = stream->get_parameters(stream, AUDIO_PARAMETER_TINY4412_CPU_NS_PER_FRAME);
+    char *value = str ? strchr(str, '=') : NULL;
+    double cost = value ? strtod(value + 1, NULL) : -1;
+
+    free(str);
+
+    return cost;
+}
+
+static void keep_best(struct bench_result *best, const struct bench_result *run, int n)
+{
+    if (n == 0) {
+        *best = *run;
+        return;
+    }
+
+    if (run->cpu_ns_per_frame < best->cpu_ns_per_frame) {
+        best->cpu_ns_per_frame = run->cpu_ns_per_frame;
+        best->hal_cpu_ns_per_frame = run->hal_cpu_ns_per_frame;
+    }
+    if (run->first_sample_us < best->first_sample_us)
+        best->first_sample_us = run->first_sample_us;
+    if (run->first_sample_virtual_us < best->first_sample_virtual_us)
+        best->first_sample_virtual_us = run->first_sample_virtual_us;
+    if (run->xruns > best->xruns)
+        best->xruns = run->xruns;
+}
+
+static int run_out_write(struct audio_hw_device *dev, const struct bench_profile *profile,
+                         uint32_t rate, double seconds, struct bench_result *result)
+{
+    struct audio_config config;
+    struct audio_stream_out *out = NULL;
+    struct fake_pcm_stats stats;
+    unsigned int device = (profile->flags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) ?
+            PCM_DEVICE_DEEP : PCM_DEVICE;
+    int64_t begin, virtual_begin, cpu_begin;
+    uint64_t frames = 0, target = (uint64_t)(seconds * rate);
+    size_t bytes, buffer_frames;
+    int16_t *buffer;
+    size_t i;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = rate;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+
+    begin = get_time_ns(CLOCK_MONOTONIC);
+    virtual_begin = fake_pcm_now_ns();
+    if (dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_SPEAKER, profile->flags, &config,
+                                &out, NULL) != 0)
+        return -1;
+
+    bytes = out->common.get_buffer_size(&out->common);
+    buffer_frames = bytes / audio_stream_out_frame_size(out);
+    buffer = malloc(bytes);
+    if (buffer == NULL) {
+        dev->close_output_stream(dev, out);
+        return -1;
+    }
+    for (i = 0; i < buffer_frames * 2; i++)
+        buffer[i] = (int16_t)(((i / 2) * 1000) & 0x3fff) - 0x2000;
+
+    out->write(out, buffer, bytes);
+    result->first_sample_us = (get_time_ns(CLOCK_MONOTONIC) - begin) / 1000.0;
+    result->first_sample_virtual_us = (fake_pcm_now_ns() - virtual_begin) / 1000.0;
+
+    /* the first call opens the pcm, leave it out */
+    cpu_begin = get_time_ns(CLOCK_THREAD_CPUTIME_ID);
+    while (frames < target) {
+        out->write(out, buffer, bytes);
+        frames += buffer_frames;
+    }
+    result->cpu_ns_per_frame =
+            (double)(get_time_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_begin) / frames;
+    result->hal_cpu_ns_per_frame = get_stream_cost(&out->common);
+    result->frames = frames;
+
+    fake_pcm_get_stats(PCM_CARD, device, PCM_OUT, &stats);
+    result->pcm_rate = stats.rate;
+    result->period = stats.period_size;
+    result->xruns = stats.xruns;
+    result->mmap = stats.mmap;
+
+    dev->close_output_stream(dev, out);
+    free(buffer);
+
+    return 0;
+}
+
+static int run_in_read(struct audio_hw_device *dev, const struct bench_profile *profile,
+                       uint32_t rate, double seconds, struct bench_result *result)
+{
+    struct audio_config config;
+    struct audio_stream_in *in = NULL;
+    struct fake_pcm_stats stats;
+    int64_t begin, virtual_begin, cpu_begin;
+    uint64_t frames = 0, target = (uint64_t)(seconds * rate);
+    size_t bytes, buffer_frames;
+    int16_t *buffer;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = rate;
+    config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+
+    begin = get_time_ns(CLOCK_MONOTONIC);
+    virtual_begin = fake_pcm_now_ns();
+    if (dev->open_input_stream(dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in,
+                               profile->flags, NULL, AUDIO_SOURCE_MIC) != 0)
+        return -1;
+
+    bytes = in->common.get_buffer_size(&in->common);
+    buffer_frames = bytes / sizeof(int16_t);
+    buffer = malloc(bytes);
+    if (buffer == NULL) {
+        dev->close_input_stream(dev, in);
+        return -1;
+    }
+
+    in->read(in, buffer, bytes);
+    result->first_sample_us = (get_time_ns(CLOCK_MONOTONIC) - begin) / 1000.0;
+    result->first_sample_virtual_us = (fake_pcm_now_ns() - virtual_begin) / 1000.0;
+
+    cpu_begin = get_time_ns(CLOCK_THREAD_CPUTIME_ID);
+    while (frames < target) {
+        in->read(in, buffer, bytes);
+        frames += buffer_frames;
+    }
+    result->cpu_ns_per_frame =
+            (double)(get_time_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_begin) / frames;
+    result->hal_cpu_ns_per_frame = get_stream_cost(&in->common);
+    result->frames = frames;
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_IN, &stats);
+    result->pcm_rate = stats.rate;
+    result->period = stats.period_size;
+    result->xruns = stats.xruns;
+    result->mmap = stats.mmap;
+
+    dev->close_input_stream(dev, in);
+    free(buffer);
+
+    return 0;
+}
+
+static void print_result(const char *bench, const char *profile, uint32_t rate,
+                         const struct bench_result *r)
+{
+    printf("bench:%s,profile:%s,rate:%u,pcm_rate:%u,period:%u,mmap:%d,frames:%llu,"
+           "cpu_ns_per_frame:%.2f,hal_cpu_ns_per_frame:%.2f,first_sample_us:%.1f,"
+           "first_sample_virtual_us:%.1f,xruns:%u\n",
+           bench, profile, rate, r->pcm_rate, r->period, r->mmap, (unsigned long long)r->frames,
+           r->cpu_ns_per_frame, r->hal_cpu_ns_per_frame, r->first_sample_us,
+           r->first_sample_virtual_us, r->xruns);
+}
+
+int main(int argc, char **argv)
+{
+    const struct hw_module_t *module = &HAL_MODULE_INFO_SYM.common;
+    struct hw_device_t *device = NULL;
+    struct audio_hw_device *dev;
+    double seconds = argc > 1 ? atof(argv[1]) : 5;
+    unsigned int i, j;
+    int resampled, n;
+    int ret = 0;
+
+    if (seconds <= 0) {
+        fprintf(stderr, "usage: %s [seconds of audio per case]\n", argv[0]);
+        return 1;
+    }
+
+    /* the free running clock only suits streams without a thread of their own */
+    property_set("audio.tiny4412.out_async", "0");
+    property_set("audio.tiny4412.in_async", "0");
+    property_set("audio.tiny4412.mixer", "0");
+    fake_pcm_reset();
+    fake_pcm_set_speed(0);
+
+    if (module->methods->open(module, AUDIO_HARDWARE_INTERFACE, &device) != 0) {
+        fprintf(stderr, "cannot open the audio device\n");
+        return 1;
+    }
+    dev = (struct audio_hw_device *)device;
+
+    /* at the client rate when the codec takes it, then on a codec locked to
+     * 48 kHz so that the HAL resamples */
+    for (resampled = 0; resampled < 2; resampled++) {
+        fake_pcm_set_caps(PCM_CARD, resampled ? AUDIO_HW_OUT_SAMPLERATE : 8000,
+                          AUDIO_HW_OUT_SAMPLERATE, 2);
+        for (i = 0; i < sizeof(out_profiles) / sizeof(out_profiles[0]); i++) {
+            for (j = 0; j < sizeof(out_rates) / sizeof(out_rates[0]); j++) {
+                struct bench_result best, run;
+
+                if (resampled && out_rates[j] == AUDIO_HW_OUT_SAMPLERATE)
+                    continue;
+
+                for (n = 0; n < BENCH_RUNS; n++) {
+                    if (run_out_write(dev, &out_profiles[i], out_rates[j], seconds, &run) != 0)
+                        break;
+                    keep_best(&best, &run, n);
+                }
+                if (n < BENCH_RUNS) {
+                    fprintf(stderr, "out_write %s %u failed\n", out_profiles[i].name,
+                            out_rates[j]);
+                    ret = 1;
+                    continue;
+                }
+                print_result("out_write", out_profiles[i].name, out_rates[j], &best);
+            }
+        }
+    }
+
+    fake_pcm_set_caps(PCM_CARD, 8000, AUDIO_HW_OUT_SAMPLERATE, 2);
+    for (i = 0; i < sizeof(in_profiles) / sizeof(in_profiles[0]); i++) {
+        for (j = 0; j < sizeof(in_rates) / sizeof(in_rates[0]); j++) {
+            struct bench_result best, run;
+
+            for (n = 0; n < BENCH_RUNS; n++) {
+                if (run_in_read(dev, &in_profiles[i], in_rates[j], seconds, &run) != 0)
+                    break;
+                keep_best(&best, &run, n);
+            }
+            if (n < BENCH_RUNS) {
+                fprintf(stderr, "in_read %s %u failed\n", in_profiles[i].name, in_rates[j]);
+                ret = 1;
+                continue;
+            }
+            print_result("in_read", in_profiles[i].name, in_rates[j], &best);
+        }
+    }
+
+    device->close(device);
+
+    return ret;
+}
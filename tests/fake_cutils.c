@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* liblog, system properties and str_parms for the host build */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <cutils/str_parms.h>
+
+#define MAX_PROPERTIES 32
+#define MAX_PARMS 32
+
+struct property {
+    char key[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+};
+
+struct str_parm {
+    char *key;
+    char *value;
+};
+
+struct str_parms {
+    struct str_parm parms[MAX_PARMS];
+    unsigned int count;
+};
+
+static pthread_mutex_t property_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct property properties[MAX_PROPERTIES];
+static unsigned int property_count;
+
+/* TINY4412_TEST_LOG=e|w|i|d|v prints down to that level. The tests go
+ * through error paths on purpose, so by default nothing is printed */
+static int get_log_threshold(void)
+{
+    static int threshold;
+    const char *env;
+
+    if (threshold)
+        return threshold;
+
+    env = getenv("TINY4412_TEST_LOG");
+    if (env == NULL || env[0] == '\0')
+        threshold = ANDROID_LOG_ERROR + 1;
+    else if (env[0] == 'v')
+        threshold = ANDROID_LOG_VERBOSE;
+    else if (env[0] == 'd')
+        threshold = ANDROID_LOG_DEBUG;
+    else if (env[0] == 'i')
+        threshold = ANDROID_LOG_INFO;
+    else if (env[0] == 'w')
+        threshold = ANDROID_LOG_WARN;
+    else
+        threshold = ANDROID_LOG_ERROR;
+
+    return threshold;
+}
+
+int __android_log_print(int prio, const char *tag, const char *fmt, ...)
+{
+    static const char letters[] = "??VDIWE";
+    va_list ap;
+
+    if (prio < get_log_threshold())
+        return 0;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "%c/%s: ", letters[prio], tag ? tag : "");
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+
+    return 0;
+}
+
+int property_get(const char *key, char *value, const char *default_value)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&property_lock);
+    for (i = 0; i < property_count; i++) {
+        if (strcmp(properties[i].key, key) == 0) {
+            strlcpy(value, properties[i].value, PROPERTY_VALUE_MAX);
+            pthread_mutex_unlock(&property_lock);
+            return strlen(value);
+        }
+    }
+    pthread_mutex_unlock(&property_lock);
+
+    if (default_value == NULL)
+        default_value = "";
+    strlcpy(value, default_value, PROPERTY_VALUE_MAX);
+
+    return strlen(value);
+}
+
+/* a NULL or empty value removes the property */
+int property_set(const char *key, const char *value)
+{
+    unsigned int i;
+
+    if (strlen(key) >= PROPERTY_KEY_MAX ||
+            (value != NULL && strlen(value) >= PROPERTY_VALUE_MAX))
+        return -EINVAL;
+
+    pthread_mutex_lock(&property_lock);
+    for (i = 0; i < property_count; i++) {
+        if (strcmp(properties[i].key, key) == 0)
+            break;
+    }
+
+    if (value == NULL || value[0] == '\0') {
+        if (i < property_count)
+            properties[i] = properties[--property_count];
+        pthread_mutex_unlock(&property_lock);
+        return 0;
+    }
+
+    if (i == property_count) {
+        if (property_count == MAX_PROPERTIES) {
+            pthread_mutex_unlock(&property_lock);
+            return -ENOMEM;
+        }
+        strlcpy(properties[property_count++].key, key, PROPERTY_KEY_MAX);
+    }
+    strlcpy(properties[i].value, value, PROPERTY_VALUE_MAX);
+    pthread_mutex_unlock(&property_lock);
+
+    return 0;
+}
+
+static struct str_parm *find_parm(struct str_parms *str_parms, const char *key)
+{
+    unsigned int i;
+
+    for (i = 0; i < str_parms->count; i++) {
+        if (strcmp(str_parms->parms[i].key, key) == 0)
+            return &str_parms->parms[i];
+    }
+
+    return NULL;
+}
+
+struct str_parms *str_parms_create(void)
+{
+    return calloc(1, sizeof(struct str_parms));
+}
+
+/* "key=value;key=value", a key without '=' gets an empty value */
+struct str_parms *str_parms_create_str(const char *_string)
+{
+    struct str_parms *str_parms;
+    char *str, *kvpair, *save = NULL;
+
+    str_parms = str_parms_create();
+    if (str_parms == NULL)
+        return NULL;
+
+    str = strdup(_string);
+    if (str == NULL)
+        return str_parms;
+
+    for (kvpair = strtok_r(str, ";", &save); kvpair != NULL;
+         kvpair = strtok_r(NULL, ";", &save)) {
+        char *value = strchr(kvpair, '=');
+
+        if (value != NULL)
+            *value++ = '\0';
+        if (kvpair[0] != '\0')
+            str_parms_add_str(str_parms, kvpair, value ? value : "");
+    }
+    free(str);
+
+    return str_parms;
+}
+
+void str_parms_destroy(struct str_parms *str_parms)
+{
+    unsigned int i;
+
+    for (i = 0; i < str_parms->count; i++) {
+        free(str_parms->parms[i].key);
+        free(str_parms->parms[i].value);
+    }
+    free(str_parms);
+}
+
+void str_parms_del(struct str_parms *str_parms, const char *key)
+{
+    struct str_parm *parm = find_parm(str_parms, key);
+
+    if (parm == NULL)
+        return;
+
+    free(parm->key);
+    free(parm->value);
+    *parm = str_parms->parms[--str_parms->count];
+}
+
+int str_parms_add_str(struct str_parms *str_parms, const char *key, const char *value)
+{
+    struct str_parm *parm = find_parm(str_parms, key);
+    char *copy;
+
+    copy = strdup(value);
+    if (copy == NULL)
+        return -ENOMEM;
+
+    if (parm != NULL) {
+        free(parm->value);
+        parm->value = copy;
+        return 0;
+    }
+
+    if (str_parms->count == MAX_PARMS) {
+        free(copy);
+        return -ENOMEM;
+    }
+
+    parm = &str_parms->parms[str_parms->count];
+    parm->key = strdup(key);
+    if (parm->key == NULL) {
+        free(copy);
+        return -ENOMEM;
+    }
+    parm->value = copy;
+    str_parms->count++;
+
+    return 0;
+}
+
+int str_parms_add_int(struct str_parms *str_parms, const char *key, int value)
+{
+    char str[16];
+
+    snprintf(str, sizeof(str), "%d", value);
+
+    return str_parms_add_str(str_parms, key, str);
+}
+
+int str_parms_add_float(struct str_parms *str_parms, const char *key, float value)
+{
+    char str[32];
+
+    snprintf(str, sizeof(str), "%.*g", 7, value);
+
+    return str_parms_add_str(str_parms, key, str);
+}
+
+bool str_parms_has_key(struct str_parms *str_parms, const char *key)
+{
+    return find_parm(str_parms, key) != NULL;
+}
+
+int str_parms_get_str(struct str_parms *str_parms, const char *key, char *out_val, int len)
+{
+    struct str_parm *parm = find_parm(str_parms, key);
+
+    if (parm == NULL)
+        return -ENOENT;
+
+    return strlcpy(out_val, parm->value, len);
+}
+
+int str_parms_get_int(struct str_parms *str_parms, const char *key, int *out_val)
+{
+    struct str_parm *parm = find_parm(str_parms, key);
+    char *end;
+
+    if (parm == NULL)
+        return -ENOENT;
+
+    *out_val = (int)strtol(parm->value, &end, 0);
+    if (parm->value[0] == '\0' || *end != '\0')
+        return -EINVAL;
+
+    return 0;
+}
+
+int str_parms_get_float(struct str_parms *str_parms, const char *key, float *out_val)
+{
+    struct str_parm *parm = find_parm(str_parms, key);
+    char *end;
+
+    if (parm == NULL)
+        return -ENOENT;
+
+    *out_val = strtof(parm->value, &end);
+    if (parm->value[0] == '\0' || *end != '\0')
+        return -EINVAL;
+
+    return 0;
+}
+
+char *str_parms_to_str(struct str_parms *str_parms)
+{
+    size_t len = 1;
+    unsigned int i;
+    char *str;
+
+    for (i = 0; i < str_parms->count; i++)
+        len += strlen(str_parms->parms[i].key) + strlen(str_parms->parms[i].value) + 2;
+
+    str = malloc(len);
+    if (str == NULL)
+        return NULL;
+
+    str[0] = '\0';
+    for (i = 0; i < str_parms->count; i++) {
+        if (i)
+            strlcat(str, ";", len);
+        strlcat(str, str_parms->parms[i].key, len);
+        strlcat(str, "=", len);
+        strlcat(str, str_parms->parms[i].value, len);
+    }
+
+    return str;
+}
+
+#ifdef BIONIC_COMPAT_STRLCPY
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+
+    return len;
+}
+
+size_t strlcat(char *dst, const char *src, size_t size)
+{
+    size_t len = strnlen(dst, size);
+
+    if (len == size)
+        return size + strlen(src);
+
+    return len + strlcpy(dst + len, src, size - len);
+}
+#endif
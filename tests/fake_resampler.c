@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* libaudioutils create_resampler() for the host build. A linear interpolator
+ * instead of speex: it keeps the interface contract, the rate ratio and the
+ * frame accounting the HAL relies on, not the audio quality */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <audio_utils/resampler.h>
+
+#define FRAC_BITS 32
+#define FRAC_ONE (1ULL << FRAC_BITS)
+/* frames asked from the provider at once */
+#define PROVIDER_CHUNK_FRAMES 256
+
+struct linear_resampler {
+    struct resampler_itfe itfe;
+    struct resampler_buffer_provider *provider;
+    uint32_t in_rate;
+    uint32_t channels;
+    uint64_t step;              /* input frames per output frame, FRAC_BITS fraction */
+    uint64_t frac;              /* position between prev and cur */
+    int16_t prev[2];
+    int16_t cur[2];
+};
+
+struct linear_input {
+    const int16_t *data;
+    size_t frames;
+    size_t used;
+    struct resampler_buffer buffer;     /* held from the provider */
+};
+
+static void linear_reset(struct resampler_itfe *resampler)
+{
+    struct linear_resampler *lr = (struct linear_resampler *)resampler;
+
+    memset(lr->prev, 0, sizeof(lr->prev));
+    memset(lr->cur, 0, sizeof(lr->cur));
+    lr->frac = 0;
+}
+
+static void release_input(struct linear_resampler *lr, struct linear_input *in)
+{
+    if (lr->provider == NULL || in->buffer.raw == NULL)
+        return;
+
+    in->buffer.frame_count = in->used;
+    lr->provider->release_buffer(lr->provider, &in->buffer);
+    in->buffer.raw = NULL;
+    in->data = NULL;
+    in->frames = 0;
+    in->used = 0;
+}
+
+static int next_frame(struct linear_resampler *lr, struct linear_input *in)
+{
+    uint32_t c;
+
+    if (in->used == in->frames) {
+        if (lr->provider == NULL)
+            return 0;
+
+        release_input(lr, in);
+        in->buffer.frame_count = PROVIDER_CHUNK_FRAMES;
+        lr->provider->get_next_buffer(lr->provider, &in->buffer);
+        if (in->buffer.raw == NULL || in->buffer.frame_count == 0) {
+            in->buffer.raw = NULL;
+            return 0;
+        }
+        in->data = in->buffer.i16;
+        in->frames = in->buffer.frame_count;
+    }
+
+    for (c = 0; c < lr->channels; c++) {
+        lr->prev[c] = lr->cur[c];
+        lr->cur[c] = in->data[in->used * lr->channels + c];
+    }
+    in->used++;
+
+    return 1;
+}
+
+static size_t linear_run(struct linear_resampler *lr, struct linear_input *in,
+                         int16_t *out, size_t out_frames)
+{
+    size_t n = 0;
+    uint32_t c;
+
+    while (n < out_frames) {
+        int32_t w;
+
+        while (lr->frac >= FRAC_ONE) {
+            if (!next_frame(lr, in))
+                return n;
+            lr->frac -= FRAC_ONE;
+        }
+
+        w = (int32_t)(lr->frac >> (FRAC_BITS - 15));
+        for (c = 0; c < lr->channels; c++)
+            out[n * lr->channels + c] =
+                    lr->prev[c] + (((lr->cur[c] - lr->prev[c]) * w) >> 15);
+        n++;
+        lr->frac += lr->step;
+    }
+
+    return n;
+}
+
+static int linear_resample_from_provider(struct resampler_itfe *resampler,
+                                         int16_t *out, size_t *outFrameCount)
+{
+    struct linear_resampler *lr = (struct linear_resampler *)resampler;
+    struct linear_input in;
+
+    if (lr == NULL || out == NULL || outFrameCount == NULL)
+        return -EINVAL;
+    if (lr->provider == NULL) {
+        *outFrameCount = 0;
+        return -ENOSYS;
+    }
+
+    memset(&in, 0, sizeof(in));
+    *outFrameCount = linear_run(lr, &in, out, *outFrameCount);
+    release_input(lr, &in);
+
+    return 0;
+}
+
+static int linear_resample_from_input(struct resampler_itfe *resampler,
+                                      int16_t *in, size_t *inFrameCount,
+                                      int16_t *out, size_t *outFrameCount)
+{
+    struct linear_resampler *lr = (struct linear_resampler *)resampler;
+    struct resampler_buffer_provider *provider;
+    struct linear_input input;
+
+    if (lr == NULL || in == NULL || inFrameCount == NULL ||
+            out == NULL || outFrameCount == NULL)
+        return -EINVAL;
+
+    memset(&input, 0, sizeof(input));
+    input.data = in;
+    input.frames = *inFrameCount;
+
+    provider = lr->provider;
+    lr->provider = NULL;
+    *outFrameCount = linear_run(lr, &input, out, *outFrameCount);
+    lr->provider = provider;
+    *inFrameCount = input.used;
+
+    return 0;
+}
+
+static int32_t linear_delay_ns(struct resampler_itfe *resampler)
+{
+    struct linear_resampler *lr = (struct linear_resampler *)resampler;
+
+    /* one input frame is held back */
+    return (int32_t)(1000000000LL / lr->in_rate);
+}
+
+int create_resampler(uint32_t inSampleRate, uint32_t outSampleRate, uint32_t channelCount,
+                     uint32_t quality, struct resampler_buffer_provider *provider,
+                     struct resampler_itfe **resampler)
+{
+    struct linear_resampler *lr;
+
+    if (resampler == NULL)
+        return -EINVAL;
+
+    *resampler = NULL;
+
+    if (inSampleRate == 0 || outSampleRate == 0 || channelCount < 1 || channelCount > 2 ||
+            quality > RESAMPLER_QUALITY_MAX)
+        return -EINVAL;
+
+    lr = (struct linear_resampler *)calloc(1, sizeof(struct linear_resampler));
+    if (lr == NULL)
+        return -ENOMEM;
+
+    lr->itfe.reset = linear_reset;
+    lr->itfe.resample_from_provider = linear_resample_from_provider;
+    lr->itfe.resample_from_input = linear_resample_from_input;
+    lr->itfe.delay_ns = linear_delay_ns;
+    lr->provider = provider;
+    lr->in_rate = inSampleRate;
+    lr->channels = channelCount;
+    lr->step = ((uint64_t)inSampleRate << FRAC_BITS) / outSampleRate;
+    linear_reset(&lr->itfe);
+
+    *resampler = &lr->itfe;
+
+    return 0;
+}
+
+void release_resampler(struct resampler_itfe *resampler)
+{
+    free(resampler);
+}
@@ -0,0 +1,1003 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* tinyalsa without a sound card. Each pcm models the kernel ring buffer: the
+ * application pointer moves with writes, reads and mmap commits, the hardware
+ * pointer with the virtual clock once the pcm runs. Xruns happen as they do in
+ * ALSA with the default stop threshold and surface as -EPIPE, except for mmap
+ * pcms whose avail simply grows past the buffer size. See fake_tinyalsa.h */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#include "fake_tinyalsa.h"
+
+enum fake_pcm_state {
+    FAKE_PCM_SETUP,
+    FAKE_PCM_PREPARED,
+    FAKE_PCM_RUNNING,
+    FAKE_PCM_XRUN,
+};
+
+struct fake_caps {
+    unsigned int min_rate;
+    unsigned int max_rate;
+    unsigned int max_channels;
+};
+
+/* left channel of the last frames played on a device */
+struct fake_history {
+    int16_t samples[FAKE_PCM_HISTORY];
+    uint64_t frames;
+};
+
+struct pcm {
+    struct fake_pcm_stats *stats;
+    struct fake_history *history;   /* NULL for capture */
+    unsigned int flags;
+    struct pcm_config config;
+    unsigned int buffer_size;   /* frames */
+    unsigned int frame_bytes;
+    int16_t *data;
+    bool ready;
+    char error[128];
+
+    enum fake_pcm_state state;
+    uint64_t hw;                /* frames moved by the hardware */
+    uint64_t appl;              /* frames moved by the application */
+    int64_t start_ns;           /* virtual time of pcm_start() */
+    uint64_t start_hw;
+    int16_t *sine;              /* whole cycles of the capture signal */
+    unsigned int sine_frames;
+    unsigned int phase;         /* next frame of sine, keeps the signal continuous */
+};
+
+struct pcm_params {
+    struct fake_caps caps;
+};
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fake_pcm_stats fake_stats[FAKE_PCM_CARDS][FAKE_PCM_DEVICES][2];
+static struct fake_caps fake_caps[FAKE_PCM_CARDS];
+static struct fake_history fake_history[FAKE_PCM_CARDS][FAKE_PCM_DEVICES];
+static bool fake_mmap = true;
+
+/* controls of the mixer of card 0 */
+struct mixer_ctl {
+    char name[44];
+    unsigned int num_values;
+    int value[FAKE_MIXER_VALUES];
+    const char *const *enums;
+    unsigned int num_enums;
+    unsigned int writes;        /* mixer_ctl_set_value() calls */
+    bool fail;
+};
+
+struct mixer {
+    int unused;
+};
+
+static struct mixer fake_mixer;
+static struct mixer_ctl fake_ctls[FAKE_MIXER_CTLS];
+static unsigned int fake_num_ctls;
+
+/* virtual time is clock_virtual_ns + (real - clock_real_ns) * clock_speed */
+static unsigned int clock_speed = 1;
+static int64_t clock_real_ns;
+static int64_t clock_virtual_ns;
+
+static int64_t get_real_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* must be called with fake_lock held */
+static int64_t get_virtual_ns(void)
+{
+    if (clock_speed == 0)
+        return clock_virtual_ns;
+
+    return clock_virtual_ns + (get_real_ns() - clock_real_ns) * clock_speed;
+}
+
+/* must be called with fake_lock held */
+static void set_speed(unsigned int speed)
+{
+    clock_virtual_ns = get_virtual_ns();
+    clock_real_ns = get_real_ns();
+    clock_speed = speed;
+}
+
+/* block until the virtual clock reaches t, or jump to it in free run.
+ * must be called with fake_lock held, it is released while sleeping */
+static void wait_until(int64_t t)
+{
+    int64_t now = get_virtual_ns();
+
+    if (clock_speed == 0) {
+        if (t > now)
+            clock_virtual_ns = t;
+        return;
+    }
+
+    while (now < t) {
+        int64_t ns = (t - now + clock_speed - 1) / clock_speed;
+        struct timespec ts = {
+            .tv_sec = ns / 1000000000LL,
+            .tv_nsec = ns % 1000000000LL,
+        };
+
+        pthread_mutex_unlock(&fake_lock);
+        nanosleep(&ts, NULL);
+        pthread_mutex_lock(&fake_lock);
+        now = get_virtual_ns();
+    }
+}
+
+static bool is_capture(struct pcm *pcm)
+{
+    return (pcm->flags & PCM_IN) != 0;
+}
+
+static bool is_mmap(struct pcm *pcm)
+{
+    return (pcm->flags & PCM_MMAP) != 0;
+}
+
+/* virtual time at which the hardware pointer reaches hw. The pcm must run */
+static int64_t get_hw_time(struct pcm *pcm, uint64_t hw)
+{
+    uint64_t frames = hw > pcm->start_hw ? hw - pcm->start_hw : 0;
+
+    return pcm->start_ns + (int64_t)((frames * 1000000000ULL + pcm->config.rate - 1) /
+                                     pcm->config.rate);
+}
+
+/* move the hardware pointer to the current virtual time.
+ * must be called with fake_lock held */
+static void sync_pcm(struct pcm *pcm)
+{
+    uint64_t hw;
+
+    if (pcm->state != FAKE_PCM_RUNNING)
+        return;
+
+    hw = pcm->start_hw +
+         (uint64_t)(get_virtual_ns() - pcm->start_ns) * pcm->config.rate / 1000000000ULL;
+    if (hw <= pcm->hw)
+        return;
+
+    if (!is_capture(pcm) && hw >= pcm->appl && !is_mmap(pcm)) {
+        /* drained: stop threshold reached */
+        hw = pcm->appl;
+        pcm->state = FAKE_PCM_XRUN;
+        pcm->stats->xruns++;
+    } else if (is_capture(pcm) && hw > pcm->appl + pcm->buffer_size && !is_mmap(pcm)) {
+        /* the application did not read in time */
+        hw = pcm->appl + pcm->buffer_size;
+        pcm->state = FAKE_PCM_XRUN;
+        pcm->stats->xruns++;
+    }
+
+    pcm->stats->frames += hw - pcm->hw;
+    pcm->hw = hw;
+}
+
+/* frames the application may move now. For mmap pcms this is more than the
+ * buffer size once the hardware overtook the application, as with ALSA */
+static int64_t get_avail(struct pcm *pcm)
+{
+    if (is_capture(pcm))
+        return (int64_t)(pcm->hw - pcm->appl);
+
+    return (int64_t)(pcm->hw + pcm->buffer_size) - (int64_t)pcm->appl;
+}
+
+static void start_pcm(struct pcm *pcm)
+{
+    pcm->state = FAKE_PCM_RUNNING;
+    pcm->start_ns = get_virtual_ns();
+    pcm->start_hw = pcm->hw;
+    pcm->stats->starts++;
+    pcm->stats->running = true;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while (b) {
+        unsigned int t = a % b;
+
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* the capture signal is precomputed over the shortest run of whole cycles,
+ * so that generating it costs no more than a copy */
+static int init_capture(struct pcm *pcm)
+{
+    unsigned int i, c;
+
+    pcm->sine_frames = pcm->config.rate / gcd(pcm->config.rate, FAKE_PCM_SINE_HZ);
+    pcm->sine = malloc(pcm->sine_frames * pcm->frame_bytes);
+    if (pcm->sine == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < pcm->sine_frames; i++) {
+        double s = sin(2 * M_PI * FAKE_PCM_SINE_HZ * (double)i / pcm->config.rate);
+
+        for (c = 0; c < pcm->config.channels; c++)
+            pcm->sine[i * pcm->config.channels + c] =
+                    (int16_t)lrint(s * FAKE_PCM_LEFT_AMPLITUDE / (c == 0 ? 1 : 2));
+    }
+
+    return 0;
+}
+
+static void fill_capture(struct pcm *pcm, int16_t *dst, unsigned int frames)
+{
+    while (frames > 0) {
+        unsigned int n = pcm->sine_frames - pcm->phase;
+
+        if (n > frames)
+            n = frames;
+        memcpy(dst, pcm->sine + pcm->phase * pcm->config.channels, n * pcm->frame_bytes);
+        dst += n * pcm->config.channels;
+        frames -= n;
+        pcm->phase = (pcm->phase + n) % pcm->sine_frames;
+    }
+}
+
+static void account_playback(struct pcm *pcm, const int16_t *src, unsigned int frames)
+{
+    unsigned int i;
+
+    for (i = 0; i < frames * pcm->config.channels; i++) {
+        int v = abs(src[i]);
+
+        if (v > pcm->stats->peak)
+            pcm->stats->peak = v;
+    }
+    for (i = 0; i < frames; i++) {
+        pcm->history->samples[pcm->history->frames % FAKE_PCM_HISTORY] =
+                src[i * pcm->config.channels];
+        pcm->history->frames++;
+    }
+    pcm->stats->appl_frames += frames;
+}
+
+static struct fake_pcm_stats *get_stats(unsigned int card, unsigned int device,
+                                        unsigned int flags)
+{
+    if (card >= FAKE_PCM_CARDS || device >= FAKE_PCM_DEVICES)
+        return NULL;
+
+    return &fake_stats[card][device][(flags & PCM_IN) ? 1 : 0];
+}
+
+/* must be called with fake_lock held */
+static struct mixer_ctl *find_ctl(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < fake_num_ctls; i++)
+        if (strcmp(fake_ctls[i].name, name) == 0)
+            return &fake_ctls[i];
+
+    return NULL;
+}
+
+void fake_pcm_reset(void)
+{
+    pthread_mutex_lock(&fake_lock);
+    memset(fake_stats, 0, sizeof(fake_stats));
+    memset(fake_history, 0, sizeof(fake_history));
+    fake_caps[0] = (struct fake_caps){ 8000, 48000, 2 };
+    fake_caps[1] = (struct fake_caps){ 32000, 192000, 8 };
+    fake_mmap = true;
+    memset(fake_ctls, 0, sizeof(fake_ctls));
+    fake_num_ctls = 0;
+    set_speed(1);
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_pcm_set_speed(unsigned int speed)
+{
+    pthread_mutex_lock(&fake_lock);
+    set_speed(speed);
+    pthread_mutex_unlock(&fake_lock);
+}
+
+int64_t fake_pcm_now_ns(void)
+{
+    int64_t now;
+
+    pthread_mutex_lock(&fake_lock);
+    now = get_virtual_ns();
+    pthread_mutex_unlock(&fake_lock);
+
+    return now;
+}
+
+void fake_pcm_advance_ns(int64_t ns)
+{
+    pthread_mutex_lock(&fake_lock);
+    clock_virtual_ns += ns;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_pcm_set_caps(unsigned int card, unsigned int min_rate, unsigned int max_rate,
+                       unsigned int max_channels)
+{
+    if (card >= FAKE_PCM_CARDS)
+        return;
+
+    pthread_mutex_lock(&fake_lock);
+    fake_caps[card] = (struct fake_caps){ min_rate, max_rate, max_channels };
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_pcm_set_mmap(bool supported)
+{
+    pthread_mutex_lock(&fake_lock);
+    fake_mmap = supported;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_pcm_get_stats(unsigned int card, unsigned int device, unsigned int flags,
+                        struct fake_pcm_stats *stats)
+{
+    struct fake_pcm_stats *s = get_stats(card, device, flags);
+
+    pthread_mutex_lock(&fake_lock);
+    if (s)
+        *stats = *s;
+    else
+        memset(stats, 0, sizeof(*stats));
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_pcm_clear_peak(unsigned int card, unsigned int device)
+{
+    struct fake_pcm_stats *s = get_stats(card, device, PCM_OUT);
+
+    pthread_mutex_lock(&fake_lock);
+    if (s)
+        s->peak = 0;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+unsigned int fake_pcm_get_history(unsigned int card, unsigned int device, int16_t *dst,
+                                  unsigned int frames)
+{
+    struct fake_history *h;
+    uint64_t i;
+
+    if (card >= FAKE_PCM_CARDS || device >= FAKE_PCM_DEVICES)
+        return 0;
+
+    pthread_mutex_lock(&fake_lock);
+    h = &fake_history[card][device];
+    if (frames > FAKE_PCM_HISTORY)
+        frames = FAKE_PCM_HISTORY;
+    if (frames > h->frames)
+        frames = h->frames;
+    for (i = h->frames - frames; i < h->frames; i++)
+        *dst++ = h->samples[i % FAKE_PCM_HISTORY];
+    pthread_mutex_unlock(&fake_lock);
+
+    return frames;
+}
+
+int fake_mixer_add_ctl(const char *name, unsigned int num_values, int value,
+                       const char *const *enums)
+{
+    struct mixer_ctl *ctl;
+    unsigned int i;
+    int ret;
+
+    if (num_values == 0 || num_values > FAKE_MIXER_VALUES)
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    if (fake_num_ctls == FAKE_MIXER_CTLS || find_ctl(name) != NULL) {
+        ret = -EINVAL;
+        goto exit;
+    }
+
+    ctl = &fake_ctls[fake_num_ctls];
+    strlcpy(ctl->name, name, sizeof(ctl->name));
+    ctl->num_values = num_values;
+    for (i = 0; i < num_values; i++)
+        ctl->value[i] = value;
+    ctl->enums = enums;
+    for (ctl->num_enums = 0; enums && enums[ctl->num_enums]; ctl->num_enums++)
+        ;
+    ret = fake_num_ctls++;
+
+exit:
+    pthread_mutex_unlock(&fake_lock);
+
+    return ret;
+}
+
+int fake_mixer_get_value(const char *name, unsigned int id)
+{
+    struct mixer_ctl *ctl;
+    int value = -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    ctl = find_ctl(name);
+    if (ctl && id < ctl->num_values)
+        value = ctl->value[id];
+    pthread_mutex_unlock(&fake_lock);
+
+    return value;
+}
+
+unsigned int fake_mixer_get_writes(const char *name)
+{
+    struct mixer_ctl *ctl;
+    unsigned int writes = 0;
+
+    pthread_mutex_lock(&fake_lock);
+    ctl = find_ctl(name);
+    if (ctl)
+        writes = ctl->writes;
+    pthread_mutex_unlock(&fake_lock);
+
+    return writes;
+}
+
+void fake_mixer_set_fail(const char *name, bool fail)
+{
+    struct mixer_ctl *ctl;
+
+    pthread_mutex_lock(&fake_lock);
+    ctl = find_ctl(name);
+    if (ctl)
+        ctl->fail = fail;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+struct pcm *pcm_open(unsigned int card, unsigned int device, unsigned int flags,
+                     struct pcm_config *config)
+{
+    struct pcm *pcm;
+    struct fake_caps *caps;
+
+    pcm = calloc(1, sizeof(struct pcm));
+    if (pcm == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&fake_lock);
+    pcm->stats = get_stats(card, device, flags);
+    if (pcm->stats && !(flags & PCM_IN))
+        pcm->history = &fake_history[card][device];
+    pcm->flags = flags;
+    pcm->config = *config;
+    if (pcm->stats == NULL) {
+        snprintf(pcm->error, sizeof(pcm->error), "no card %u device %u", card, device);
+        goto exit;
+    }
+
+    caps = &fake_caps[card];
+    if (config->rate < caps->min_rate || config->rate > caps->max_rate ||
+            config->channels == 0 || config->channels > caps->max_channels ||
+            config->period_size == 0 || config->period_count < 2) {
+        snprintf(pcm->error, sizeof(pcm->error), "cannot set hw params: %u Hz %u ch",
+                 config->rate, config->channels);
+        goto exit;
+    }
+    if ((flags & PCM_MMAP) && !fake_mmap) {
+        snprintf(pcm->error, sizeof(pcm->error), "mmap not supported");
+        goto exit;
+    }
+
+    pcm->buffer_size = config->period_size * config->period_count;
+    pcm->frame_bytes = config->channels * sizeof(int16_t);
+    pcm->data = calloc(pcm->buffer_size, pcm->frame_bytes);
+    if (pcm->data == NULL || ((flags & PCM_IN) && init_capture(pcm) != 0)) {
+        snprintf(pcm->error, sizeof(pcm->error), "out of memory");
+        goto exit;
+    }
+    /* the tinyalsa defaults */
+    if (pcm->config.start_threshold == 0)
+        pcm->config.start_threshold = (flags & PCM_IN) ? 1 : pcm->buffer_size / 2;
+
+    pcm->ready = true;
+    pcm->stats->opens++;
+    pcm->stats->open = true;
+    pcm->stats->running = false;
+    pcm->stats->mmap = (flags & PCM_MMAP) != 0;
+    pcm->stats->rate = config->rate;
+    pcm->stats->channels = config->channels;
+    pcm->stats->period_size = config->period_size;
+    pcm->stats->period_count = config->period_count;
+
+exit:
+    pthread_mutex_unlock(&fake_lock);
+
+    return pcm;
+}
+
+int pcm_close(struct pcm *pcm)
+{
+    if (pcm == NULL)
+        return -EFAULT;
+
+    pthread_mutex_lock(&fake_lock);
+    if (pcm->ready) {
+        sync_pcm(pcm);
+        pcm->stats->closes++;
+        pcm->stats->open = false;
+        pcm->stats->running = false;
+    }
+    pthread_mutex_unlock(&fake_lock);
+
+    free(pcm->sine);
+    free(pcm->data);
+    free(pcm);
+
+    return 0;
+}
+
+int pcm_is_ready(struct pcm *pcm)
+{
+    return pcm != NULL && pcm->ready;
+}
+
+const char *pcm_get_error(struct pcm *pcm)
+{
+    return pcm->error;
+}
+
+struct pcm_params *pcm_params_get(unsigned int card, unsigned int device __attribute__((unused)),
+                                  unsigned int flags __attribute__((unused)))
+{
+    struct pcm_params *params;
+
+    if (card >= FAKE_PCM_CARDS)
+        return NULL;
+
+    params = malloc(sizeof(struct pcm_params));
+    if (params == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&fake_lock);
+    params->caps = fake_caps[card];
+    pthread_mutex_unlock(&fake_lock);
+
+    return params;
+}
+
+void pcm_params_free(struct pcm_params *pcm_params)
+{
+    free(pcm_params);
+}
+
+unsigned int pcm_params_get_min(struct pcm_params *pcm_params, enum pcm_param param)
+{
+    switch (param) {
+    case PCM_PARAM_RATE:
+        return pcm_params->caps.min_rate;
+    case PCM_PARAM_CHANNELS:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+unsigned int pcm_params_get_max(struct pcm_params *pcm_params, enum pcm_param param)
+{
+    switch (param) {
+    case PCM_PARAM_RATE:
+        return pcm_params->caps.max_rate;
+    case PCM_PARAM_CHANNELS:
+        return pcm_params->caps.max_channels;
+    default:
+        return 0;
+    }
+}
+
+unsigned int pcm_get_buffer_size(struct pcm *pcm)
+{
+    return pcm->buffer_size;
+}
+
+unsigned int pcm_frames_to_bytes(struct pcm *pcm, unsigned int frames)
+{
+    return frames * pcm->frame_bytes;
+}
+
+unsigned int pcm_bytes_to_frames(struct pcm *pcm, unsigned int bytes)
+{
+    return bytes / pcm->frame_bytes;
+}
+
+int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail, struct timespec *tstamp)
+{
+    int64_t now;
+    int64_t frames;
+
+    if (!pcm_is_ready(pcm))
+        return -1;
+
+    pthread_mutex_lock(&fake_lock);
+    sync_pcm(pcm);
+    if (pcm->state != FAKE_PCM_RUNNING) {
+        pthread_mutex_unlock(&fake_lock);
+        return -1;
+    }
+
+    frames = get_avail(pcm);
+    if (frames > pcm->buffer_size)
+        frames = pcm->buffer_size;
+    *avail = frames;
+
+    now = get_virtual_ns();
+    tstamp->tv_sec = now / 1000000000LL;
+    tstamp->tv_nsec = now % 1000000000LL;
+    pthread_mutex_unlock(&fake_lock);
+
+    return 0;
+}
+
+int pcm_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+    const int16_t *src = (const int16_t *)data;
+    unsigned int frames;
+    int ret = 0;
+
+    if (!pcm_is_ready(pcm) || is_capture(pcm))
+        return -EINVAL;
+
+    frames = count / pcm->frame_bytes;
+
+    pthread_mutex_lock(&fake_lock);
+    sync_pcm(pcm);
+    if (pcm->state == FAKE_PCM_XRUN) {
+        /* PCM_NORESTART: the caller re-prepares */
+        ret = -EPIPE;
+        goto exit;
+    }
+    if (pcm->state == FAKE_PCM_SETUP) {
+        pcm->state = FAKE_PCM_PREPARED;
+        pcm->stats->prepares++;
+    }
+
+    while (frames > 0) {
+        unsigned int n = get_avail(pcm);
+        unsigned int offset = pcm->appl % pcm->buffer_size;
+
+        if (n > frames)
+            n = frames;
+        if (n > pcm->buffer_size - offset)
+            n = pcm->buffer_size - offset;
+
+        if (n == 0) {
+            if (pcm->state != FAKE_PCM_RUNNING)
+                start_pcm(pcm);
+            /* wait for the room of the rest, but never until the buffer is
+             * empty: that would be an xrun */
+            n = pcm->buffer_size - pcm->config.period_size;
+            if (n > frames)
+                n = frames;
+            wait_until(get_hw_time(pcm, pcm->appl + n - pcm->buffer_size));
+            sync_pcm(pcm);
+            if (pcm->state == FAKE_PCM_XRUN) {
+                ret = -EPIPE;
+                goto exit;
+            }
+            continue;
+        }
+
+        memcpy(pcm->data + offset * pcm->config.channels, src, n * pcm->frame_bytes);
+        account_playback(pcm, src, n);
+        pcm->appl += n;
+        src += n * pcm->config.channels;
+        frames -= n;
+
+        if (pcm->state != FAKE_PCM_RUNNING && pcm->appl - pcm->hw >= pcm->config.start_threshold)
+            start_pcm(pcm);
+    }
+
+exit:
+    pthread_mutex_unlock(&fake_lock);
+
+    return ret;
+}
+
+int pcm_read(struct pcm *pcm, void *data, unsigned int count)
+{
+    int16_t *dst = (int16_t *)data;
+    unsigned int frames;
+    int ret = 0;
+
+    if (!pcm_is_ready(pcm) || !is_capture(pcm))
+        return -EINVAL;
+
+    frames = count / pcm->frame_bytes;
+
+    pthread_mutex_lock(&fake_lock);
+    sync_pcm(pcm);
+    if (pcm->state == FAKE_PCM_XRUN) {
+        ret = -EPIPE;
+        goto exit;
+    }
+    if (pcm->state != FAKE_PCM_RUNNING) {
+        if (pcm->state == FAKE_PCM_SETUP)
+            pcm->stats->prepares++;
+        start_pcm(pcm);
+    }
+
+    while (frames > 0) {
+        unsigned int n = get_avail(pcm);
+
+        if (n > frames)
+            n = frames;
+
+        if (n == 0) {
+            /* see pcm_write() */
+            n = pcm->buffer_size - pcm->config.period_size;
+            if (n > frames)
+                n = frames;
+            wait_until(get_hw_time(pcm, pcm->appl + n));
+            sync_pcm(pcm);
+            if (pcm->state == FAKE_PCM_XRUN) {
+                ret = -EPIPE;
+                goto exit;
+            }
+            continue;
+        }
+
+        fill_capture(pcm, dst, n);
+        pcm->appl += n;
+        pcm->stats->appl_frames += n;
+        dst += n * pcm->config.channels;
+        frames -= n;
+    }
+
+exit:
+    pthread_mutex_unlock(&fake_lock);
+
+    return ret;
+}
+
+int pcm_mmap_avail(struct pcm *pcm)
+{
+    int64_t avail;
+
+    if (!pcm_is_ready(pcm) || !is_mmap(pcm))
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    sync_pcm(pcm);
+    avail = get_avail(pcm);
+    if (avail == 0 && pcm->state == FAKE_PCM_RUNNING && clock_speed == 0) {
+        /* free run: the caller would sleep on the hardware, let a period pass */
+        uint64_t target = is_capture(pcm) ? pcm->appl : pcm->appl - pcm->buffer_size;
+
+        wait_until(get_hw_time(pcm, target + pcm->config.period_size));
+        sync_pcm(pcm);
+        avail = get_avail(pcm);
+    }
+    pthread_mutex_unlock(&fake_lock);
+
+    return (int)avail;
+}
+
+int pcm_mmap_begin(struct pcm *pcm, void **areas, unsigned int *offset, unsigned int *frames)
+{
+    int64_t avail;
+    unsigned int n;
+
+    if (!pcm_is_ready(pcm) || !is_mmap(pcm))
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    sync_pcm(pcm);
+    avail = get_avail(pcm);
+    if (avail < 0)
+        avail = 0;
+    if (avail > pcm->buffer_size)
+        avail = pcm->buffer_size;
+
+    *offset = pcm->appl % pcm->buffer_size;
+    n = *frames;
+    if (n > avail)
+        n = avail;
+    if (n > pcm->buffer_size - *offset)
+        n = pcm->buffer_size - *offset;
+    *frames = n;
+    *areas = pcm->data;
+
+    if (is_capture(pcm))
+        fill_capture(pcm, pcm->data + *offset * pcm->config.channels, n);
+    pthread_mutex_unlock(&fake_lock);
+
+    return 0;
+}
+
+int pcm_mmap_commit(struct pcm *pcm, unsigned int offset, unsigned int frames)
+{
+    if (!pcm_is_ready(pcm) || !is_mmap(pcm))
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    if (is_capture(pcm))
+        pcm->stats->appl_frames += frames;
+    else
+        account_playback(pcm, pcm->data + offset * pcm->config.channels, frames);
+    pcm->appl += frames;
+    pthread_mutex_unlock(&fake_lock);
+
+    return frames;
+}
+
+int pcm_prepare(struct pcm *pcm)
+{
+    if (!pcm_is_ready(pcm))
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    sync_pcm(pcm);
+    /* whatever was queued is dropped */
+    pcm->hw = pcm->appl;
+    pcm->state = FAKE_PCM_PREPARED;
+    pcm->stats->prepares++;
+    pcm->stats->running = false;
+    pthread_mutex_unlock(&fake_lock);
+
+    return 0;
+}
+
+int pcm_start(struct pcm *pcm)
+{
+    int ret = 0;
+
+    if (!pcm_is_ready(pcm))
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    sync_pcm(pcm);
+    if (pcm->state == FAKE_PCM_XRUN) {
+        ret = -EPIPE;
+        snprintf(pcm->error, sizeof(pcm->error), "cannot start channel: xrun");
+    } else if (pcm->state != FAKE_PCM_RUNNING) {
+        if (pcm->state == FAKE_PCM_SETUP)
+            pcm->stats->prepares++;
+        start_pcm(pcm);
+    }
+    pthread_mutex_unlock(&fake_lock);
+
+    return ret;
+}
+
+int pcm_stop(struct pcm *pcm)
+{
+    if (!pcm_is_ready(pcm))
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    sync_pcm(pcm);
+    pcm->hw = pcm->appl;
+    pcm->state = FAKE_PCM_SETUP;
+    pcm->stats->stops++;
+    pcm->stats->running = false;
+    pthread_mutex_unlock(&fake_lock);
+
+    return 0;
+}
+
+struct mixer *mixer_open(unsigned int card)
+{
+    struct mixer *mixer = NULL;
+
+    /* a card without controls has no mixer, as on a board without a codec */
+    pthread_mutex_lock(&fake_lock);
+    if (card == 0 && fake_num_ctls > 0)
+        mixer = &fake_mixer;
+    pthread_mutex_unlock(&fake_lock);
+
+    return mixer;
+}
+
+void mixer_close(struct mixer *mixer __attribute__((unused)))
+{
+}
+
+struct mixer_ctl *mixer_get_ctl_by_name(struct mixer *mixer, const char *name)
+{
+    struct mixer_ctl *ctl;
+
+    if (mixer == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&fake_lock);
+    ctl = find_ctl(name);
+    pthread_mutex_unlock(&fake_lock);
+
+    return ctl;
+}
+
+enum mixer_ctl_type mixer_ctl_get_type(struct mixer_ctl *ctl)
+{
+    return ctl->num_enums > 0 ? MIXER_CTL_TYPE_ENUM : MIXER_CTL_TYPE_INT;
+}
+
+unsigned int mixer_ctl_get_num_values(struct mixer_ctl *ctl)
+{
+    return ctl->num_values;
+}
+
+unsigned int mixer_ctl_get_num_enums(struct mixer_ctl *ctl)
+{
+    return ctl->num_enums;
+}
+
+const char *mixer_ctl_get_enum_string(struct mixer_ctl *ctl, unsigned int enum_id)
+{
+    if (enum_id >= ctl->num_enums)
+        return NULL;
+
+    return ctl->enums[enum_id];
+}
+
+int mixer_ctl_get_value(struct mixer_ctl *ctl, unsigned int id)
+{
+    int value;
+
+    if (id >= ctl->num_values)
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    value = ctl->value[id];
+    pthread_mutex_unlock(&fake_lock);
+
+    return value;
+}
+
+int mixer_ctl_set_value(struct mixer_ctl *ctl, unsigned int id, int value)
+{
+    int ret = 0;
+
+    if (id >= ctl->num_values)
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    ctl->writes++;
+    if (ctl->fail || (ctl->num_enums > 0 && (value < 0 || (unsigned int)value >= ctl->num_enums)))
+        ret = -EINVAL;
+    else
+        ctl->value[id] = value;
+    pthread_mutex_unlock(&fake_lock);
+
+    return ret;
+}
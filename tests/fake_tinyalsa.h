@@ -0,0 +1,87 @@
+#ifndef __FAKE_TINYALSA_H__
+#define __FAKE_TINYALSA_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* control side of fake_tinyalsa.c, for the host tests and benchmarks.
+ *
+ * The fake pcms run on a virtual clock. With a speed above 0 it runs speed
+ * times faster than CLOCK_MONOTONIC and calls that wait for the hardware
+ * really sleep. With speed 0 the clock is free running: it only moves when a
+ * call would have to wait, and then jumps to the moment the call completes.
+ * Free run costs no sleeping but only suits a single stream, any other running
+ * pcm sees the jumps as stalls */
+
+#define FAKE_PCM_CARDS 2
+#define FAKE_PCM_DEVICES 4
+
+struct fake_pcm_stats {
+    unsigned int opens;
+    unsigned int closes;
+    unsigned int prepares;
+    unsigned int starts;
+    unsigned int stops;
+    unsigned int xruns;
+    uint64_t frames;        /* played or captured by the hardware */
+    uint64_t appl_frames;   /* written or read by the HAL */
+    int peak;               /* highest absolute sample written */
+    bool open;
+    bool running;
+    bool mmap;              /* of the pcm open now, or the last one */
+    unsigned int rate;
+    unsigned int channels;
+    unsigned int period_size;
+    unsigned int period_count;
+};
+
+/* back to the defaults: speed 1, mmap supported, codec 8-48 kHz stereo on card
+ * 0, HDMI 32-192 kHz 8 channels on card 1, no mixer controls, all counters
+ * cleared */
+void fake_pcm_reset(void);
+
+void fake_pcm_set_speed(unsigned int speed);
+int64_t fake_pcm_now_ns(void);
+/* jump the virtual clock, as if the client had stalled: running pcms xrun */
+void fake_pcm_advance_ns(int64_t ns);
+
+/* what pcm_params_get() reports, pcm_open() fails outside of it */
+void fake_pcm_set_caps(unsigned int card, unsigned int min_rate, unsigned int max_rate,
+                       unsigned int max_channels);
+/* false makes pcm_open(PCM_MMAP) fail, as on a driver without mmap */
+void fake_pcm_set_mmap(bool supported);
+
+/* flags is PCM_OUT or PCM_IN */
+void fake_pcm_get_stats(unsigned int card, unsigned int device, unsigned int flags,
+                        struct fake_pcm_stats *stats);
+void fake_pcm_clear_peak(unsigned int card, unsigned int device);
+
+/* left channel of the last frames played on the device, oldest first, to
+ * follow gain ramps. returns the frames copied, at most FAKE_PCM_HISTORY */
+#define FAKE_PCM_HISTORY 4096
+unsigned int fake_pcm_get_history(unsigned int card, unsigned int device, int16_t *dst,
+                                  unsigned int frames);
+
+/* controls of the mixer of card 0. With none, the default, mixer_open() fails
+ * as on a board without codec controls */
+#define FAKE_MIXER_CTLS 16
+#define FAKE_MIXER_VALUES 8
+
+/* every channel starts at value. enums is NULL for an integer control or a
+ * NULL terminated list of the enum strings. returns the index of the control
+ * or -EINVAL */
+int fake_mixer_add_ctl(const char *name, unsigned int num_values, int value,
+                       const char *const *enums);
+/* value of channel id, or -EINVAL */
+int fake_mixer_get_value(const char *name, unsigned int id);
+/* mixer_ctl_set_value() calls on the control, one per channel written */
+unsigned int fake_mixer_get_writes(const char *name);
+/* true makes mixer_ctl_set_value() fail on the control, the value is kept */
+void fake_mixer_set_fail(const char *name, bool fail);
+
+/* captured audio: a 1 kHz sine at FAKE_PCM_LEFT_AMPLITUDE on the left channel,
+ * at half that on the right one */
+#define FAKE_PCM_LEFT_AMPLITUDE 8192
+#define FAKE_PCM_SINE_HZ 1000
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __AUDIO_UTILS_RESAMPLER_H__
+#define __AUDIO_UTILS_RESAMPLER_H__
+
+/* libaudioutils resampler interface, implemented on the host by a linear
+ * interpolator in fake_resampler.c */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RESAMPLER_QUALITY_MAX 10
+#define RESAMPLER_QUALITY_MIN 0
+#define RESAMPLER_QUALITY_DEFAULT 4
+#define RESAMPLER_QUALITY_VOIP 3
+#define RESAMPLER_QUALITY_DESKTOP 5
+
+struct resampler_buffer {
+    union {
+        void *raw;
+        short *i16;
+        int8_t *i8;
+    };
+    size_t frame_count;
+};
+
+struct resampler_buffer_provider {
+    int (*get_next_buffer)(struct resampler_buffer_provider *provider,
+                           struct resampler_buffer *buffer);
+    void (*release_buffer)(struct resampler_buffer_provider *provider,
+                           struct resampler_buffer *buffer);
+};
+
+struct resampler_itfe {
+    void (*reset)(struct resampler_itfe *resampler);
+    int (*resample_from_provider)(struct resampler_itfe *resampler,
+                                  int16_t *out, size_t *outFrameCount);
+    int (*resample_from_input)(struct resampler_itfe *resampler,
+                               int16_t *in, size_t *inFrameCount,
+                               int16_t *out, size_t *outFrameCount);
+    int32_t (*delay_ns)(struct resampler_itfe *resampler);
+};
+
+int create_resampler(uint32_t inSampleRate, uint32_t outSampleRate, uint32_t channelCount,
+                     uint32_t quality, struct resampler_buffer_provider *provider,
+                     struct resampler_itfe **);
+void release_resampler(struct resampler_itfe *);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef __BIONIC_COMPAT_H__
+#define __BIONIC_COMPAT_H__
+
+/* bionic extensions the HAL relies on, forced into every host build unit.
+ * glibc only has strlcpy() and strlcat() from 2.38 on */
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+#define BIONIC_COMPAT_STRLCPY 1
+size_t strlcpy(char *dst, const char *src, size_t size);
+size_t strlcat(char *dst, const char *src, size_t size);
+#endif
+
+#endif
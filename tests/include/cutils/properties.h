@@ -0,0 +1,12 @@
+#ifndef __CUTILS_PROPERTIES_H__
+#define __CUTILS_PROPERTIES_H__
+
+/* system properties on the host: a table the tests fill with property_set() */
+
+#define PROPERTY_KEY_MAX 32
+#define PROPERTY_VALUE_MAX 92
+
+int property_get(const char *key, char *value, const char *default_value);
+int property_set(const char *key, const char *value);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __SYSTEM_AUDIO_H__
+#define __SYSTEM_AUDIO_H__
+
+/* the audio types and helpers of system/core the HAL uses, same values */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+typedef int audio_io_handle_t;
+typedef int audio_mode_t;
+typedef int audio_source_t;
+typedef uint32_t audio_devices_t;
+typedef uint32_t audio_channel_mask_t;
+
+typedef enum {
+    AUDIO_FORMAT_DEFAULT = 0,
+    AUDIO_FORMAT_PCM = 0,
+    AUDIO_FORMAT_PCM_16_BIT = 0x1,
+    AUDIO_FORMAT_PCM_8_BIT = 0x2,
+    AUDIO_FORMAT_PCM_32_BIT = 0x3,
+    AUDIO_FORMAT_PCM_8_24_BIT = 0x4,
+    AUDIO_FORMAT_PCM_FLOAT = 0x5,
+    AUDIO_FORMAT_PCM_24_BIT_PACKED = 0x6,
+} audio_format_t;
+
+typedef enum {
+    AUDIO_OUTPUT_FLAG_NONE = 0x0,
+    AUDIO_OUTPUT_FLAG_DIRECT = 0x1,
+    AUDIO_OUTPUT_FLAG_PRIMARY = 0x2,
+    AUDIO_OUTPUT_FLAG_FAST = 0x4,
+    AUDIO_OUTPUT_FLAG_DEEP_BUFFER = 0x8,
+    AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD = 0x10,
+    AUDIO_OUTPUT_FLAG_NON_BLOCKING = 0x20,
+    AUDIO_OUTPUT_FLAG_HW_AV_SYNC = 0x40,
+} audio_output_flags_t;
+
+typedef enum {
+    AUDIO_INPUT_FLAG_NONE = 0x0,
+    AUDIO_INPUT_FLAG_FAST = 0x1,
+    AUDIO_INPUT_FLAG_HW_HOTWORD = 0x2,
+} audio_input_flags_t;
+
+#define AUDIO_SOURCE_DEFAULT 0
+#define AUDIO_SOURCE_MIC 1
+#define AUDIO_SOURCE_VOICE_UPLINK 2
+#define AUDIO_SOURCE_VOICE_DOWNLINK 3
+#define AUDIO_SOURCE_VOICE_CALL 4
+#define AUDIO_SOURCE_CAMCORDER 5
+#define AUDIO_SOURCE_VOICE_RECOGNITION 6
+#define AUDIO_SOURCE_VOICE_COMMUNICATION 7
+#define AUDIO_SOURCE_HOTWORD 1999
+
+#define AUDIO_DEVICE_NONE 0x0
+#define AUDIO_DEVICE_BIT_IN 0x80000000u
+#define AUDIO_DEVICE_OUT_EARPIECE 0x1
+#define AUDIO_DEVICE_OUT_SPEAKER 0x2
+#define AUDIO_DEVICE_OUT_WIRED_HEADSET 0x4
+#define AUDIO_DEVICE_OUT_WIRED_HEADPHONE 0x8
+#define AUDIO_DEVICE_OUT_AUX_DIGITAL 0x400
+#define AUDIO_DEVICE_IN_BUILTIN_MIC (AUDIO_DEVICE_BIT_IN | 0x4)
+#define AUDIO_DEVICE_IN_WIRED_HEADSET (AUDIO_DEVICE_BIT_IN | 0x10)
+#define AUDIO_DEVICE_IN_BACK_MIC (AUDIO_DEVICE_BIT_IN | 0x80)
+
+#define AUDIO_CHANNEL_NONE 0x0
+#define AUDIO_CHANNEL_OUT_MONO 0x1
+#define AUDIO_CHANNEL_OUT_STEREO 0x3
+#define AUDIO_CHANNEL_OUT_5POINT1 0x3f
+#define AUDIO_CHANNEL_OUT_7POINT1 0x63f
+#define AUDIO_CHANNEL_IN_STEREO 0xc
+#define AUDIO_CHANNEL_IN_MONO 0x10
+
+#define AUDIO_PARAMETER_STREAM_ROUTING "routing"
+#define AUDIO_PARAMETER_STREAM_INPUT_SOURCE "input_source"
+#define AUDIO_PARAMETER_STREAM_SUP_FORMATS "sup_formats"
+#define AUDIO_PARAMETER_STREAM_SUP_CHANNELS "sup_channels"
+#define AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES "sup_sampling_rates"
+
+static inline uint32_t audio_channel_count_from_in_mask(audio_channel_mask_t channel)
+{
+    return __builtin_popcount(channel);
+}
+
+static inline uint32_t audio_channel_count_from_out_mask(audio_channel_mask_t channel)
+{
+    return __builtin_popcount(channel);
+}
+
+static inline size_t audio_bytes_per_sample(audio_format_t format)
+{
+    switch (format) {
+    case AUDIO_FORMAT_PCM_32_BIT:
+    case AUDIO_FORMAT_PCM_8_24_BIT:
+    case AUDIO_FORMAT_PCM_FLOAT:
+        return 4;
+    case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+        return 3;
+    case AUDIO_FORMAT_PCM_16_BIT:
+        return 2;
+    case AUDIO_FORMAT_PCM_8_BIT:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __TINYALSA_ASOUNDLIB_H__
+#define __TINYALSA_ASOUNDLIB_H__
+
+/* the part of the tinyalsa API the HAL uses, implemented by fake_tinyalsa.c */
+
+#include <stddef.h>
+#include <time.h>
+
+#define PCM_OUT         0x00000000
+#define PCM_IN          0x10000000
+#define PCM_MMAP        0x00000001
+#define PCM_NOIRQ       0x00000002
+#define PCM_NORESTART   0x00000004
+#define PCM_MONOTONIC   0x00000008
+
+struct pcm;
+struct pcm_params;
+struct mixer;
+struct mixer_ctl;
+
+enum pcm_format {
+    PCM_FORMAT_S16_LE = 0,
+    PCM_FORMAT_S32_LE,
+    PCM_FORMAT_S8,
+    PCM_FORMAT_S24_LE,
+    PCM_FORMAT_S24_3LE,
+};
+
+enum pcm_param {
+    PCM_PARAM_SAMPLE_BITS = 8,
+    PCM_PARAM_FRAME_BITS,
+    PCM_PARAM_CHANNELS,
+    PCM_PARAM_RATE,
+    PCM_PARAM_PERIOD_TIME,
+    PCM_PARAM_PERIOD_SIZE,
+    PCM_PARAM_PERIOD_BYTES,
+    PCM_PARAM_PERIODS,
+};
+
+struct pcm_config {
+    unsigned int channels;
+    unsigned int rate;
+    unsigned int period_size;
+    unsigned int period_count;
+    enum pcm_format format;
+    unsigned int start_threshold;
+    unsigned int stop_threshold;
+    unsigned int silence_threshold;
+    int avail_min;
+};
+
+struct pcm *pcm_open(unsigned int card, unsigned int device, unsigned int flags,
+                     struct pcm_config *config);
+int pcm_close(struct pcm *pcm);
+int pcm_is_ready(struct pcm *pcm);
+const char *pcm_get_error(struct pcm *pcm);
+
+struct pcm_params *pcm_params_get(unsigned int card, unsigned int device, unsigned int flags);
+void pcm_params_free(struct pcm_params *pcm_params);
+unsigned int pcm_params_get_min(struct pcm_params *pcm_params, enum pcm_param param);
+unsigned int pcm_params_get_max(struct pcm_params *pcm_params, enum pcm_param param);
+
+unsigned int pcm_get_buffer_size(struct pcm *pcm);
+unsigned int pcm_frames_to_bytes(struct pcm *pcm, unsigned int frames);
+unsigned int pcm_bytes_to_frames(struct pcm *pcm, unsigned int bytes);
+int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail, struct timespec *tstamp);
+
+int pcm_write(struct pcm *pcm, const void *data, unsigned int count);
+int pcm_read(struct pcm *pcm, void *data, unsigned int count);
+int pcm_mmap_begin(struct pcm *pcm, void **areas, unsigned int *offset, unsigned int *frames);
+int pcm_mmap_commit(struct pcm *pcm, unsigned int offset, unsigned int frames);
+int pcm_mmap_avail(struct pcm *pcm);
+
+int pcm_prepare(struct pcm *pcm);
+int pcm_start(struct pcm *pcm);
+int pcm_stop(struct pcm *pcm);
+
+enum mixer_ctl_type {
+    MIXER_CTL_TYPE_BOOL,
+    MIXER_CTL_TYPE_INT,
+    MIXER_CTL_TYPE_ENUM,
+    MIXER_CTL_TYPE_BYTE,
+    MIXER_CTL_TYPE_IEC958,
+    MIXER_CTL_TYPE_INT64,
+    MIXER_CTL_TYPE_UNKNOWN,
+    MIXER_CTL_TYPE_MAX,
+};
+
+struct mixer *mixer_open(unsigned int card);
+void mixer_close(struct mixer *mixer);
+struct mixer_ctl *mixer_get_ctl_by_name(struct mixer *mixer, const char *name);
+enum mixer_ctl_type mixer_ctl_get_type(struct mixer_ctl *ctl);
+unsigned int mixer_ctl_get_num_values(struct mixer_ctl *ctl);
+unsigned int mixer_ctl_get_num_enums(struct mixer_ctl *ctl);
+const char *mixer_ctl_get_enum_string(struct mixer_ctl *ctl, unsigned int enum_id);
+int mixer_ctl_get_value(struct mixer_ctl *ctl, unsigned int id);
+int mixer_ctl_set_value(struct mixer_ctl *ctl, unsigned int id, int value);
+
+#endif
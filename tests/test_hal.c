@@ -0,0 +1,1110 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* end-to-end tests of the HAL on fake_tinyalsa.c: the streams are driven
+ * through the audio_hw_device interface only, as audioflinger would, and
+ * checked against what reached the fake pcms */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "audio_hal.h"
+#include "fake_tinyalsa.h"
+
+#define TONE_AMPLITUDE 10000
+
+/* what the HAL loader would dlsym() */
+extern struct audio_module HAL_MODULE_INFO_SYM;
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                    __func__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static const char *test_properties[] = {
+    "audio.tiny4412.out_mmap",
+    "audio.tiny4412.in_mmap",
+    "audio.tiny4412.out_async",
+    "audio.tiny4412.in_async",
+    "audio.tiny4412.mixer",
+    "audio.tiny4412.in_downmix",
+    "audio.tiny4412.resampler",
+    "audio.tiny4412.warm_standby_ms",
+    "debug.audio.dumpdata",
+    "debug.audio.dumpsize",
+};
+
+/* every test starts from the defaults of a board with a plain codec */
+static void reset_env(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(test_properties) / sizeof(test_properties[0]); i++)
+        property_set(test_properties[i], NULL);
+    fake_pcm_reset();
+}
+
+static struct audio_hw_device *open_device(void)
+{
+    const struct hw_module_t *module = &HAL_MODULE_INFO_SYM.common;
+    struct hw_device_t *device = NULL;
+
+    if (module->methods->open(module, AUDIO_HARDWARE_INTERFACE, &device) != 0)
+        return NULL;
+
+    return (struct audio_hw_device *)device;
+}
+
+static void close_device(struct audio_hw_device *dev)
+{
+    dev->common.close(&dev->common);
+}
+
+static struct audio_stream_out *open_output(struct audio_hw_device *dev,
+                                            audio_output_flags_t flags, uint32_t rate)
+{
+    struct audio_config config;
+    struct audio_stream_out *out = NULL;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = rate;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+
+    if (dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_SPEAKER, flags, &config,
+                                &out, NULL) != 0)
+        return NULL;
+
+    return out;
+}
+
+static struct audio_stream_in *open_input(struct audio_hw_device *dev,
+                                          audio_input_flags_t flags, uint32_t rate)
+{
+    struct audio_config config;
+    struct audio_stream_in *in = NULL;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = rate;
+    config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+
+    if (dev->open_input_stream(dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in, flags,
+                               NULL, AUDIO_SOURCE_MIC) != 0)
+        return NULL;
+
+    return in;
+}
+
+/* write count buffers of a square wave, returns the frames accepted */
+static size_t write_tone(struct audio_stream_out *out, unsigned int count)
+{
+    size_t bytes = out->common.get_buffer_size(&out->common);
+    size_t frames = bytes / audio_stream_out_frame_size(out);
+    int16_t *buffer = malloc(bytes);
+    size_t written = 0;
+    unsigned int i;
+    size_t j;
+
+    if (buffer == NULL)
+        return 0;
+
+    for (j = 0; j < frames * 2; j++)
+        buffer[j] = ((j / 2) & 16) ? TONE_AMPLITUDE : -TONE_AMPLITUDE;
+
+    for (i = 0; i < count; i++) {
+        ssize_t ret = out->write(out, buffer, bytes);
+
+        if (ret > 0)
+            written += ret / audio_stream_out_frame_size(out);
+    }
+    free(buffer);
+
+    return written;
+}
+
+/* read count buffers, returns the highest absolute sample seen */
+static int read_peak(struct audio_stream_in *in, unsigned int count)
+{
+    size_t bytes = in->common.get_buffer_size(&in->common);
+    int16_t *buffer = malloc(bytes);
+    int peak = 0;
+    unsigned int i;
+    size_t j;
+
+    if (buffer == NULL)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        memset(buffer, 0, bytes);
+        if (in->read(in, buffer, bytes) != (ssize_t)bytes)
+            peak = -1;
+        for (j = 0; peak >= 0 && j < bytes / sizeof(int16_t); j++)
+            if (abs(buffer[j]) > peak)
+                peak = abs(buffer[j]);
+    }
+    free(buffer);
+
+    return peak;
+}
+
+static long get_device_parameter(struct audio_hw_device *dev, const char *key)
+{
+    char *str = dev->get_parameters(dev, key);
+    char *value;
+    long ret = -1;
+
+    if (str == NULL)
+        return -1;
+
+    value = strchr(str, '=');
+    if (value != NULL && strncmp(str, key, value - str) == 0)
+        ret = strtol(value + 1, NULL, 10);
+    free(str);
+
+    return ret;
+}
+
+static void test_open_device(void)
+{
+    struct audio_hw_device *dev;
+    int i;
+
+    /* the reaper and tap threads must not survive a close */
+    for (i = 0; i < 2; i++) {
+        dev = open_device();
+        CHECK(dev != NULL);
+        if (dev == NULL)
+            return;
+        CHECK(dev->init_check(dev) == 0);
+        /* audioflinger sends every device key to every HAL */
+        CHECK(dev->set_parameters(dev, "screen_state=on") == 0);
+        close_device(dev);
+    }
+}
+
+static void test_output(void)
+{
+    struct audio_hw_device *dev = open_device();
+    struct audio_stream_out *out;
+    struct fake_pcm_stats stats;
+    size_t frames;
+
+    out = open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 48000);
+    CHECK(out != NULL);
+    if (out == NULL)
+        goto exit;
+
+    CHECK(out->common.get_sample_rate(&out->common) == 48000);
+    CHECK(out->common.get_buffer_size(&out->common) ==
+          AUDIO_HW_OUT_PERIOD_SZ * audio_stream_out_frame_size(out));
+    CHECK(out->get_latency(out) ==
+          AUDIO_HW_OUT_PERIOD_SZ * AUDIO_HW_OUT_PERIOD_CNT * 1000 / 48000);
+
+    /* nothing is opened before the first write */
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.opens == 0);
+
+    frames = write_tone(out, 6);
+    CHECK(frames == 6 * AUDIO_HW_OUT_PERIOD_SZ);
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.opens == 1);
+    CHECK(stats.open && stats.running && !stats.mmap);
+    CHECK(stats.rate == 48000 && stats.channels == 2);
+    CHECK(stats.period_size == AUDIO_HW_OUT_PERIOD_SZ);
+    CHECK(stats.period_count == AUDIO_HW_OUT_PERIOD_CNT);
+    CHECK(stats.appl_frames == frames);
+    CHECK(stats.peak == TONE_AMPLITUDE);
+    CHECK(stats.xruns == 0);
+
+    dev->close_output_stream(dev, out);
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.closes == 1 && !stats.open);
+
+exit:
+    close_device(dev);
+}
+
+static int64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/* presentation position through writes, standby and restart: frames and
+ * timestamps never go back, frames never pass what was written and stay
+ * within the stream latency of it */
+static void check_position(struct audio_hw_device *dev, audio_output_flags_t flags,
+                           uint32_t rate, uint64_t max_queued)
+{
+    struct audio_stream_out *out;
+    struct timespec ts;
+    uint64_t frames, last_frames = 0;
+    uint64_t written = 0;
+    int64_t last_ns = 0;
+    uint32_t dsp_frames;
+    unsigned int i;
+    int positions = 0;
+
+    out = open_output(dev, flags, rate);
+    CHECK(out != NULL);
+    if (out == NULL)
+        return;
+
+    /* nothing to report before the first write */
+    CHECK(out->get_presentation_position(out, &frames, &ts) != 0);
+
+    for (i = 0; i < 40; i++) {
+        written += write_tone(out, 1);
+        if (i == 20)
+            out->common.standby(&out->common);
+
+        /* not running yet, or in standby */
+        if (out->get_presentation_position(out, &frames, &ts) != 0)
+            continue;
+        positions++;
+
+        CHECK(frames >= last_frames);
+        CHECK(timespec_to_ns(&ts) >= last_ns);
+        CHECK(frames <= written);
+        CHECK(written - frames <= max_queued);
+        CHECK(out->get_render_position(out, &dsp_frames) == 0);
+        CHECK(dsp_frames >= (uint32_t)frames);
+
+        last_frames = frames;
+        last_ns = timespec_to_ns(&ts);
+    }
+    /* an async stream fills its ring before the writer starts the pcm */
+    CHECK(positions >= 10);
+    CHECK(last_frames > 0);
+
+    dev->close_output_stream(dev, out);
+}
+
+static void test_output_position(void)
+{
+    struct audio_hw_device *dev = open_device();
+    uint64_t buffer = AUDIO_HW_OUT_PERIOD_SZ * AUDIO_HW_OUT_PERIOD_CNT;
+
+    check_position(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 48000, buffer);
+    check_position(dev, AUDIO_OUTPUT_FLAG_PRIMARY | AUDIO_OUTPUT_FLAG_FAST, 48000,
+                   AUDIO_HW_OUT_FAST_PERIOD_SZ * AUDIO_HW_OUT_FAST_PERIOD_CNT);
+    close_device(dev);
+
+    /* the kernel buffer holds pcm frames, the position counts client frames */
+    reset_env();
+    fake_pcm_set_caps(PCM_CARD, 48000, 48000, 2);
+    dev = open_device();
+    check_position(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 44100,
+                   buffer * 44100 / 48000 + AUDIO_HW_OUT_RS_MARGIN);
+    close_device(dev);
+
+    /* and the ring in front of it in async mode */
+    reset_env();
+    property_set("audio.tiny4412.out_async", "1");
+    dev = open_device();
+    check_position(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 48000, buffer * 3);
+    close_device(dev);
+}
+
+static void test_output_standby(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    struct fake_pcm_stats stats;
+
+    property_set("audio.tiny4412.warm_standby_ms", "2000");
+    dev = open_device();
+    out = open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 48000);
+    CHECK(out != NULL);
+    if (out == NULL)
+        goto exit;
+
+    /* warm standby keeps the pcm open and only stops it */
+    write_tone(out, 4);
+    CHECK(out->common.standby(&out->common) == 0);
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.opens == 1 && stats.stops == 1);
+    CHECK(stats.open && !stats.running);
+
+    write_tone(out, 4);
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.opens == 1 && stats.running);
+    CHECK(stats.appl_frames == 8 * AUDIO_HW_OUT_PERIOD_SZ);
+
+    dev->close_output_stream(dev, out);
+
+exit:
+    close_device(dev);
+
+    /* without warm standby, the default, the pcm is closed right away */
+    reset_env();
+    dev = open_device();
+    out = open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 48000);
+    CHECK(out != NULL);
+    if (out != NULL) {
+        write_tone(out, 4);
+        out->common.standby(&out->common);
+        fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+        CHECK(stats.opens == 1 && stats.closes == 1 && !stats.open);
+
+        write_tone(out, 4);
+        fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+        CHECK(stats.opens == 2 && stats.open);
+
+        /* a pcm failing to open is reported to the caller, the next write
+         * tries again */
+        out->common.standby(&out->common);
+        fake_pcm_set_caps(PCM_CARD, 8000, 16000, 2);
+        CHECK(write_tone(out, 1) == 0);
+        fake_pcm_set_caps(PCM_CARD, 8000, 48000, 2);
+        CHECK(write_tone(out, 1) == AUDIO_HW_OUT_PERIOD_SZ);
+        dev->close_output_stream(dev, out);
+    }
+    close_device(dev);
+}
+
+static void test_output_xrun(void)
+{
+    struct audio_hw_device *dev = open_device();
+    struct audio_stream_out *out;
+    struct fake_pcm_stats stats;
+    size_t frames;
+
+    out = open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 48000);
+    CHECK(out != NULL);
+    if (out == NULL)
+        goto exit;
+
+    write_tone(out, 4);
+    CHECK(get_device_parameter(dev, "tiny4412_out_xruns") == 0);
+
+    /* the client stalls for a second: the pcm drains and the next write
+     * recovers without losing the buffer */
+    fake_pcm_advance_ns(1000000000LL);
+    frames = write_tone(out, 4);
+    CHECK(frames == 4 * AUDIO_HW_OUT_PERIOD_SZ);
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.xruns == 1);
+    CHECK(stats.opens == 1);
+    CHECK(stats.appl_frames == 8 * AUDIO_HW_OUT_PERIOD_SZ);
+    CHECK(get_device_parameter(dev, "tiny4412_out_xruns") == 1);
+
+    dev->close_output_stream(dev, out);
+
+exit:
+    close_device(dev);
+}
+
+/* true when the absolute samples never rise, or never fall */
+static bool is_monotonic(const int16_t *samples, unsigned int count, bool falling)
+{
+    unsigned int i;
+
+    for (i = 1; i < count; i++) {
+        int prev = abs(samples[i - 1]);
+        int cur = abs(samples[i]);
+
+        if (falling ? cur > prev : cur < prev)
+            return false;
+    }
+
+    return true;
+}
+
+static void test_output_volume(void)
+{
+    struct audio_hw_device *dev = open_device();
+    struct audio_stream_out *out;
+    struct fake_pcm_stats stats;
+    int16_t history[AUDIO_HW_OUT_PERIOD_SZ];
+    float volume;
+    bool muted;
+
+    out = open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 48000);
+    CHECK(out != NULL);
+    if (out == NULL)
+        goto exit;
+
+    write_tone(out, 4);
+    CHECK(dev->set_master_volume(dev, 2.0f) == -EINVAL);
+    CHECK(dev->set_master_volume(dev, 0.5f) == 0);
+    CHECK(dev->get_master_volume(dev, &volume) == 0 && volume == 0.5f);
+
+    /* the next buffer ramps down to half over AUDIO_HW_GAIN_RAMP_MS */
+    write_tone(out, 1);
+    CHECK(fake_pcm_get_history(PCM_CARD, PCM_DEVICE, history, AUDIO_HW_OUT_PERIOD_SZ) ==
+          AUDIO_HW_OUT_PERIOD_SZ);
+    CHECK(abs(history[0]) > TONE_AMPLITUDE * 9 / 10);
+    CHECK(is_monotonic(history, AUDIO_HW_OUT_PERIOD_SZ, true));
+    CHECK(abs(history[48000 * AUDIO_HW_GAIN_RAMP_MS / 1000]) == TONE_AMPLITUDE / 2);
+    CHECK(abs(history[AUDIO_HW_OUT_PERIOD_SZ - 1]) == TONE_AMPLITUDE / 2);
+
+    fake_pcm_clear_peak(PCM_CARD, PCM_DEVICE);
+    write_tone(out, 2);
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.peak == TONE_AMPLITUDE / 2);
+
+    /* mute fades out, unmute fades back in to the master volume */
+    CHECK(dev->set_master_mute(dev, true) == 0);
+    CHECK(dev->get_master_mute(dev, &muted) == 0 && muted);
+    write_tone(out, 1);
+    fake_pcm_get_history(PCM_CARD, PCM_DEVICE, history, AUDIO_HW_OUT_PERIOD_SZ);
+    CHECK(is_monotonic(history, AUDIO_HW_OUT_PERIOD_SZ, true));
+    CHECK(history[AUDIO_HW_OUT_PERIOD_SZ - 1] == 0);
+
+    CHECK(dev->set_master_mute(dev, false) == 0);
+    write_tone(out, 1);
+    fake_pcm_get_history(PCM_CARD, PCM_DEVICE, history, AUDIO_HW_OUT_PERIOD_SZ);
+    CHECK(history[0] == 0);
+    CHECK(is_monotonic(history, AUDIO_HW_OUT_PERIOD_SZ, false));
+    CHECK(abs(history[AUDIO_HW_OUT_PERIOD_SZ - 1]) == TONE_AMPLITUDE / 2);
+
+    dev->close_output_stream(dev, out);
+
+exit:
+    close_device(dev);
+}
+
+static void test_output_fast(void)
+{
+    struct audio_hw_device *dev = open_device();
+    struct audio_stream_out *out;
+    struct fake_pcm_stats stats;
+    size_t frames;
+
+    /* a 10 ms buffer: on a loaded host real time scheduling alone would
+     * underrun it, the free running clock only moves when the stream waits */
+    fake_pcm_set_speed(0);
+    out = open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY | AUDIO_OUTPUT_FLAG_FAST, 48000);
+    CHECK(out != NULL);
+    if (out == NULL)
+        goto exit;
+
+    CHECK(out->common.get_buffer_size(&out->common) ==
+          AUDIO_HW_OUT_FAST_PERIOD_SZ * audio_stream_out_frame_size(out));
+
+    frames = write_tone(out, 20);
+    CHECK(frames == 20 * AUDIO_HW_OUT_FAST_PERIOD_SZ);
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.mmap && stats.running);
+    CHECK(stats.period_size == AUDIO_HW_OUT_FAST_PERIOD_SZ);
+    CHECK(stats.period_count == AUDIO_HW_OUT_FAST_PERIOD_CNT);
+    CHECK(stats.appl_frames == frames);
+    CHECK(stats.peak == TONE_AMPLITUDE);
+
+    dev->close_output_stream(dev, out);
+
+exit:
+    close_device(dev);
+
+    /* a driver without mmap: the stream falls back to pcm_write() */
+    reset_env();
+    fake_pcm_set_mmap(false);
+    fake_pcm_set_speed(0);
+    dev = open_device();
+    out = open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY | AUDIO_OUTPUT_FLAG_FAST, 48000);
+    CHECK(out != NULL);
+    if (out != NULL) {
+        frames = write_tone(out, 20);
+        CHECK(frames == 20 * AUDIO_HW_OUT_FAST_PERIOD_SZ);
+
+        fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+        CHECK(!stats.mmap && stats.opens == 1);
+        CHECK(stats.appl_frames == frames);
+        dev->close_output_stream(dev, out);
+    }
+    close_device(dev);
+}
+
+static void test_output_resampled(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    struct fake_pcm_stats stats;
+    size_t frames;
+
+    /* a codec locked to 48 kHz: 44.1 kHz clients are resampled in the HAL */
+    fake_pcm_set_caps(PCM_CARD, 48000, 48000, 2);
+    dev = open_device();
+    out = open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 44100);
+    CHECK(out != NULL);
+    if (out == NULL)
+        goto exit;
+
+    CHECK(out->common.get_sample_rate(&out->common) == 44100);
+    /* 2048 frames at 48 kHz are 1881.6 at 44.1 kHz, rounded up to 16 */
+    CHECK(out->common.get_buffer_size(&out->common) == 1888 * audio_stream_out_frame_size(out));
+
+    frames = write_tone(out, 8);
+    CHECK(frames == 8 * 1888);
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.rate == 48000);
+    CHECK(stats.peak > 0);
+    /* the filter holds back a few frames at most */
+    CHECK(stats.appl_frames <= (uint64_t)frames * 48000 / 44100 + 1);
+    CHECK(stats.appl_frames + 2 * AUDIO_HW_OUT_RS_MARGIN >= (uint64_t)frames * 48000 / 44100);
+
+    dev->close_output_stream(dev, out);
+
+exit:
+    close_device(dev);
+}
+
+static void test_output_mixed(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out[2];
+    struct fake_pcm_stats stats;
+    uint32_t latency;
+
+    property_set("audio.tiny4412.mixer", "1");
+    dev = open_device();
+    out[0] = open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 48000);
+    /* the codec could run 44.1 kHz, the mixer does not */
+    out[1] = open_output(dev, AUDIO_OUTPUT_FLAG_DEEP_BUFFER, 44100);
+    CHECK(out[0] != NULL && out[1] != NULL);
+    if (out[0] == NULL || out[1] == NULL)
+        goto exit;
+
+    CHECK(out[1]->common.get_sample_rate(&out[1]->common) == 44100);
+
+    /* the mixer pcm and the ring in front of it */
+    latency = (AUDIO_HW_OUT_FAST_PERIOD_SZ * AUDIO_HW_OUT_FAST_PERIOD_CNT +
+               AUDIO_HW_OUT_PERIOD_SZ * AUDIO_HW_OUT_PERIOD_CNT * 2) * 1000 / 48000;
+    CHECK(out[0]->get_latency(out[0]) == latency);
+
+    write_tone(out[1], 4);
+    /* more than its ring holds: the mixer has taken some of it when this returns */
+    write_tone(out[0], 12);
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.opens == 1 && stats.rate == 48000);
+    CHECK(stats.period_size == AUDIO_HW_OUT_FAST_PERIOD_SZ);
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE_DEEP, PCM_OUT, &stats);
+    CHECK(stats.opens == 0);
+
+exit:
+    if (out[0])
+        dev->close_output_stream(dev, out[0]);
+    if (out[1])
+        dev->close_output_stream(dev, out[1]);
+    close_device(dev);
+}
+
+static void test_output_hdmi(void)
+{
+    struct audio_hw_device *dev = open_device();
+    struct audio_config config;
+    struct audio_stream_out *out = NULL;
+    int ret;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 48000;
+    config.channel_mask = AUDIO_CHANNEL_OUT_5POINT1;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    ret = dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_AUX_DIGITAL,
+                                  AUDIO_OUTPUT_FLAG_DIRECT, &config, &out, NULL);
+    CHECK(ret == 0 && out != NULL);
+    if (out != NULL) {
+        CHECK(out->common.get_channels(&out->common) == AUDIO_CHANNEL_OUT_5POINT1);
+        dev->close_output_stream(dev, out);
+    }
+
+    /* a rate the sink does not take gets a suggestion from its range */
+    fake_pcm_set_caps(PCM_CARD_SPDIF, 32000, 44100, 8);
+    config.sample_rate = 96000;
+    ret = dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_AUX_DIGITAL,
+                                  AUDIO_OUTPUT_FLAG_DIRECT, &config, &out, NULL);
+    CHECK(ret == -EINVAL && out == NULL);
+    CHECK(config.sample_rate == 32000);
+
+    /* and nothing is suggested when the range holds no known rate */
+    fake_pcm_set_caps(PCM_CARD_SPDIF, 8000, 16000, 8);
+    config.sample_rate = 48000;
+    ret = dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_AUX_DIGITAL,
+                                  AUDIO_OUTPUT_FLAG_DIRECT, &config, &out, NULL);
+    CHECK(ret == -EINVAL && out == NULL);
+    CHECK(config.sample_rate == 48000);
+
+    close_device(dev);
+}
+
+static void test_input(void)
+{
+    struct audio_hw_device *dev = open_device();
+    struct audio_stream_in *in;
+    struct fake_pcm_stats stats;
+    int peak;
+
+    in = open_input(dev, AUDIO_INPUT_FLAG_NONE, 48000);
+    CHECK(in != NULL);
+    if (in == NULL)
+        goto exit;
+
+    CHECK(in->common.get_sample_rate(&in->common) == 48000);
+    CHECK(in->common.get_buffer_size(&in->common) == AUDIO_HW_IN_PERIOD_SZ * sizeof(int16_t));
+
+    /* the left channel of the sine, at unity gain */
+    peak = read_peak(in, 4);
+    CHECK(peak > FAKE_PCM_LEFT_AMPLITUDE * 9 / 10 && peak <= FAKE_PCM_LEFT_AMPLITUDE);
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_IN, &stats);
+    CHECK(stats.opens == 1 && stats.running);
+    CHECK(stats.channels == 2 && stats.rate == 48000);
+
+    CHECK(in->common.standby(&in->common) == 0);
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_IN, &stats);
+    CHECK(!stats.running);
+
+    dev->close_input_stream(dev, in);
+
+exit:
+    close_device(dev);
+}
+
+static void test_input_gain(void)
+{
+    struct audio_hw_device *dev = open_device();
+    struct audio_stream_in *in;
+    int peak[4];
+    bool muted;
+    int i;
+
+    in = open_input(dev, AUDIO_INPUT_FLAG_NONE, 48000);
+    CHECK(in != NULL);
+    if (in == NULL)
+        goto exit;
+
+    /* a buffer is 2048 frames: the fade in of CAPTURE_START_RAMP_MS spans the
+     * first three, each louder than the one before */
+    for (i = 0; i < 4; i++)
+        peak[i] = read_peak(in, 1);
+    CHECK(peak[0] > 0 && peak[0] < FAKE_PCM_LEFT_AMPLITUDE / 2);
+    CHECK(peak[0] < peak[1] && peak[1] < peak[2]);
+    CHECK(peak[2] > FAKE_PCM_LEFT_AMPLITUDE * 9 / 10 && peak[2] <= peak[3]);
+    CHECK(peak[3] <= FAKE_PCM_LEFT_AMPLITUDE);
+
+    CHECK(in->set_gain(in, 1.5f) == -EINVAL);
+    CHECK(in->set_gain(in, 0.5f) == 0);
+    read_peak(in, 1);
+    peak[0] = read_peak(in, 2);
+    CHECK(peak[0] > FAKE_PCM_LEFT_AMPLITUDE * 45 / 100 && peak[0] <= FAKE_PCM_LEFT_AMPLITUDE / 2);
+
+    /* mute fades out within a buffer, there is no step back in on unmute */
+    CHECK(dev->set_mic_mute(dev, true) == 0);
+    CHECK(dev->get_mic_mute(dev, &muted) == 0 && muted);
+    peak[0] = read_peak(in, 1);
+    peak[1] = read_peak(in, 2);
+    CHECK(peak[0] > 0 && peak[0] <= FAKE_PCM_LEFT_AMPLITUDE / 2);
+    CHECK(peak[1] == 0);
+
+    CHECK(dev->set_mic_mute(dev, false) == 0);
+    peak[0] = read_peak(in, 1);
+    peak[1] = read_peak(in, 2);
+    CHECK(peak[0] > 0 && peak[0] <= peak[1]);
+    CHECK(peak[1] > FAKE_PCM_LEFT_AMPLITUDE * 45 / 100 && peak[1] <= FAKE_PCM_LEFT_AMPLITUDE / 2);
+
+    dev->close_input_stream(dev, in);
+
+exit:
+    close_device(dev);
+}
+
+static void test_input_resampled(void)
+{
+    struct audio_hw_device *dev = open_device();
+    struct audio_stream_in *in;
+    struct fake_pcm_stats stats;
+    int peak;
+
+    in = open_input(dev, AUDIO_INPUT_FLAG_NONE, 16000);
+    CHECK(in != NULL);
+    if (in == NULL)
+        goto exit;
+
+    CHECK(in->common.get_sample_rate(&in->common) == 16000);
+    /* 2048 frames at 48 kHz are 682.7 at 16 kHz, rounded up to 16 */
+    CHECK(in->common.get_buffer_size(&in->common) == 688 * sizeof(int16_t));
+
+    /* 1 kHz is well inside the passband */
+    read_peak(in, 1);
+    peak = read_peak(in, 8);
+    CHECK(peak > FAKE_PCM_LEFT_AMPLITUDE * 8 / 10 && peak < FAKE_PCM_LEFT_AMPLITUDE * 11 / 10);
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_IN, &stats);
+    CHECK(stats.rate == 48000);
+    CHECK(stats.appl_frames >= 9 * 688 * 3);
+
+    dev->close_input_stream(dev, in);
+
+exit:
+    close_device(dev);
+}
+
+static void test_output_async(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    struct fake_pcm_stats stats;
+    size_t frames;
+
+    property_set("audio.tiny4412.out_async", "1");
+    dev = open_device();
+    out = open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY, 48000);
+    CHECK(out != NULL);
+    if (out == NULL)
+        goto exit;
+
+    /* the ring takes two kernel buffers before write() blocks */
+    frames = write_tone(out, 12);
+    CHECK(frames == 12 * AUDIO_HW_OUT_PERIOD_SZ);
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_OUT, &stats);
+    CHECK(stats.opens == 1 && stats.running);
+    CHECK(stats.appl_frames > 0 && stats.appl_frames <= frames);
+    CHECK(stats.peak == TONE_AMPLITUDE);
+
+    dev->close_output_stream(dev, out);
+
+exit:
+    close_device(dev);
+}
+
+static void test_input_async(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_in *in;
+    int peak;
+
+    property_set("audio.tiny4412.in_async", "1");
+    dev = open_device();
+    in = open_input(dev, AUDIO_INPUT_FLAG_NONE, 48000);
+    CHECK(in != NULL);
+    if (in == NULL)
+        goto exit;
+
+    peak = read_peak(in, 4);
+    CHECK(peak > FAKE_PCM_LEFT_AMPLITUDE * 9 / 10 && peak <= FAKE_PCM_LEFT_AMPLITUDE);
+
+    dev->close_input_stream(dev, in);
+
+exit:
+    close_device(dev);
+}
+
+static void test_input_shared(void)
+{
+    struct audio_hw_device *dev = open_device();
+    struct audio_stream_in *in[2];
+    struct fake_pcm_stats stats;
+    int peak;
+
+    /* the second stream moves both onto the capture engine and its single pcm */
+    in[0] = open_input(dev, AUDIO_INPUT_FLAG_NONE, 48000);
+    in[1] = open_input(dev, AUDIO_INPUT_FLAG_NONE, 16000);
+    CHECK(in[0] != NULL && in[1] != NULL);
+    if (in[0] == NULL || in[1] == NULL)
+        goto exit;
+
+    /* past the fade in of CAPTURE_START_RAMP_MS */
+    read_peak(in[0], 3);
+    peak = read_peak(in[0], 2);
+    CHECK(peak > FAKE_PCM_LEFT_AMPLITUDE * 9 / 10 && peak <= FAKE_PCM_LEFT_AMPLITUDE);
+    read_peak(in[1], 8);
+    peak = read_peak(in[1], 4);
+    CHECK(peak > FAKE_PCM_LEFT_AMPLITUDE * 8 / 10 && peak < FAKE_PCM_LEFT_AMPLITUDE * 11 / 10);
+
+    fake_pcm_get_stats(PCM_CARD, PCM_DEVICE, PCM_IN, &stats);
+    CHECK(stats.opens == 1 && stats.open);
+
+exit:
+    if (in[0])
+        dev->close_input_stream(dev, in[0]);
+    if (in[1])
+        dev->close_input_stream(dev, in[1]);
+    close_device(dev);
+}
+
+static const char route_config[] =
+    "# a codec with a speaker and a headphone amplifier\n"
+    "default\n"
+    "    \"Playback Volume\" 100\n"
+    "    \"Missing Switch\" 1    # not on this card, skipped\n"
+    "path speaker\n"
+    "    \"DAC Switch\" 1\n"
+    "    \"Speaker Switch\" 1\n"
+    "    \"Playback Volume\" 110\n"
+    "path headphone\n"
+    "    \"DAC Switch\" 1\n"
+    "    \"Headphone Switch\" 1\n"
+    "    \"Playback Volume\" 90\n"
+    "path mic2\n"
+    "    \"ADC Source\" MIC2\n"
+    "path loud\n"
+    "    \"Playback Volume\" 127\n"
+    "    \"Playback Volume\" 120\n";
+
+static void test_route(void)
+{
+    static const char *const adc_sources[] = { "MIC1", "MIC2", NULL };
+    char path[] = "/tmp/test_hal_route_XXXXXX";
+    struct audio_route_engine *route = NULL;
+    int speaker, headphone, mic2, loud;
+    unsigned int writes;
+    int fd;
+
+    fake_mixer_add_ctl("DAC Switch", 1, 0, NULL);
+    fake_mixer_add_ctl("Speaker Switch", 1, 0, NULL);
+    fake_mixer_add_ctl("Headphone Switch", 1, 0, NULL);
+    fake_mixer_add_ctl("Playback Volume", 2, 50, NULL);
+    fake_mixer_add_ctl("ADC Source", 1, 0, adc_sources);
+
+    fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return;
+    CHECK(write(fd, route_config, sizeof(route_config) - 1) ==
+          (ssize_t)sizeof(route_config) - 1);
+    close(fd);
+
+    route = audio_route_engine_open(0, path);
+    CHECK(route != NULL);
+    if (route == NULL)
+        goto exit;
+
+    /* open writes the default section, both channels of the volume */
+    CHECK(route->writes == 1);
+    CHECK(fake_mixer_get_value("Playback Volume", 0) == 100);
+    CHECK(fake_mixer_get_value("Playback Volume", 1) == 100);
+    CHECK(fake_mixer_get_writes("Playback Volume") == 2);
+    CHECK(fake_mixer_get_writes("Speaker Switch") == 0);
+
+    speaker = audio_route_engine_find_path(route, "speaker");
+    headphone = audio_route_engine_find_path(route, "headphone");
+    mic2 = audio_route_engine_find_path(route, "mic2");
+    loud = audio_route_engine_find_path(route, "loud");
+    CHECK(speaker == 0 && headphone == 1 && mic2 == 2 && loud == 3);
+    CHECK(audio_route_engine_find_path(route, "earpiece") == -ENOENT);
+
+    CHECK(audio_route_engine_apply(route, 1u << speaker) == 3);
+    CHECK(fake_mixer_get_value("Speaker Switch", 0) == 1);
+    CHECK(fake_mixer_get_value("Playback Volume", 1) == 110);
+
+    /* the DAC stays on: only what differs between the paths is written */
+    writes = fake_mixer_get_writes("DAC Switch");
+    CHECK(audio_route_engine_apply(route, 1u << headphone) == 3);
+    CHECK(fake_mixer_get_writes("DAC Switch") == writes);
+    CHECK(fake_mixer_get_value("Speaker Switch", 0) == 0);
+    CHECK(fake_mixer_get_value("Headphone Switch", 0) == 1);
+    CHECK(fake_mixer_get_value("Playback Volume", 0) == 90);
+
+    /* enum values are looked up by name */
+    CHECK(audio_route_engine_apply(route, (1u << headphone) | (1u << mic2)) == 1);
+    CHECK(fake_mixer_get_value("ADC Source", 0) == 1);
+
+    /* the later path wins, and within a path the later setting. The ADC goes
+     * back to its boot value */
+    CHECK(audio_route_engine_apply(route, (1u << speaker) | (1u << loud)) == 4);
+    CHECK(fake_mixer_get_value("Playback Volume", 0) == 120);
+    CHECK(fake_mixer_get_value("ADC Source", 0) == 0);
+
+    /* a failed write is retried on the next apply even though the target
+     * did not change */
+    fake_mixer_set_fail("Speaker Switch", true);
+    CHECK(audio_route_engine_apply(route, 1u << headphone) == -EIO);
+    CHECK(fake_mixer_get_value("Speaker Switch", 0) == 1);
+    fake_mixer_set_fail("Speaker Switch", false);
+    writes = fake_mixer_get_writes("Speaker Switch");
+    CHECK(audio_route_engine_apply(route, 1u << headphone) == 1);
+    CHECK(fake_mixer_get_writes("Speaker Switch") == writes + 1);
+    CHECK(fake_mixer_get_value("Speaker Switch", 0) == 0);
+    CHECK(audio_route_engine_apply(route, 1u << headphone) == 0);
+
+    audio_route_engine_close(route);
+
+exit:
+    unlink(path);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* checks the header of a dump of 16 bit mono at rate, returns the data bytes
+ * or -1. The first sample is returned in *first */
+static long read_tap_file(const char *name, unsigned int index, unsigned int rate,
+                          int16_t *first)
+{
+    char path[256];
+    uint8_t header[46];
+    FILE *file;
+    long size;
+    long bytes = -1;
+
+    snprintf(path, sizeof(path), "%s/%s_%u.wav", AUDIO_TAP_DIR, name, index);
+    file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+
+    memset(header, 0, sizeof(header));
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (fread(header, 1, sizeof(header), file) >= 44 &&
+            memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVEfmt ", 8) == 0 &&
+            memcmp(header + 36, "data", 4) == 0 &&
+            get_le32(header + 4) == (uint32_t)size - 8 &&
+            get_le32(header + 16) == 16 && (get_le32(header + 20) & 0xffff) == 1 &&
+            (get_le32(header + 20) >> 16) == 1 && get_le32(header + 24) == rate &&
+            get_le32(header + 28) == rate * 2 && (get_le32(header + 32) & 0xffff) == 2 &&
+            (get_le32(header + 32) >> 16) == 16 &&
+            get_le32(header + 40) == (uint32_t)size - 44)
+        bytes = size - 44;
+    *first = (int16_t)(header[44] | header[45] << 8);
+    fclose(file);
+
+    return bytes;
+}
+
+/* wait for the tap thread to pick up a new tap */
+static bool wait_tap_active(struct audio_tap *tap)
+{
+    int i;
+
+    for (i = 0; i < 1000 && !atomic_load(&tap->active); i++)
+        usleep(1000);
+
+    return atomic_load(&tap->active);
+}
+
+static void test_tap(void)
+{
+    static int16_t samples[128 * 1024];
+    struct audio_tap *tap;
+    unsigned int dropped;
+    int16_t first;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(samples) / sizeof(samples[0]); i++)
+        samples[i] = (int16_t)i;
+
+    mkdir(AUDIO_TAP_DIR, 0755);
+    for (i = 0; i < 4; i++) {
+        char path[256];
+
+        snprintf(path, sizeof(path), "%s/test_tap_%u.wav", AUDIO_TAP_DIR, i);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/test_drop_%u.wav", AUDIO_TAP_DIR, i);
+        unlink(path);
+    }
+
+    /* 40000 bytes in files of 16384: two full files and the rest in a third */
+    property_set("debug.audio.dumpdata", "1");
+    property_set("debug.audio.dumpsize", "16384");
+    CHECK(audio_tap_start() == 0);
+    tap = audio_tap_open("test_tap", 16000, 1);
+    CHECK(tap != NULL && wait_tap_active(tap));
+    if (tap == NULL)
+        goto exit;
+    for (i = 0; i < 10; i++)
+        audio_tap_write(tap, samples + i * 2000, 4000);
+    CHECK(atomic_load(&tap->dropped) == 0);
+    audio_tap_close(tap);
+
+    CHECK(read_tap_file("test_tap", 0, 16000, &first) == 16384 && first == 0);
+    CHECK(read_tap_file("test_tap", 1, 16000, &first) == 16384 && first == 8192);
+    CHECK(read_tap_file("test_tap", 2, 16000, &first) == 40000 - 2 * 16384 && first == 16384);
+    CHECK(read_tap_file("test_tap", 3, 16000, &first) == -1);
+    audio_tap_stop();
+
+    /* twice the ring at once: what did not fit is counted, nothing else lost */
+    property_set("debug.audio.dumpsize", NULL);
+    CHECK(audio_tap_start() == 0);
+    tap = audio_tap_open("test_drop", 16000, 1);
+    CHECK(tap != NULL && wait_tap_active(tap));
+    if (tap == NULL)
+        goto exit;
+    audio_tap_write(tap, samples, sizeof(samples));
+    audio_tap_write(tap, samples, sizeof(samples));
+    dropped = atomic_load(&tap->dropped);
+    audio_tap_close(tap);
+
+    CHECK(dropped > 0);
+    CHECK(read_tap_file("test_drop", 0, 16000, &first) + dropped == 2 * sizeof(samples));
+
+exit:
+    audio_tap_stop();
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} tests[] = {
+    { "open_device", test_open_device },
+    { "output", test_output },
+    { "output_position", test_output_position },
+    { "output_standby", test_output_standby },
+    { "output_xrun", test_output_xrun },
+    { "output_volume", test_output_volume },
+    { "output_fast", test_output_fast },
+    { "output_resampled", test_output_resampled },
+    { "output_async", test_output_async },
+    { "output_mixed", test_output_mixed },
+    { "output_hdmi", test_output_hdmi },
+    { "input", test_input },
+    { "input_gain", test_input_gain },
+    { "input_resampled", test_input_resampled },
+    { "input_async", test_input_async },
+    { "input_shared", test_input_shared },
+    { "route", test_route },
+    { "tap", test_tap },
+};
+
+int main(int argc, char **argv)
+{
+    unsigned int i;
+    int failed = 0;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+
+        if (argc > 1 && strcmp(argv[1], tests[i].name) != 0)
+            continue;
+
+        reset_env();
+        tests[i].run();
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", tests[i].name);
+        if (failures != before)
+            failed++;
+    }
+
+    return failed ? 1 : 0;
+}